@@ -0,0 +1,98 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <dlib/image_processing/frontal_face_detector.h>
+#include "FaceAligner.h"
+#include "ImageStandardizer.h"
+
+/**
+ * Per-face latency of the alignment stage. Detects the faces of an image with dlib's HOG detector and times, per face,
+ *  - the plain crop: bicubic resize of the box to 160x160,
+ *  - the landmarks of the 5-point shape predictor alone,
+ *  - the full alignment: landmarks plus one affine warp to 160x160,
+ *  - the batched paths into the network input: cropStandardizeFaces against alignStandardizeFaces.
+ * If the image holds no face, its center is used as one.
+ *
+ * Usage: ./alignment_bench <image> <shape_predictor_5_face_landmarks.dat>
+ */
+
+static const int faceSize = 160;
+static const int iterations = 200;
+
+template <typename Function>
+static double timePerFace(Function f, int nmbrFaces) {
+    auto start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++)
+        f();
+    auto end = std::chrono::steady_clock::now();
+    double micros = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    return micros / (double(iterations) * nmbrFaces);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cout << "Usage: ./alignment_bench <image> <shape_predictor_5_face_landmarks.dat>" << std::endl;
+        return 0;
+    }
+    cv::Mat frame = cv::imread(argv[1]);
+    if (frame.empty()) {
+        std::cout << "Unable to read " << argv[1] << std::endl;
+        return 1;
+    }
+    AlignmentConfig config;
+    config.enabled = true;
+    config.shapePredictorPath = argv[2];
+    FaceAligner aligner(config);
+    if (!aligner.isLoaded())
+        return 1;
+
+    dlib::frontal_face_detector detector = dlib::get_frontal_face_detector();
+    std::vector<dlib::rectangle> detections = detector(dlib::cv_image<dlib::bgr_pixel>(frame));
+    std::vector<cv::Rect> faceRects;
+    for (const dlib::rectangle& r : detections)
+        faceRects.emplace_back(cv::Point2i(r.left(), r.top()), cv::Point2i(r.right() + 1, r.bottom() + 1));
+    if (faceRects.empty()) {
+        int size = std::min(frame.cols, frame.rows) / 2;
+        faceRects.emplace_back((frame.cols - size) / 2, (frame.rows - size) / 2, size, size);
+    }
+    // the benchmarks crop inside the frame only
+    for (auto& faceRect : faceRects)
+        faceRect &= cv::Rect(0, 0, frame.cols, frame.rows);
+    int nmbrFaces = faceRects.size();
+    std::vector<cv::Mat> frames(nmbrFaces, frame);
+    std::vector<float> tensor(size_t(nmbrFaces) * faceSize * faceSize * 3);
+
+    cv::Mat face, transform;
+    double cropTime = timePerFace([&]() {
+        for (const auto& faceRect : faceRects)
+            cv::resize(frame(faceRect), face, cv::Size(faceSize, faceSize), 0, 0, cv::INTER_CUBIC);
+    }, nmbrFaces);
+    double landmarkTime = timePerFace([&]() {
+        for (const auto& faceRect : faceRects)
+            aligner.getTransform(frame, faceRect, faceSize, transform);
+    }, nmbrFaces);
+    double alignTime = timePerFace([&]() {
+        for (const auto& faceRect : faceRects)
+            aligner.alignFace(frame, faceRect, faceSize, face);
+    }, nmbrFaces);
+    double batchCropTime = timePerFace([&]() {
+        cropStandardizeFaces(frames, faceRects, 0, nmbrFaces, faceSize, CROP_CUBIC, tensor.data());
+    }, nmbrFaces);
+    double batchAlignTime = timePerFace([&]() {
+        aligner.alignStandardizeFaces(frames, faceRects, 0, nmbrFaces, faceSize, tensor.data());
+    }, nmbrFaces);
+
+    std::cout << nmbrFaces << " faces in " << frame.cols << "x" << frame.rows << std::endl;
+    std::cout << "crop + resize:             " << cropTime << "us per face" << std::endl;
+    std::cout << "landmarks:                 " << landmarkTime << "us per face" << std::endl;
+    std::cout << "landmarks + warp:          " << alignTime << "us per face (+" << alignTime - cropTime << "us)" <<
+              std::endl;
+    std::cout << "batch crop + standardize:  " << batchCropTime << "us per face" << std::endl;
+    std::cout << "batch align + standardize: " << batchAlignTime << "us per face (+" <<
+              batchAlignTime - batchCropTime << "us)" << std::endl;
+    return 0;
+}
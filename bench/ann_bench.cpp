@@ -0,0 +1,104 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "EmbeddingGallery.h"
+
+/**
+ * Recall / latency benchmark for the HNSW index of the embedding gallery. Synthetic 512-d embeddings are drawn around
+ * identity centers (several noisy samples per identity, like enrolment photos), the queries are new samples of enrolled
+ * identities. For a sweep over efSearch the recall@1 and recall@k against exact search and the latency per query are
+ * printed. The gallery size can be passed as first argument.
+ */
+
+static const int dim = 512;
+static const int samplesPerIdentity = 4;
+static const int nmbrQueries = 500;
+static const int k = 10;
+
+static void normalize(float* embedding) {
+    float squaredNorm = 0.f;
+    for (int j = 0; j < dim; j++)
+        squaredNorm += embedding[j] * embedding[j];
+    float invNorm = 1.f / std::sqrt(squaredNorm);
+    for (int j = 0; j < dim; j++)
+        embedding[j] *= invNorm;
+}
+
+static void noisySample(std::mt19937& rng, const float* center, float noise, float* sample) {
+    std::normal_distribution<float> normal(0.f, noise / std::sqrt(float(dim)));
+    for (int j = 0; j < dim; j++)
+        sample[j] = center[j] + normal(rng);
+    normalize(sample);
+}
+
+template <typename Function>
+static double millisPerQuery(Function f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / (1000. * nmbrQueries);
+}
+
+int main(int argc, char *argv[]) {
+    int gallerySize = argc > 1 ? std::atoi(argv[1]) : 100000;
+    int nmbrIdentities = std::max(1, gallerySize / samplesPerIdentity);
+    std::mt19937 rng(42);
+    std::normal_distribution<float> normal(0.f, 1.f);
+
+    std::vector<float> centers(size_t(nmbrIdentities) * dim);
+    for (auto& value : centers)
+        value = normal(rng);
+    for (int i = 0; i < nmbrIdentities; i++)
+        normalize(centers.data() + size_t(i) * dim);
+
+    EmbeddingGallery gallery(dim);
+    gallery.reserve(gallerySize);
+    std::vector<float> sample(dim);
+    for (int i = 0; i < gallerySize; i++) {
+        noisySample(rng, centers.data() + size_t(i % nmbrIdentities) * dim, 0.6f, sample.data());
+        gallery.add("id" + std::to_string(i % nmbrIdentities), sample.data());
+    }
+    std::vector<float> queries(size_t(nmbrQueries) * dim);
+    for (int q = 0; q < nmbrQueries; q++)
+        noisySample(rng, centers.data() + size_t(rng() % nmbrIdentities) * dim, 0.6f, queries.data() + q * dim);
+
+    std::vector<std::vector<GalleryMatch> > exact, approximate;
+    double exactMillis = millisPerQuery([&]() {
+        gallery.searchExact(queries.data(), nmbrQueries, k, exact);
+    });
+    std::cout << gallerySize << " embeddings, exact search: " << exactMillis << "ms per query" << std::endl;
+
+    HnswConfig config;
+    auto start = std::chrono::steady_clock::now();
+    gallery.enableIndex(config);
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "HNSW build (M=" << config.M << ", efConstruction=" << config.efConstruction << "): " <<
+              std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+
+    std::cout << "efSearch, recall@1, recall@" << k << ", ms per query" << std::endl;
+    for (int efSearch : {10, 16, 32, 64, 128, 256}) {
+        gallery.setIndexEfSearch(efSearch);
+        double millis = millisPerQuery([&]() {
+            gallery.search(queries.data(), nmbrQueries, k, approximate);
+        });
+        int hitsAt1 = 0, hitsAtK = 0;
+        for (int q = 0; q < nmbrQueries; q++) {
+            if (!approximate[q].empty() && approximate[q][0].index == exact[q][0].index)
+                hitsAt1++;
+            for (const GalleryMatch& match : approximate[q]) {
+                for (const GalleryMatch& truth : exact[q]) {
+                    if (match.index == truth.index) {
+                        hitsAtK++;
+                        break;
+                    }
+                }
+            }
+        }
+        std::cout << efSearch << ", " << double(hitsAt1) / nmbrQueries << ", " <<
+                  double(hitsAtK) / (nmbrQueries * k) << ", " << millis << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,310 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "FaceNet.h"
+#include "VideoStreamer.h"
+
+/**
+ * Reproducible offline benchmark of the recognition path, without camera, display or GPU. Replays the frames of a
+ * video file (through VideoStreamer) or of an image directory (sorted by name) and sweeps
+ *  - session and detector threads: a new classifier per thread count,
+ *  - detector backends: detection of every frame, timed per frame,
+ *  - batch sizes: the faces of consecutive frames are embedded in batches of that many faces, timed per batch,
+ *  - gallery sizes: the embeddings are matched against galleries of random unit embeddings, timed per batch.
+ * A detector name ending in +gate (cascade+gate) runs the backend behind the motion gate of GatedFaceDetector.
+ * The frames are decoded once up front, so decoding does not count. Every combination gives one result row with
+ * p50 / p95 / p99 / max latencies and the throughput of detection, embedding and matching run one after another on
+ * one stream. Results go to stdout as CSV, and to --csv and --json files if given.
+ *
+ * Usage: ./facenet_bench <model.pb> <video file | image directory> [--frames 200] [--threads 0] [--batch 1,8]
+ *        [--detectors cascade,hog] [--gallery 1000,100000] [--cascade ../models/haarcascade_frontalface_default.xml]
+ *        [--csv results.csv] [--json results.json]
+ */
+
+struct Latencies {
+    std::vector<double> millis;
+    double percentile(double q) const {
+        if (millis.empty())
+            return 0.;
+        std::vector<double> sorted(millis);
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[std::min(sorted.size() - 1, size_t(q * (sorted.size() - 1) + 0.5))];
+    }
+    double total() const {
+        double sum = 0.;
+        for (double m : millis)
+            sum += m;
+        return sum;
+    }
+};
+
+// one threads x detector x batch size combination, matched against every gallery size
+struct EmbedRun {
+    int threads;
+    std::string detector;
+    int batchSize;
+    int faces;
+    Latencies detect;
+    Latencies embed;
+    std::vector<cv::Mat> batchEmbeddings;
+};
+
+struct ResultRow {
+    int threads;
+    std::string detector;
+    int batchSize;
+    int gallerySize;
+    int frames;
+    int faces;
+    Latencies detect, embed, match;
+};
+
+static double millisSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() /
+           1000.;
+}
+
+static std::vector<int> parseInts(const std::string& list) {
+    std::vector<int> values;
+    std::stringstream stream(list);
+    std::string value;
+    while (std::getline(stream, value, ','))
+        values.push_back(std::atoi(value.c_str()));
+    return values;
+}
+
+static std::vector<std::string> parseStrings(const std::string& list) {
+    std::vector<std::string> values;
+    std::stringstream stream(list);
+    std::string value;
+    while (std::getline(stream, value, ','))
+        values.push_back(value);
+    return values;
+}
+
+static void loadFrames(const std::string& source, int maxFrames, std::vector<cv::Mat>& frames) {
+    DIR *dir = opendir(source.c_str());
+    if (dir) {
+        std::vector<std::string> names;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_type != DT_DIR)
+                names.push_back(entry->d_name);
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+        for (const std::string& name : names) {
+            if (frames.size() >= maxFrames)
+                break;
+            cv::Mat image = cv::imread(source + "/" + name);
+            if (!image.empty())
+                frames.push_back(image);
+        }
+        return;
+    }
+    VideoStreamer videoStreamer(source, 0, 0);
+    cv::Mat frame;
+    while (frames.size() < maxFrames) {
+        videoStreamer.getFrame(frame);
+        if (frame.empty())
+            break;
+        // the streamer recycles its buffers
+        frames.push_back(frame.clone());
+    }
+}
+
+static const char* csvHeader = "threads,detector,batch_size,gallery_size,frames,faces,detect_p50_ms,detect_p95_ms,"
+                               "detect_p99_ms,detect_max_ms,embed_p50_ms,embed_p95_ms,embed_p99_ms,embed_max_ms,"
+                               "match_p50_ms,match_p95_ms,match_p99_ms,match_max_ms,fps,faces_per_s";
+
+static void writeCsvRow(std::ostream& out, const ResultRow& row) {
+    double seconds = (row.detect.total() + row.embed.total() + row.match.total()) / 1000.;
+    out << row.threads << "," << row.detector << "," << row.batchSize << "," << row.gallerySize << "," << row.frames <<
+        "," << row.faces;
+    for (const Latencies* latencies : {&row.detect, &row.embed, &row.match})
+        out << "," << latencies->percentile(0.5) << "," << latencies->percentile(0.95) << "," <<
+            latencies->percentile(0.99) << "," << latencies->percentile(1.);
+    out << "," << (seconds > 0. ? row.frames / seconds : 0.) << "," << (seconds > 0. ? row.faces / seconds : 0.) <<
+        std::endl;
+}
+
+static void writeJsonLatencies(std::ostream& out, const char* name, const Latencies& latencies) {
+    out << "\"" << name << "_ms\": {\"samples\": " << latencies.millis.size() << ", \"p50\": " <<
+        latencies.percentile(0.5) << ", \"p95\": " << latencies.percentile(0.95) << ", \"p99\": " <<
+        latencies.percentile(0.99) << ", \"max\": " << latencies.percentile(1.) << "}";
+}
+
+static void writeJson(std::ostream& out, const std::string& model, const std::string& source,
+                      const std::vector<ResultRow>& rows) {
+    out << "{\n  \"model\": \"" << model << "\",\n  \"source\": \"" << source << "\",\n  \"hardware_threads\": " <<
+        std::thread::hardware_concurrency() << ",\n  \"opencv\": \"" << CV_VERSION << "\",\n  \"results\": [\n";
+    for (size_t r = 0; r < rows.size(); r++) {
+        const ResultRow& row = rows[r];
+        double seconds = (row.detect.total() + row.embed.total() + row.match.total()) / 1000.;
+        out << "    {\"threads\": " << row.threads << ", \"detector\": \"" << row.detector << "\", \"batch_size\": " <<
+            row.batchSize << ", \"gallery_size\": " << row.gallerySize << ", \"frames\": " << row.frames <<
+            ", \"faces\": " << row.faces << ", ";
+        writeJsonLatencies(out, "detect", row.detect);
+        out << ", ";
+        writeJsonLatencies(out, "embed", row.embed);
+        out << ", ";
+        writeJsonLatencies(out, "match", row.match);
+        out << ", \"fps\": " << (seconds > 0. ? row.frames / seconds : 0.) << ", \"faces_per_s\": " <<
+            (seconds > 0. ? row.faces / seconds : 0.) << "}" << (r + 1 < rows.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cout << "Usage: ./facenet_bench <model.pb> <video file | image directory> [--frames 200] [--threads 0] "
+                     "[--batch 1,8] [--detectors cascade,hog] [--gallery 1000,100000] [--cascade <xml>] "
+                     "[--csv <file>] [--json <file>]" << std::endl;
+        return 0;
+    }
+    std::string modelPath = argv[1], source = argv[2];
+    int maxFrames = 200;
+    std::vector<int> threadCounts = {0}, batchSizes = {1, 8}, gallerySizes = {1000, 100000};
+    std::vector<std::string> detectors = {"cascade", "hog"};
+    std::string cascadePath = "../models/haarcascade_frontalface_default.xml", csvPath, jsonPath;
+    for (int a = 3; a + 1 < argc; a += 2) {
+        std::string option = argv[a], value = argv[a + 1];
+        if (option == "--frames") maxFrames = std::atoi(value.c_str());
+        else if (option == "--threads") threadCounts = parseInts(value);
+        else if (option == "--batch") batchSizes = parseInts(value);
+        else if (option == "--detectors") detectors = parseStrings(value);
+        else if (option == "--gallery") gallerySizes = parseInts(value);
+        else if (option == "--cascade") cascadePath = value;
+        else if (option == "--csv") csvPath = value;
+        else if (option == "--json") jsonPath = value;
+        else std::cerr << "Unknown option " << option << std::endl;
+    }
+    // a batch size of 0 (also what atoi makes of a typo) would never advance through the faces
+    for (int batchSize : batchSizes) {
+        if (batchSize <= 0) {
+            std::cerr << "Batch sizes must be positive: " << batchSize << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<cv::Mat> frames;
+    loadFrames(source, maxFrames, frames);
+    if (frames.empty()) {
+        std::cerr << "No frames in " << source << std::endl;
+        return 1;
+    }
+    std::cerr << frames.size() << " frames loaded from " << source << std::endl;
+
+    std::vector<EmbedRun> runs;
+    for (int threads : threadCounts) {
+        SessionConfig sessionConfig;
+        sessionConfig.intraOpThreads = threads;
+        DetectorConfig detectorConfig;
+        detectorConfig.cascadePath = cascadePath;
+        detectorConfig.numThreads = threads;
+        // a negative count restores OpenCV's default pool
+        cv::setNumThreads(threads > 0 ? threads : -1);
+        FaceNetClassifier classifier(modelPath, 1.f, detectorConfig, sessionConfig);
+        for (const std::string& detector : detectors) {
+            // "+gate" puts the motion gate in front of the backend, e.g. cascade+gate
+            detectorConfig.backend = detector.compare(0, 3, "hog") == 0 ? DETECTOR_CPU_HOG : DETECTOR_CPU_CASCADE;
+            detectorConfig.gate.enabled = detector.find("+gate") != std::string::npos;
+            classifier.setDetector(detectorConfig);
+            // detection once per backend, every batch size embeds the same faces
+            Latencies detect;
+            std::vector<cv::Mat> faceFrames;
+            std::vector<cv::Rect> faceRects, clippedRects, frameRects;
+            for (const cv::Mat& frame : frames) {
+                auto start = std::chrono::steady_clock::now();
+                classifier.detectFaces(frame, frameRects);
+                classifier.clipFaces(frame, frameRects, clippedRects);
+                detect.millis.push_back(millisSince(start));
+                faceRects.insert(faceRects.end(), frameRects.begin(), frameRects.end());
+                faceFrames.insert(faceFrames.end(), frameRects.size(), frame);
+            }
+            classifier.printDetectorReport(std::cerr);
+            for (int batchSize : batchSizes) {
+                EmbedRun run;
+                run.threads = threads;
+                run.detector = detector;
+                run.batchSize = batchSize;
+                run.faces = faceRects.size();
+                run.detect = detect;
+                classifier.setMaxBatchSize(batchSize);
+                classifier.warmUp();
+                for (int firstFace = 0; firstFace < faceRects.size(); firstFace += batchSize) {
+                    int lastFace = std::min<int>(firstFace + batchSize, faceRects.size());
+                    std::vector<cv::Mat> batchFrames(faceFrames.begin() + firstFace, faceFrames.begin() + lastFace);
+                    std::vector<cv::Rect> batchRects(faceRects.begin() + firstFace, faceRects.begin() + lastFace);
+                    cv::Mat embeddings;
+                    auto start = std::chrono::steady_clock::now();
+                    classifier.embed(batchFrames, batchRects, embeddings);
+                    run.embed.millis.push_back(millisSince(start));
+                    run.batchEmbeddings.push_back(embeddings);
+                }
+                std::cerr << "threads " << threads << ", " << detector << ", batch " << batchSize << ": " <<
+                          run.faces << " faces embedded" << std::endl;
+                runs.push_back(run);
+            }
+        }
+    }
+
+    // galleries of random unit embeddings, grown from one size to the next, the same for every run
+    std::sort(gallerySizes.begin(), gallerySizes.end());
+    EmbeddingGallery gallery;
+    cv::RNG rng(42);
+    cv::Mat embedding(1, gallery.dim(), CV_32F);
+    std::vector<ResultRow> rows;
+    std::vector<std::vector<GalleryMatch> > matches;
+    for (int gallerySize : gallerySizes) {
+        gallery.reserve(gallerySize);
+        while (gallery.size() < gallerySize) {
+            rng.fill(embedding, cv::RNG::NORMAL, 0., 1.);
+            embedding /= cv::norm(embedding);
+            gallery.add("identity" + std::to_string(gallery.size()), embedding.ptr<float>());
+        }
+        for (const EmbedRun& run : runs) {
+            ResultRow row;
+            row.threads = run.threads;
+            row.detector = run.detector;
+            row.batchSize = run.batchSize;
+            row.gallerySize = gallerySize;
+            row.frames = frames.size();
+            row.faces = run.faces;
+            row.detect = run.detect;
+            row.embed = run.embed;
+            for (const cv::Mat& embeddings : run.batchEmbeddings) {
+                if (embeddings.empty())
+                    continue;
+                auto start = std::chrono::steady_clock::now();
+                gallery.search(embeddings.ptr<float>(), embeddings.rows, 1, matches);
+                row.match.millis.push_back(millisSince(start));
+            }
+            rows.push_back(row);
+        }
+    }
+
+    std::cout << csvHeader << std::endl;
+    for (const ResultRow& row : rows)
+        writeCsvRow(std::cout, row);
+    if (!csvPath.empty()) {
+        std::ofstream csv(csvPath);
+        csv << csvHeader << std::endl;
+        for (const ResultRow& row : rows)
+            writeCsvRow(csv, row);
+    }
+    if (!jsonPath.empty()) {
+        std::ofstream json(jsonPath);
+        writeJson(json, modelPath, source, rows);
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "EmbeddingGallery.h"
+
+/**
+ * Micro benchmark for the embedding gallery. Fills galleries of 1k, 10k, 100k and 1M random L2-normalized 512-d
+ * embeddings, times a batched top-k search and checks the nearest match of every probe against a scalar brute force
+ * scan. The largest gallery size can be passed as first argument (the 1M gallery needs 2GB of memory).
+ */
+
+static const int dim = 512;
+static const int nmbrProbes = 8;
+static const int k = 5;
+static const int iterations = 5;
+
+static void randomEmbedding(std::mt19937& rng, float* embedding) {
+    std::normal_distribution<float> normal(0.f, 1.f);
+    float squaredNorm = 0.f;
+    for (int j = 0; j < dim; j++) {
+        embedding[j] = normal(rng);
+        squaredNorm += embedding[j] * embedding[j];
+    }
+    float invNorm = 1.f / std::sqrt(squaredNorm);
+    for (int j = 0; j < dim; j++)
+        embedding[j] *= invNorm;
+}
+
+// the nearest row like computeEuclidDistanceAndClassify found it before the gallery, one distance at a time
+static int bruteForceNearest(const EmbeddingGallery& gallery, const float* probe) {
+    int winner = -1;
+    double minDistance = 1e30;
+    for (int i = 0; i < gallery.size(); i++) {
+        const float* embedding = gallery.getEmbedding(i);
+        double distance = 0.;
+        for (int j = 0; j < dim; j++)
+            distance += double(probe[j] - embedding[j]) * (probe[j] - embedding[j]);
+        if (distance < minDistance) {
+            minDistance = distance;
+            winner = i;
+        }
+    }
+    return winner;
+}
+
+int main(int argc, char *argv[]) {
+    int maxSize = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    std::mt19937 rng(42);
+    std::vector<float> embedding(dim);
+    std::vector<float> probes(nmbrProbes * dim);
+    std::vector<std::vector<GalleryMatch> > matches;
+    bool mismatch = false;
+
+    for (int gallerySize = 1000; gallerySize <= maxSize; gallerySize *= 10) {
+        EmbeddingGallery gallery(dim);
+        gallery.reserve(gallerySize);
+        for (int i = 0; i < gallerySize; i++) {
+            randomEmbedding(rng, embedding.data());
+            gallery.add("id" + std::to_string(i), embedding.data());
+        }
+        // probes are noisy copies of enrolled embeddings, like a known person seen again
+        for (int p = 0; p < nmbrProbes; p++) {
+            const float* enrolled = gallery.getEmbedding(int(rng() % gallerySize));
+            randomEmbedding(rng, probes.data() + p * dim);
+            for (int j = 0; j < dim; j++)
+                probes[p * dim + j] = enrolled[j] + 0.5f * probes[p * dim + j];
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int it = 0; it < iterations; it++)
+            gallery.search(probes.data(), nmbrProbes, k, matches);
+        auto end = std::chrono::steady_clock::now();
+        double millis = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.;
+
+        for (int p = 0; p < nmbrProbes; p++) {
+            if (matches[p][0].index != bruteForceNearest(gallery, probes.data() + p * dim))
+                mismatch = true;
+        }
+        std::cout << gallerySize << " identities: " << millis / iterations << "ms per batch of " << nmbrProbes <<
+                  " probes, " << millis / (iterations * nmbrProbes) << "ms per probe" << std::endl;
+    }
+
+    if (mismatch) {
+        std::cout << "Nearest matches differ from brute force search!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
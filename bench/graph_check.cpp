@@ -0,0 +1,99 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include "FaceNet.h"
+
+/**
+ * Accuracy check for the graph optimizer. Embeds the same faces with the model as it is and with the optimized graph
+ * (written next to the model if it does not exist yet), prints the largest absolute difference and the smallest cosine
+ * similarity between the two embeddings of every face, and the time per batch of both graphs. Faces are random crops
+ * plus, if a directory is given, every image in it resized to 160x160. Exits with 1 if an embedding changed by more
+ * than the tolerance.
+ *
+ * Usage: ./graph_check <model.pb> [Path/To/Face/Crops]
+ */
+
+static const int nmbrRandomFaces = 16;
+static const int iterations = 10;
+static const float tolerance = 1e-4f;
+
+static void embedTimed(FaceNetClassifier& classifier, const std::vector<cv::Mat>& faces, cv::Mat& embeddings,
+                       double& millisPerBatch) {
+    classifier.embed(faces, embeddings);
+    auto start = std::chrono::steady_clock::now();
+    cv::Mat timed;
+    for (int it = 0; it < iterations; it++)
+        classifier.embed(faces, timed);
+    millisPerBatch = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count() / 1000. / iterations;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cout << "Usage: ./graph_check <model.pb> [Path/To/Face/Crops]" << std::endl;
+        return 0;
+    }
+    std::vector<cv::Mat> faces(nmbrRandomFaces);
+    cv::RNG rng(42);
+    for (auto& face : faces) {
+        face.create(160, 160, CV_8UC3);
+        rng.fill(face, cv::RNG::UNIFORM, 0, 256);
+    }
+    if (argc > 2) {
+        DIR *dir = opendir(argv[2]);
+        struct dirent *entry;
+        while (dir && (entry = readdir(dir)) != NULL) {
+            cv::Mat image = cv::imread(std::string(argv[2]) + "/" + entry->d_name);
+            if (image.empty())
+                continue;
+            cv::Mat face;
+            cv::resize(image, face, cv::Size(160, 160), 0, 0, cv::INTER_CUBIC);
+            faces.push_back(face);
+        }
+        if (dir)
+            closedir(dir);
+    }
+
+    DetectorConfig detectorConfig;
+    SessionConfig sessionConfig;
+    sessionConfig.useOptimizedGraph = false;
+    cv::Mat reference, optimized;
+    double referenceMillis, optimizedMillis;
+    {
+        FaceNetClassifier classifier(argv[1], 1.f, detectorConfig, sessionConfig);
+        embedTimed(classifier, faces, reference, referenceMillis);
+    }
+    sessionConfig.useOptimizedGraph = true;
+    {
+        FaceNetClassifier classifier(argv[1], 1.f, detectorConfig, sessionConfig);
+        embedTimed(classifier, faces, optimized, optimizedMillis);
+    }
+    if (reference.rows != faces.size() || optimized.rows != faces.size()) {
+        std::cout << "inference failed" << std::endl;
+        return 1;
+    }
+
+    double maxDifference = 0., minCosine = 1.;
+    for (int i = 0; i < reference.rows; i++) {
+        double dot = reference.row(i).dot(optimized.row(i));
+        double norms = cv::norm(reference.row(i)) * cv::norm(optimized.row(i));
+        minCosine = std::min(minCosine, norms > 0. ? dot / norms : 0.);
+        maxDifference = std::max(maxDifference, cv::norm(reference.row(i), optimized.row(i), cv::NORM_INF));
+    }
+    std::cout << faces.size() << " faces, max abs difference " << maxDifference << ", min cosine similarity " <<
+              minCosine << std::endl;
+    std::cout << "batch of " << faces.size() << ": " << referenceMillis << " ms original, " << optimizedMillis <<
+              " ms optimized" << std::endl;
+    if (maxDifference > tolerance) {
+        std::cout << "FAILED: embeddings differ by more than " << tolerance << std::endl;
+        return 1;
+    }
+    std::cout << "OK" << std::endl;
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include "ImageStandardizer.h"
+
+/**
+ * Micro benchmark for the input preprocessing. Compares the former preprocessInput + createInputTensor path (cvtColor,
+ * meanStdDev and convertTo in double precision) with the fused standardizeFace kernel on random 160x160 crops, checks
+ * that both produce the same tensor values within tolerance and prints the time per face.
+ * The second part starts from the face rectangles of a 1080p frame: crop, resize and standardize face by face against
+ * cropStandardizeFaces over all faces at once, with bicubic and bilinear interpolation.
+ */
+
+static const int faceSize = 160;
+static const int nmbrFaces = 8;
+static const int iterations = 200;
+static const float tolerance = 1e-4f;
+static const int nmbrFrameFaces = 16;
+
+// the path FaceNetClassifier used before the fused kernel, writes into dst like createInputTensor did
+static void referencePreprocess(const cv::Mat& face, float* dst) {
+    cv::Mat image;
+    cv::cvtColor(face, image, cv::COLOR_RGB2BGR);
+    cv::Mat temp = image.reshape(1, image.rows * 3);
+    cv::Mat mean3;
+    cv::Mat stddev3;
+    cv::meanStdDev(temp, mean3, stddev3);
+
+    double mean_pxl = mean3.at<double>(0);
+    double stddev_pxl = stddev3.at<double>(0);
+    cv::Mat image2;
+    image.convertTo(image2, CV_64FC1);
+    cv::Mat mat(4, 1, CV_64FC1);
+    mat.at<double>(0, 0) = mean_pxl;
+    mat.at<double>(1, 0) = mean_pxl;
+    mat.at<double>(2, 0) = mean_pxl;
+    mat.at<double>(3, 0) = 0;
+    image2 = image2 - mat;
+    image2 = image2 / stddev_pxl;
+
+    cv::Mat tensorView(faceSize, faceSize, CV_32FC3, dst);
+    image2.convertTo(tensorView, CV_32FC3);
+}
+
+// the crop of FaceExtractor::cropFace followed by standardizeFace, one face at a time
+static void cropThenStandardize(const cv::Mat& frame, const cv::Rect& faceRect, float* dst) {
+    cv::Mat croppedFace;
+    cv::resize(frame(faceRect), croppedFace, cv::Size(faceSize, faceSize), 0, 0, cv::INTER_CUBIC);
+    standardizeFace(croppedFace, dst);
+}
+
+template <typename Function>
+static double timePerFace(Function f, int facesPerIteration = nmbrFaces) {
+    auto start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++)
+        f();
+    auto end = std::chrono::steady_clock::now();
+    double micros = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    return micros / (double(iterations) * facesPerIteration);
+}
+
+int main() {
+    const size_t faceLength = size_t(faceSize) * faceSize * 3;
+    std::vector<cv::Mat> faces(nmbrFaces);
+    cv::RNG rng(42);
+    for (auto& face : faces) {
+        face.create(faceSize, faceSize, CV_8UC3);
+        rng.fill(face, cv::RNG::UNIFORM, 0, 256);
+    }
+    // a ROI view, crops handed to createInputTensor do not have to be continuous
+    cv::Mat frame(2 * faceSize, 2 * faceSize, CV_8UC3);
+    rng.fill(frame, cv::RNG::UNIFORM, 0, 256);
+    faces.back() = frame(cv::Rect(7, 13, faceSize, faceSize));
+
+    std::vector<float> reference(nmbrFaces * faceLength);
+    std::vector<float> fused(nmbrFaces * faceLength);
+
+    double referenceTime = timePerFace([&]() {
+        for (int i = 0; i < nmbrFaces; i++)
+            referencePreprocess(faces[i], reference.data() + i * faceLength);
+    });
+    double fusedTime = timePerFace([&]() {
+        for (int i = 0; i < nmbrFaces; i++)
+            standardizeFace(faces[i], fused.data() + i * faceLength);
+    });
+
+    float maxError = 0.f;
+    for (size_t i = 0; i < reference.size(); i++)
+        maxError = std::max(maxError, std::abs(reference[i] - fused[i]));
+
+    std::cout << "reference: " << referenceTime << "us per face" << std::endl;
+    std::cout << "fused:     " << fusedTime << "us per face (" << referenceTime / fusedTime << "x)" << std::endl;
+    std::cout << "max abs error: " << maxError << std::endl;
+
+    // faces of 100 to 300 pixels inside a 1080p frame, as the detector returns them
+    cv::Mat hdFrame(1080, 1920, CV_8UC3);
+    rng.fill(hdFrame, cv::RNG::UNIFORM, 0, 256);
+    cv::GaussianBlur(hdFrame, hdFrame, cv::Size(5, 5), 0);
+    std::vector<cv::Rect> faceRects;
+    for (int i = 0; i < nmbrFrameFaces; i++) {
+        int size = rng.uniform(100, 300);
+        faceRects.emplace_back(rng.uniform(0, hdFrame.cols - size), rng.uniform(0, hdFrame.rows - size), size, size);
+    }
+    std::vector<cv::Mat> frames(nmbrFrameFaces, hdFrame);
+    std::vector<float> perFace(nmbrFrameFaces * faceLength);
+    std::vector<float> batchCubic(nmbrFrameFaces * faceLength);
+    std::vector<float> batchLinear(nmbrFrameFaces * faceLength);
+
+    double perFaceTime = timePerFace([&]() {
+        for (int i = 0; i < nmbrFrameFaces; i++)
+            cropThenStandardize(hdFrame, faceRects[i], perFace.data() + i * faceLength);
+    }, nmbrFrameFaces);
+    double cubicTime = timePerFace([&]() {
+        cropStandardizeFaces(frames, faceRects, 0, nmbrFrameFaces, faceSize, CROP_CUBIC, batchCubic.data());
+    }, nmbrFrameFaces);
+    double linearTime = timePerFace([&]() {
+        cropStandardizeFaces(frames, faceRects, 0, nmbrFrameFaces, faceSize, CROP_BILINEAR, batchLinear.data());
+    }, nmbrFrameFaces);
+
+    float maxCropError = 0.f;
+    for (size_t i = 0; i < perFace.size(); i++)
+        maxCropError = std::max(maxCropError, std::abs(perFace[i] - batchCubic[i]));
+
+    std::cout << nmbrFrameFaces << " faces of a 1080p frame, crop + resize + standardize:" << std::endl;
+    std::cout << "per face:       " << perFaceTime << "us per face" << std::endl;
+    std::cout << "batch bicubic:  " << cubicTime << "us per face (" << perFaceTime / cubicTime << "x)" << std::endl;
+    std::cout << "batch bilinear: " << linearTime << "us per face (" << perFaceTime / linearTime << "x)" << std::endl;
+    std::cout << "max abs error batch bicubic: " << maxCropError << std::endl;
+
+    if (maxError > tolerance || maxCropError > tolerance) {
+        std::cout << "Results differ by more than " << tolerance << "!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
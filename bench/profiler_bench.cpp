@@ -0,0 +1,100 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "Profiler.h"
+
+/**
+ * Overhead benchmark for the Profiler. A small stand-in stage (a 512-d squared distance, repeated to take a few
+ * microseconds, shorter than any real stage) runs without a timer, with a disabled ScopedTimer and with an enabled one.
+ * The cost per sample is printed, relative to the stage and to a 30 fps frame. Then short-lived threads are started in
+ * waves, like the connection threads of the recognition server, to check that the histograms of exited threads are
+ * reused and no sample is lost. The number of distance repetitions per stage can be passed as first argument.
+ */
+
+static const int dim = 512;
+static const int nmbrSamples = 200000;
+static const int nmbrWaves = 250;
+static const int threadsPerWave = 8;
+// every stage once plus crop and preprocess for a few faces
+static const int samplesPerFrame = 16;
+static const double nanosPerFrame = 1e9 / 30.;
+
+static volatile float sink;
+
+static float stage(const std::vector<float>& a, const std::vector<float>& b, int repetitions) {
+    float sum = 0.f;
+    for (int r = 0; r < repetitions; r++) {
+        for (int j = 0; j < dim; j++) {
+            float difference = a[j] - b[j] + float(r);
+            sum += difference * difference;
+        }
+    }
+    return sum;
+}
+
+enum TimerMode {
+    NO_TIMER,
+    DISABLED_TIMER,
+    ENABLED_TIMER
+};
+
+static double nanosPerStage(TimerMode mode, const std::vector<float>& a, const std::vector<float>& b, int repetitions) {
+    Profiler::setEnabled(mode == ENABLED_TIMER);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < nmbrSamples; i++) {
+        if (mode == NO_TIMER) {
+            sink = stage(a, b, repetitions);
+        }
+        else {
+            ScopedTimer timer(PROFILE_MATCH);
+            sink = stage(a, b, repetitions);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    Profiler::setEnabled(false);
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()) / nmbrSamples;
+}
+
+int main(int argc, char *argv[]) {
+    int repetitions = argc > 1 ? std::max(1, std::atoi(argv[1])) : 4;
+    std::vector<float> a(dim, 0.25f), b(dim, 0.75f);
+
+    // warm up the clock, the caches and the histograms of this thread
+    nanosPerStage(ENABLED_TIMER, a, b, repetitions);
+    Profiler::reset();
+
+    std::cout << "timer, ns per stage, ns per sample, stage overhead, frame overhead" << std::endl;
+    double baseline = nanosPerStage(NO_TIMER, a, b, repetitions);
+    std::cout << "none, " << baseline << ", 0, 0%, 0%" << std::endl;
+    const TimerMode modes[] = {DISABLED_TIMER, ENABLED_TIMER};
+    for (TimerMode mode : modes) {
+        double nanos = nanosPerStage(mode, a, b, repetitions);
+        std::cout << (mode == DISABLED_TIMER ? "disabled" : "enabled") << ", " << nanos << ", " << nanos - baseline <<
+                  ", " << 100. * (nanos - baseline) / baseline << "%, " <<
+                  100. * samplesPerFrame * (nanos - baseline) / nanosPerFrame << "%" << std::endl;
+    }
+
+    Profiler::reset();
+    Profiler::setEnabled(true);
+    size_t setsBefore = Profiler::getHistogramSets();
+    for (int wave = 0; wave < nmbrWaves; wave++) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadsPerWave; t++) {
+            threads.emplace_back([]() {
+                for (int i = 0; i < 100; i++)
+                    Profiler::record(PROFILE_MATCH, 1000);
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+    }
+    Profiler::setEnabled(false);
+    ProfileSummary summary;
+    Profiler::getStageSummary(PROFILE_MATCH, summary);
+    std::cout << nmbrWaves * threadsPerWave << " threads in waves of " << threadsPerWave << ": " <<
+              Profiler::getHistogramSets() - setsBefore << " new histogram sets, " << summary.count << " of " <<
+              nmbrWaves * threadsPerWave * 100 << " samples" << std::endl;
+    return 0;
+}
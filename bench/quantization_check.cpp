@@ -0,0 +1,149 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include "FaceNet.h"
+
+/**
+ * Accuracy regression harness for the reduced precision models. Embeds the images of a labelled pair set with the
+ * float32, fp16 and int8 graphs and prints per precision
+ *  - the cosine drift against float32 (mean and largest 1 - cosine similarity per image),
+ *  - the verification accuracy: a pair counts as the same person if the distance is below the threshold,
+ *  - the time per batch and the speedup against float32. fp16 is a storage format that runs as float32, so no speedup
+ *    is reported for it; int8 usually comes out slower than float32 with TensorFlow's reference int8 kernels.
+ * The pairs file has one pair per line: "<image1> <image2> <1 if same person, 0 otherwise>". The int8 graph is
+ * calibrated on the images of the calibration directory (e.g. the enrolment images) unless <model>.int8.pb exists.
+ *
+ * Usage: ./quantization_check <model.pb> <pairs.txt> <Path/To/Calibration/Images> [threshold=1.0]
+ */
+
+static const int batchSize = 8;
+
+struct Pair {
+    int first;
+    int second;
+    bool same;
+};
+
+static void embedAll(FaceNetClassifier& classifier, const std::vector<cv::Mat>& faces, cv::Mat& embeddings,
+                     double& millisPerBatch) {
+    embeddings.release();
+    double millis = 0.;
+    int batches = 0;
+    for (int firstFace = 0; firstFace < faces.size(); firstFace += batchSize) {
+        std::vector<cv::Mat> batch(faces.begin() + firstFace,
+                                   faces.begin() + std::min<int>(firstFace + batchSize, faces.size()));
+        cv::Mat batchEmbeddings;
+        auto start = std::chrono::steady_clock::now();
+        classifier.embed(batch, batchEmbeddings);
+        millis += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count() / 1000.;
+        batches++;
+        embeddings.push_back(batchEmbeddings);
+    }
+    millisPerBatch = batches > 0 ? millis / batches : 0.;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        std::cout << "Usage: ./quantization_check <model.pb> <pairs.txt> <Path/To/Calibration/Images> [threshold=1.0]"
+                  << std::endl;
+        return 0;
+    }
+    float threshold = argc > 4 ? std::atof(argv[4]) : 1.f;
+
+    std::map<std::string, int> imageIndices;
+    std::vector<std::string> imagePaths;
+    std::vector<Pair> pairs;
+    std::ifstream pairsFile(argv[2]);
+    std::string line;
+    while (std::getline(pairsFile, line)) {
+        std::istringstream fields(line);
+        std::string paths[2];
+        int same;
+        if (!(fields >> paths[0] >> paths[1] >> same))
+            continue;
+        int indices[2];
+        for (int j = 0; j < 2; j++) {
+            auto found = imageIndices.find(paths[j]);
+            if (found == imageIndices.end()) {
+                found = imageIndices.insert({paths[j], int(imagePaths.size())}).first;
+                imagePaths.push_back(paths[j]);
+            }
+            indices[j] = found->second;
+        }
+        pairs.push_back({indices[0], indices[1], same != 0});
+    }
+    if (pairs.empty()) {
+        std::cout << "No pairs in " << argv[2] << std::endl;
+        return 1;
+    }
+
+    const char* names[] = {"float32", "fp16", "int8"};
+    ModelPrecision precisions[] = {PRECISION_FLOAT32, PRECISION_FLOAT16_STORAGE, PRECISION_INT8};
+    DetectorConfig detectorConfig;
+    cv::Mat reference;
+    double referenceMillis = 0.;
+    std::cout << "precision  mean drift   max drift   accuracy   ms/batch   speedup" << std::endl;
+    for (int p = 0; p < 3; p++) {
+        SessionConfig sessionConfig;
+        sessionConfig.precision = precisions[p];
+        sessionConfig.calibrationImagesPath = argv[3];
+        FaceNetClassifier classifier(argv[1], threshold, detectorConfig, sessionConfig);
+
+        // the same crops for every precision: the first face, or the whole image if it is an aligned crop already
+        std::vector<cv::Mat> faces;
+        for (const std::string& path : imagePaths) {
+            cv::Mat image = cv::imread(path);
+            std::vector<cv::Mat> croppedFaces;
+            if (!image.empty())
+                classifier.getCroppedFaces(image, croppedFaces, false);
+            if (croppedFaces.empty() && !image.empty()) {
+                croppedFaces.emplace_back();
+                cv::resize(image, croppedFaces[0], cv::Size(160, 160), 0, 0, cv::INTER_CUBIC);
+            }
+            faces.push_back(croppedFaces.empty() ? cv::Mat::zeros(160, 160, CV_8UC3) : croppedFaces[0]);
+        }
+
+        cv::Mat embeddings;
+        double millisPerBatch;
+        embedAll(classifier, faces, embeddings, millisPerBatch);
+        if (embeddings.rows != faces.size()) {
+            std::cout << names[p] << ": inference failed" << std::endl;
+            return 1;
+        }
+        if (p == 0) {
+            reference = embeddings.clone();
+            referenceMillis = millisPerBatch;
+        }
+
+        double meanDrift = 0., maxDrift = 0.;
+        for (int i = 0; i < embeddings.rows; i++) {
+            double norms = cv::norm(embeddings.row(i)) * cv::norm(reference.row(i));
+            double drift = 1. - (norms > 0. ? embeddings.row(i).dot(reference.row(i)) / norms : 0.);
+            meanDrift += drift / embeddings.rows;
+            maxDrift = std::max(maxDrift, drift);
+        }
+        int correct = 0;
+        for (const Pair& pair : pairs) {
+            double distance = cv::norm(embeddings.row(pair.first), embeddings.row(pair.second));
+            correct += (distance < threshold) == pair.same;
+        }
+        std::cout << names[p] << "\t   " << meanDrift << "\t" << maxDrift << "\t    " <<
+                  100. * correct / pairs.size() << "%\t" << millisPerBatch << "\t";
+        if (precisions[p] == PRECISION_FLOAT16_STORAGE)
+            std::cout << "none (storage only)" << std::endl;
+        else
+            std::cout << (millisPerBatch > 0. ? referenceMillis / millisPerBatch : 0.) << "x" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "RecognitionClient.h"
+
+/**
+ * Load generator for the recognition server (facenet_recognition <images> <gallery> --serve <socket>). Every client
+ * thread has its own connection and sends the same image back to back for the given time, one request in flight per
+ * connection, so the server batches the requests of all clients. Prints throughput and latency percentiles. Modes:
+ *  - jpeg:  the encoded image, decoded by the server,
+ *  - shm:   the decoded frame in shared memory, read in place by the server,
+ *  - faces: the whole image resized to one 160x160 face, no detection.
+ *
+ * Usage: ./server_load <unix:/path/to/socket | port> <image> [clients=8] [seconds=10] [jpeg|shm|faces]
+ *        [embeddings=0]
+ */
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cout << "Usage: ./server_load <unix:/path/to/socket | port> <image> [clients=8] [seconds=10] "
+                     "[jpeg|shm|faces] [embeddings=0]" << std::endl;
+        return 0;
+    }
+    std::string address = argv[1];
+    std::string imagePath = argv[2];
+    int nmbrClients = argc > 3 ? std::atoi(argv[3]) : 8;
+    double seconds = argc > 4 ? std::atof(argv[4]) : 10.;
+    std::string mode = argc > 5 ? argv[5] : "jpeg";
+    bool embeddings = argc > 6 && std::atoi(argv[6]) != 0;
+
+    cv::Mat image = cv::imread(imagePath);
+    if (image.empty()) {
+        std::cerr << "Unable to read " << imagePath << std::endl;
+        return 1;
+    }
+    std::vector<unsigned char> encoded;
+    cv::imencode(".jpg", image, encoded);
+
+    std::vector<std::vector<double> > latencies(nmbrClients);
+    std::vector<long> faces(nmbrClients, 0), failures(nmbrClients, 0);
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> threads;
+    for (int c = 0; c < nmbrClients; c++) {
+        threads.emplace_back([&, c]() {
+            RecognitionClient client;
+            bool connected = address.compare(0, 5, "unix:") == 0 ? client.connectUnix(address.substr(5))
+                                                                   : client.connectTcp(std::atoi(address.c_str()));
+            if (!connected) {
+                std::cerr << "Client " << c << " unable to connect to " << address << std::endl;
+                return;
+            }
+            // shm: decode once into the shared object, like a client decoding its camera frames into it
+            cv::Mat sharedFrame;
+            if (mode == "shm") {
+                sharedFrame = client.getSharedFrame(image.cols, image.rows);
+                image.copyTo(sharedFrame);
+            }
+            std::vector<cv::Mat> faceImages(1, image);
+            RecognitionReply reply;
+            while (!stop) {
+                auto start = std::chrono::steady_clock::now();
+                bool ok;
+                if (mode == "shm")
+                    ok = client.recognizeFrame(sharedFrame, reply, embeddings);
+                else if (mode == "faces")
+                    ok = client.recognizeFaces(faceImages, reply, embeddings);
+                else
+                    ok = client.recognizeEncoded(encoded, reply, embeddings);
+                if (!ok)
+                    break;
+                latencies[c].push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start).count() / 1000.);
+                if (reply.status == STATUS_OK)
+                    faces[c] += reply.faces.size();
+                else
+                    failures[c]++;
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(long(seconds * 1000)));
+    stop = true;
+    for (auto& thread : threads)
+        thread.join();
+
+    std::vector<double> all;
+    long totalFaces = 0, totalFailures = 0;
+    for (int c = 0; c < nmbrClients; c++) {
+        all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+        totalFaces += faces[c];
+        totalFailures += failures[c];
+    }
+    if (all.empty()) {
+        std::cerr << "No request completed" << std::endl;
+        return 1;
+    }
+    std::sort(all.begin(), all.end());
+    auto percentile = [&](double q) {
+        return all[std::min(all.size() - 1, size_t(q * (all.size() - 1) + 0.5))];
+    };
+    std::cout << "mode " << mode << ", " << nmbrClients << " clients, " << all.size() << " requests, " <<
+              totalFailures << " failed, " << totalFaces << " faces in " << seconds << " s" << std::endl;
+    std::cout << "throughput " << all.size() / seconds << " requests/s, " << totalFaces / seconds << " faces/s" <<
+              std::endl;
+    std::cout << "latency ms p50 " << percentile(0.5) << ", p95 " << percentile(0.95) << ", p99 " <<
+              percentile(0.99) << ", max " << all.back() << std::endl;
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "FaceNet.h"
+
+/**
+ * Startup benchmark for the TensorFlow session. Times the construction of a FaceNetClassifier (session creation and
+ * graph loading) and the warm-up, then the first embedding of every batch bucket 1, 2, 4, ..., maxBatchSize, as it
+ * would happen on the first live frames with that many faces, and finally the steady state latency per bucket. Run it
+ * once with and once without warm-up, the setup pays for the warm-up and the first frames reach steady state latency.
+ * Every run is a new process, so lazy initialization inside TensorFlow is not shared between configurations.
+ *
+ * Usage: ./startup_bench <model.pb> [warmUpIterations=1] [intraOpThreads=0] [interOpThreads=0] [optimize=1]
+ */
+
+static const int maxBatchSize = 8;    // default of FaceNetClassifier
+static const int iterations = 20;
+
+static double millisSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() /
+           1000.;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cout << "Usage: ./startup_bench <model.pb> [warmUpIterations=1] [intraOpThreads=0] [interOpThreads=0] "
+                     "[optimize=1]" << std::endl;
+        return 0;
+    }
+    SessionConfig sessionConfig;
+    sessionConfig.warmUpIterations = argc > 2 ? std::atoi(argv[2]) : 1;
+    sessionConfig.intraOpThreads = argc > 3 ? std::atoi(argv[3]) : 0;
+    sessionConfig.interOpThreads = argc > 4 ? std::atoi(argv[4]) : 0;
+    sessionConfig.optimizeGraph = argc > 5 ? std::atoi(argv[5]) != 0 : true;
+    sessionConfig.rewriteGraph = sessionConfig.optimizeGraph;
+
+    // the detector is not used, but the default cascade must be loadable
+    DetectorConfig detectorConfig;
+    detectorConfig.cascadePath = "../models/haarcascade_frontalface_default.xml";
+
+    auto start = std::chrono::steady_clock::now();
+    FaceNetClassifier classifier(argv[1], 1.f, detectorConfig, sessionConfig);
+    double constructionMillis = millisSince(start);
+    start = std::chrono::steady_clock::now();
+    classifier.warmUp();
+    double warmUpMillis = millisSince(start);
+
+    std::vector<cv::Mat> faces(maxBatchSize);
+    cv::RNG rng(42);
+    for (auto& face : faces) {
+        face.create(160, 160, CV_8UC3);
+        rng.fill(face, cv::RNG::UNIFORM, 0, 256);
+    }
+
+    std::cout << "warm-up iterations " << sessionConfig.warmUpIterations << ", intra-op threads " <<
+              sessionConfig.intraOpThreads << ", inter-op threads " << sessionConfig.interOpThreads <<
+              ", graph optimizations " << (sessionConfig.optimizeGraph ? "on" : "off") << std::endl;
+    std::cout << "construction: " << constructionMillis << " ms, warm-up: " << warmUpMillis << " ms" << std::endl;
+    std::cout << "batch   first run ms   steady ms" << std::endl;
+    cv::Mat embeddings;
+    for (int batchSize = 1; batchSize <= maxBatchSize; batchSize *= 2) {
+        std::vector<cv::Mat> batch(faces.begin(), faces.begin() + batchSize);
+        start = std::chrono::steady_clock::now();
+        classifier.embed(batch, embeddings);
+        double firstMillis = millisSince(start);
+
+        start = std::chrono::steady_clock::now();
+        for (int it = 0; it < iterations; it++)
+            classifier.embed(batch, embeddings);
+        double steadyMillis = millisSince(start) / iterations;
+        std::cout << batchSize << "\t" << firstMillis << "\t\t" << steadyMillis << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "EmbeddingGallery.h"
+#include "IdentityGallery.h"
+
+/**
+ * Memory / accuracy benchmark for compressed gallery storage. Synthetic 512-d embeddings are drawn around identity
+ * centers (several noisy samples per identity, like enrolment photos), the queries are new samples of enrolled
+ * identities. For float32, fp16 and int8 rows the memory of the rows, the latency of the exact scan and the recall@1 /
+ * recall@k and distance error against the float gallery are printed, first for a plain EmbeddingGallery, then for
+ * IdentityGallery storage combinations (compressed centroids with float or compressed exemplars). The number of
+ * identities can be passed as first argument.
+ */
+
+static const int dim = 512;
+static const int samplesPerIdentity = 4;
+static const int nmbrQueries = 256;
+static const int k = 10;
+
+static void normalize(float* embedding) {
+    float squaredNorm = 0.f;
+    for (int j = 0; j < dim; j++)
+        squaredNorm += embedding[j] * embedding[j];
+    float invNorm = 1.f / std::sqrt(squaredNorm);
+    for (int j = 0; j < dim; j++)
+        embedding[j] *= invNorm;
+}
+
+static void noisySample(std::mt19937& rng, const float* center, float noise, float* sample) {
+    std::normal_distribution<float> normal(0.f, noise / std::sqrt(float(dim)));
+    for (int j = 0; j < dim; j++)
+        sample[j] = center[j] + normal(rng);
+    normalize(sample);
+}
+
+static const char* storageName(GalleryStorage storage) {
+    return storage == GALLERY_FLOAT32 ? "float32" : storage == GALLERY_FLOAT16 ? "fp16" : "int8";
+}
+
+template <typename Function>
+static double millisPerQuery(Function f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / (1000. * nmbrQueries);
+}
+
+// recall@1, recall@k and mean absolute error of the nearest distance against the float results
+static void printAccuracy(const std::vector<std::vector<GalleryMatch> >& reference,
+                          const std::vector<std::vector<GalleryMatch> >& matches) {
+    int hitsAt1 = 0, hitsAtK = 0, nmbrReference = 0;
+    double distanceError = 0.;
+    for (int q = 0; q < nmbrQueries; q++) {
+        nmbrReference += int(reference[q].size());
+        if (reference[q].empty() || matches[q].empty())
+            continue;
+        if (matches[q][0].index == reference[q][0].index)
+            hitsAt1++;
+        distanceError += std::abs(matches[q][0].distance - reference[q][0].distance);
+        for (const GalleryMatch& match : matches[q]) {
+            for (const GalleryMatch& truth : reference[q]) {
+                if (match.index == truth.index) {
+                    hitsAtK++;
+                    break;
+                }
+            }
+        }
+    }
+    std::cout << double(hitsAt1) / nmbrQueries << ", " << double(hitsAtK) / std::max(nmbrReference, 1) << ", " <<
+              distanceError / nmbrQueries;
+}
+
+int main(int argc, char *argv[]) {
+    int nmbrIdentities = argc > 1 ? std::max(1, std::atoi(argv[1])) : 25000;
+    int gallerySize = nmbrIdentities * samplesPerIdentity;
+    std::mt19937 rng(42);
+    std::normal_distribution<float> normal(0.f, 1.f);
+
+    std::vector<float> centers(size_t(nmbrIdentities) * dim);
+    for (auto& value : centers)
+        value = normal(rng);
+    for (int i = 0; i < nmbrIdentities; i++)
+        normalize(centers.data() + size_t(i) * dim);
+    std::vector<float> samples(size_t(gallerySize) * dim);
+    std::vector<std::string> names(gallerySize);
+    for (int i = 0; i < gallerySize; i++) {
+        noisySample(rng, centers.data() + size_t(i % nmbrIdentities) * dim, 0.6f, samples.data() + size_t(i) * dim);
+        names[i] = "id" + std::to_string(i % nmbrIdentities);
+    }
+    std::vector<float> queries(size_t(nmbrQueries) * dim);
+    for (int q = 0; q < nmbrQueries; q++)
+        noisySample(rng, centers.data() + size_t(rng() % nmbrIdentities) * dim, 0.6f, queries.data() + q * dim);
+
+    const GalleryStorage storages[] = {GALLERY_FLOAT32, GALLERY_FLOAT16, GALLERY_INT8};
+    std::vector<std::vector<GalleryMatch> > reference, matches;
+    std::cout << gallerySize << " embeddings, exact scan" << std::endl;
+    std::cout << "storage, MB, ms per query, recall@1, recall@" << k << ", distance error" << std::endl;
+    for (GalleryStorage storage : storages) {
+        EmbeddingGallery gallery(dim, storage);
+        gallery.reserve(gallerySize);
+        for (int i = 0; i < gallerySize; i++)
+            gallery.add(names[i], samples.data() + size_t(i) * dim);
+        double millis = millisPerQuery([&]() {
+            gallery.searchExact(queries.data(), nmbrQueries, k, matches);
+        });
+        if (storage == GALLERY_FLOAT32)
+            reference = matches;
+        std::cout << storageName(storage) << ", " << gallery.memoryBytes() / 1e6 << ", " << millis << ", ";
+        printAccuracy(reference, matches);
+        std::cout << std::endl;
+    }
+
+    std::cout << nmbrIdentities << " identities with " << samplesPerIdentity << " exemplars each" << std::endl;
+    std::cout << "centroids, exemplars, MB, ms per query, recall@1, recall@" << k << ", distance error" << std::endl;
+    bool first = true;
+    for (GalleryStorage exemplarStorage : storages) {
+        for (GalleryStorage centroidStorage : storages) {
+            if (centroidStorage < exemplarStorage)
+                continue;
+            IdentityGalleryConfig config;
+            config.centroidStorage = centroidStorage;
+            config.exemplarStorage = exemplarStorage;
+            IdentityGallery gallery(dim, config);
+            gallery.addExemplars(names, samples.data());
+            std::shared_ptr<const GallerySnapshot> snapshot = gallery.snapshot();
+            double millis = millisPerQuery([&]() {
+                snapshot->search(queries.data(), nmbrQueries, k, matches);
+            });
+            if (first)
+                reference = matches;
+            first = false;
+            std::cout << storageName(centroidStorage) << ", " << storageName(exemplarStorage) << ", " <<
+                      snapshot->memoryBytes() / 1e6 << ", " << millis << ", ";
+            printAccuracy(reference, matches);
+            std::cout << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,610 @@
+#include "EmbeddingGallery.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// gallery rows per block, 64 rows of 512 floats (128kB) stay in L2 while all probes are compared against them
+static const int GALLERY_BLOCK = 64;
+// probes compared against one gallery row at once, each gallery load is reused PROBE_BLOCK times
+static const int PROBE_BLOCK = 4;
+
+#if defined(__AVX2__)
+typedef __m256 FloatVector;
+static const int VECTOR_WIDTH = 8;
+
+static inline FloatVector loadVector(const float* values) {
+    return _mm256_loadu_ps(values);
+}
+
+static inline float horizontalSum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+static inline __m256 multiplyAdd(__m256 a, __m256 b, __m256 c) {
+#if defined(__FMA__)
+    return _mm256_fmadd_ps(a, b, c);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+static inline __m256 subtract(__m256 a, __m256 b) {
+    return _mm256_sub_ps(a, b);
+}
+
+static inline __m256 zeroVector() {
+    return _mm256_setzero_ps();
+}
+#elif defined(__SSE2__)
+typedef __m128 FloatVector;
+static const int VECTOR_WIDTH = 4;
+
+static inline FloatVector loadVector(const float* values) {
+    return _mm_loadu_ps(values);
+}
+
+static inline float horizontalSum(__m128 v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+static inline __m128 multiplyAdd(__m128 a, __m128 b, __m128 c) {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+
+static inline __m128 subtract(__m128 a, __m128 b) {
+    return _mm_sub_ps(a, b);
+}
+
+static inline __m128 zeroVector() {
+    return _mm_setzero_ps();
+}
+#endif
+
+// values of a gallery row times the same values of PROBE_BLOCK probes, one accumulator register per probe
+struct ProbeAccumulators {
+    const float* const* probes;
+#if defined(__AVX2__) || defined(__SSE2__)
+    FloatVector acc0 = zeroVector(), acc1 = zeroVector(), acc2 = zeroVector(), acc3 = zeroVector();
+    inline void add(FloatVector g, int j) {
+        acc0 = multiplyAdd(g, loadVector(probes[0] + j), acc0);
+        acc1 = multiplyAdd(g, loadVector(probes[1] + j), acc1);
+        acc2 = multiplyAdd(g, loadVector(probes[2] + j), acc2);
+        acc3 = multiplyAdd(g, loadVector(probes[3] + j), acc3);
+    }
+#endif
+    float tail0 = 0.f, tail1 = 0.f, tail2 = 0.f, tail3 = 0.f;
+    explicit ProbeAccumulators(const float* const* probes) : probes(probes) {}
+    inline void add(float g, int j) {
+        tail0 += g * probes[0][j];
+        tail1 += g * probes[1][j];
+        tail2 += g * probes[2][j];
+        tail3 += g * probes[3][j];
+    }
+    inline void sum(float* dots) const {
+#if defined(__AVX2__) || defined(__SSE2__)
+        dots[0] = horizontalSum(acc0) + tail0;
+        dots[1] = horizontalSum(acc1) + tail1;
+        dots[2] = horizontalSum(acc2) + tail2;
+        dots[3] = horizontalSum(acc3) + tail3;
+#else
+        dots[0] = tail0;
+        dots[1] = tail1;
+        dots[2] = tail2;
+        dots[3] = tail3;
+#endif
+    }
+};
+
+// squared differences of the values of a gallery row and one probe
+struct DistanceAccumulator {
+    const float* probe;
+#if defined(__AVX2__) || defined(__SSE2__)
+    FloatVector acc = zeroVector();
+    inline void add(FloatVector g, int j) {
+        FloatVector difference = subtract(loadVector(probe + j), g);
+        acc = multiplyAdd(difference, difference, acc);
+    }
+#endif
+    float tail = 0.f;
+    explicit DistanceAccumulator(const float* probe) : probe(probe) {}
+    inline void add(float g, int j) {
+        tail += (probe[j] - g) * (probe[j] - g);
+    }
+    inline float sum() const {
+#if defined(__AVX2__) || defined(__SSE2__)
+        return horizontalSum(acc) + tail;
+#else
+        return tail;
+#endif
+    }
+};
+
+/**
+ * Feeds values first to first + count of a float row to the accumulators, a vector at a time.
+ */
+template <typename Accumulators>
+static inline void accumulateFloats(const float* values, int first, int count, Accumulators& acc) {
+    int j = 0;
+#if defined(__AVX2__) || defined(__SSE2__)
+    for (; j + VECTOR_WIDTH <= count; j += VECTOR_WIDTH)
+        acc.add(loadVector(values + j), first + j);
+#endif
+    for (; j < count; j++)
+        acc.add(values[j], first + j);
+}
+
+// values converted at once by the kernels without a native conversion, small enough for the stack
+static const int DECODE_CHUNK = 64;
+
+/**
+ * Feeds a float row to the accumulators. Every storage type has one such kernel, the scan accumulates dot products
+ * with PROBE_BLOCK probes and the re-rank squared differences with one probe.
+ */
+template <typename Accumulators>
+static void accumulateRow(const float* row, int dim, Accumulators& acc) {
+    accumulateFloats(row, 0, dim, acc);
+}
+
+/**
+ * Feeds an fp16 row to the accumulators. With F16C the row is converted to float 8 values at a time inside the kernel,
+ * otherwise chunks of it are converted on the stack first.
+ */
+template <typename Accumulators>
+static void accumulateRow(const uint16_t* row, int dim, Accumulators& acc) {
+    int j = 0;
+#if defined(__AVX2__) && defined(__F16C__)
+    for (; j + 8 <= dim; j += 8)
+        acc.add(_mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + j))), j);
+    for (; j < dim; j++)
+        acc.add(halfToFloat(row[j]), j);
+#else
+    float chunk[DECODE_CHUNK];
+    for (; j < dim; j += DECODE_CHUNK) {
+        int count = std::min(DECODE_CHUNK, dim - j);
+        for (int c = 0; c < count; c++)
+            chunk[c] = halfToFloat(row[j + c]);
+        accumulateFloats(chunk, j, count, acc);
+    }
+#endif
+}
+
+/**
+ * Feeds an int8 row times its scale to the accumulators. With AVX2 the codes are widened to float 8 values at a time
+ * inside the kernel, otherwise chunks of them are converted on the stack first.
+ */
+template <typename Accumulators>
+static void accumulateRow(const int8_t* row, float scale, int dim, Accumulators& acc) {
+    int j = 0;
+#if defined(__AVX2__)
+    __m256 scales = _mm256_set1_ps(scale);
+    for (; j + 8 <= dim; j += 8) {
+        __m128i codes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + j));
+        acc.add(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(codes)), scales), j);
+    }
+    for (; j < dim; j++)
+        acc.add(row[j] * scale, j);
+#else
+    float chunk[DECODE_CHUNK];
+    for (; j < dim; j += DECODE_CHUNK) {
+        int count = std::min(DECODE_CHUNK, dim - j);
+        for (int c = 0; c < count; c++)
+            chunk[c] = row[j + c] * scale;
+        accumulateFloats(chunk, j, count, acc);
+    }
+#endif
+}
+
+float squaredL2Distance(const float* a, const float* b, int dim) {
+    DistanceAccumulator acc(b);
+    accumulateRow(a, dim, acc);
+    return acc.sum();
+}
+
+uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = int32_t((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (exponent <= 0) {
+        if (exponent < -10)
+            return sign;
+        // subnormal half, round to nearest
+        mantissa |= 0x800000;
+        uint32_t shift = uint32_t(14 - exponent);
+        return uint16_t(sign | ((mantissa + (1u << (shift - 1))) >> shift));
+    }
+    if (exponent >= 31)
+        return uint16_t(sign | 0x7c00);
+    uint16_t half = uint16_t(sign | (exponent << 10) | (mantissa >> 13));
+    // round to nearest, a carry into the exponent is the correct result
+    if (mantissa & 0x1000)
+        half++;
+    return half;
+}
+
+float halfToFloat(uint16_t half) {
+    uint32_t sign = uint32_t(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0) {
+        float value = std::ldexp(float(mantissa), -24);
+        return sign ? -value : value;
+    }
+    if (exponent == 31)
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    else
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * Quantizes an embedding to int8 codes, the largest absolute value maps to 127.
+ * @return scale of the embedding, value j is codes[j] * scale
+ */
+float quantizeInt8(const float* embedding, int dim, int8_t* codes) {
+    float maxAbs = 0.f;
+    for (int j = 0; j < dim; j++)
+        maxAbs = std::max(maxAbs, std::abs(embedding[j]));
+    float scale = maxAbs > 0.f ? maxAbs / 127.f : 1.f;
+    for (int j = 0; j < dim; j++)
+        codes[j] = int8_t(std::lround(embedding[j] / scale));
+    return scale;
+}
+
+static bool closerMatch(const GalleryMatch& a, const GalleryMatch& b) {
+    return a.distance < b.distance || (a.distance == b.distance && a.index < b.index);
+}
+
+/**
+ * Keeps the k closest matches as a max-heap on the (squared) distance.
+ */
+static void pushMatch(std::vector<GalleryMatch>& heap, int k, int index, float distance) {
+    GalleryMatch match = {index, distance};
+    if (heap.size() < size_t(k)) {
+        heap.push_back(match);
+        std::push_heap(heap.begin(), heap.end(), closerMatch);
+    }
+    else if (closerMatch(match, heap.front())) {
+        std::pop_heap(heap.begin(), heap.end(), closerMatch);
+        heap.back() = match;
+        std::push_heap(heap.begin(), heap.end(), closerMatch);
+    }
+}
+
+/**
+ * Creates an empty gallery.
+ * @param dim length of the embeddings, 512 for the FaceNet models
+ * @param storage value type of the rows, fp16 and int8 trade a little accuracy for half or a quarter of the memory
+ */
+EmbeddingGallery::EmbeddingGallery(int dim, GalleryStorage storage) : m_index(dim) {
+    m_dim = dim;
+    m_storage = storage;
+}
+
+/**
+ * Writes an embedding into an allocated row in the storage type of the gallery, together with the squared norm of the
+ * stored (decoded) values, so the distances of the scan are those of the stored row.
+ */
+void EmbeddingGallery::store(int index, const float* embedding) {
+    size_t offset = size_t(index) * m_dim;
+    if (m_storage == GALLERY_FLOAT16) {
+        for (int j = 0; j < m_dim; j++)
+            m_halfs[offset + j] = floatToHalf(embedding[j]);
+    }
+    else if (m_storage == GALLERY_INT8) {
+        m_scales[index] = quantizeInt8(embedding, m_dim, m_codes.data() + offset);
+    }
+    std::vector<float> decoded;
+    const float* row = embedding;
+    if (m_storage != GALLERY_FLOAT32) {
+        decoded.resize(m_dim);
+        this->readEmbedding(index, decoded.data());
+        row = decoded.data();
+    }
+    if (m_storage == GALLERY_FLOAT32 || m_useIndex)
+        std::copy(row, row + m_dim, m_embeddings.begin() + offset);
+    float squaredNorm = 0.f;
+    for (int j = 0; j < m_dim; j++)
+        squaredNorm += row[j] * row[j];
+    m_squaredNorms[index] = squaredNorm;
+}
+
+/**
+ * Appends an embedding to the gallery.
+ * @param className name of the person the embedding belongs to
+ * @param embedding dim floats
+ * @return index of the new row, this is the class number
+ */
+int EmbeddingGallery::add(const std::string& className, const float* embedding) {
+    int index = size();
+    m_classNames.push_back(className);
+    m_removed.push_back(0);
+    m_squaredNorms.push_back(0.f);
+    size_t values = size_t(size()) * m_dim;
+    if (m_storage == GALLERY_FLOAT32 || m_useIndex)
+        m_embeddings.resize(values);
+    if (m_storage == GALLERY_FLOAT16)
+        m_halfs.resize(values);
+    if (m_storage == GALLERY_INT8) {
+        m_codes.resize(values);
+        m_scales.push_back(1.f);
+    }
+    this->store(index, embedding);
+    if (m_useIndex)
+        m_index.add(m_embeddings.data(), index);
+    return index;
+}
+
+/**
+ * Overwrites the embedding of a row, e.g. a centroid. An enabled index links the row again at its new position.
+ * @param index row of the embedding
+ * @param embedding dim floats
+ */
+void EmbeddingGallery::update(int index, const float* embedding) {
+    this->store(index, embedding);
+    if (m_useIndex)
+        m_index.update(m_embeddings.data(), index);
+}
+
+/**
+ * Removes an embedding from search results. The row and its class number stay valid, so indices of other rows do not
+ * change.
+ * @param index row of the embedding
+ */
+void EmbeddingGallery::remove(int index) {
+    if (index < 0 || index >= size() || m_removed[index])
+        return;
+    m_removed[index] = 1;
+    m_nmbrRemoved++;
+    if (m_useIndex)
+        m_index.remove(index);
+}
+
+bool EmbeddingGallery::isRemoved(int index) const {
+    return m_removed[index] != 0;
+}
+
+void EmbeddingGallery::reserve(int capacity) {
+    if (m_storage == GALLERY_FLOAT32)
+        m_embeddings.reserve(size_t(capacity) * m_dim);
+    else if (m_storage == GALLERY_FLOAT16)
+        m_halfs.reserve(size_t(capacity) * m_dim);
+    else
+        m_codes.reserve(size_t(capacity) * m_dim);
+    m_scales.reserve(m_storage == GALLERY_INT8 ? capacity : 0);
+    m_squaredNorms.reserve(capacity);
+    m_classNames.reserve(capacity);
+    m_removed.reserve(capacity);
+}
+
+void EmbeddingGallery::clear() {
+    m_embeddings.clear();
+    m_halfs.clear();
+    m_codes.clear();
+    m_scales.clear();
+    m_squaredNorms.clear();
+    m_classNames.clear();
+    m_removed.clear();
+    m_nmbrRemoved = 0;
+    if (m_useIndex)
+        m_index.build(m_embeddings.data(), 0, m_removed);
+}
+
+/**
+ * Builds an HNSW index over all rows, afterwards search is approximate and new rows are inserted into the index.
+ * Building again also drops removed rows from the graph. The index needs float rows, compressed rows are decoded into
+ * a float copy that is kept until disableIndex.
+ * @param config graph degree and candidate list sizes, see HnswConfig
+ */
+void EmbeddingGallery::enableIndex(const HnswConfig& config) {
+    if (m_storage != GALLERY_FLOAT32 && !m_useIndex) {
+        m_embeddings.resize(size_t(size()) * m_dim);
+        for (int i = 0; i < size(); i++)
+            this->readEmbedding(i, m_embeddings.data() + size_t(i) * m_dim);
+    }
+    m_index = HnswIndex(m_dim, config);
+    m_index.build(m_embeddings.data(), size(), m_removed);
+    m_useIndex = true;
+}
+
+void EmbeddingGallery::disableIndex() {
+    m_index = HnswIndex(m_dim);
+    m_useIndex = false;
+    if (m_storage != GALLERY_FLOAT32)
+        std::vector<float, AlignedAllocator<float> >().swap(m_embeddings);
+}
+
+void EmbeddingGallery::setIndexEfSearch(int efSearch) {
+    m_index.setEfSearch(efSearch);
+}
+
+bool EmbeddingGallery::isIndexEnabled() const {
+    return m_useIndex;
+}
+
+/**
+ * Removed rows the enabled index still navigates through, enableIndex builds it again without them.
+ */
+int EmbeddingGallery::getIndexTombstones() const {
+    return m_useIndex ? m_index.removedCount() : 0;
+}
+
+int EmbeddingGallery::size() const {
+    return int(m_classNames.size());
+}
+
+/**
+ * Number of embeddings that were not removed.
+ */
+int EmbeddingGallery::count() const {
+    return size() - m_nmbrRemoved;
+}
+
+int EmbeddingGallery::dim() const {
+    return m_dim;
+}
+
+GalleryStorage EmbeddingGallery::storage() const {
+    return m_storage;
+}
+
+/**
+ * Allocated bytes of the embedding rows, their norms and scales and the float copy of the index, without the graph
+ * of the index and the class names.
+ */
+size_t EmbeddingGallery::memoryBytes() const {
+    return m_embeddings.capacity() * sizeof(float) + m_halfs.capacity() * sizeof(uint16_t) +
+           m_codes.capacity() * sizeof(int8_t) + (m_scales.capacity() + m_squaredNorms.capacity()) * sizeof(float);
+}
+
+const std::string& EmbeddingGallery::getClassName(int index) const {
+    return m_classNames[index];
+}
+
+/**
+ * Float row of an embedding, only for GALLERY_FLOAT32 storage or while the index is enabled, nullptr otherwise.
+ * readEmbedding works for every storage type.
+ */
+const float* EmbeddingGallery::getEmbedding(int index) const {
+    if (m_storage != GALLERY_FLOAT32 && !m_useIndex)
+        return nullptr;
+    return m_embeddings.data() + size_t(index) * m_dim;
+}
+
+/**
+ * Reads one embedding as float, fp16 and int8 rows are converted back.
+ */
+void EmbeddingGallery::readEmbedding(int index, float* embedding) const {
+    size_t offset = size_t(index) * m_dim;
+    switch (m_storage) {
+        case GALLERY_FLOAT16:
+            for (int j = 0; j < m_dim; j++)
+                embedding[j] = halfToFloat(m_halfs[offset + j]);
+            break;
+        case GALLERY_INT8:
+            for (int j = 0; j < m_dim; j++)
+                embedding[j] = m_codes[offset + j] * m_scales[index];
+            break;
+        default:
+            std::copy(m_embeddings.begin() + offset, m_embeddings.begin() + offset + m_dim, embedding);
+    }
+}
+
+/**
+ * Feeds the stored (decoded) values of one row to the accumulators, through the kernel of the storage type.
+ */
+template <typename Accumulators>
+void EmbeddingGallery::accumulate(int index, Accumulators& acc) const {
+    size_t offset = size_t(index) * m_dim;
+    switch (m_storage) {
+        case GALLERY_FLOAT16:
+            accumulateRow(m_halfs.data() + offset, m_dim, acc);
+            break;
+        case GALLERY_INT8:
+            accumulateRow(m_codes.data() + offset, m_scales[index], m_dim, acc);
+            break;
+        default:
+            accumulateRow(m_embeddings.data() + offset, m_dim, acc);
+    }
+}
+
+/**
+ * Squared euclidean distance of a probe to the stored (decoded) row of an embedding, computed straight from the
+ * compressed row by the same kernel as the scan.
+ */
+float EmbeddingGallery::squaredDistance(int index, const float* probe) const {
+    DistanceAccumulator acc(probe);
+    this->accumulate(index, acc);
+    return acc.sum();
+}
+
+/**
+ * Finds the k nearest gallery embeddings for every probe, approximately through the HNSW index if it is enabled and
+ * exactly otherwise.
+ * @param probes nmbrProbes x dim floats, row-major
+ * @param nmbrProbes number of probe embeddings
+ * @param k number of matches per probe, fewer if the gallery is smaller
+ * @param matches nearest matches per probe sorted by ascending distance
+ */
+void EmbeddingGallery::search(const float* probes, int nmbrProbes, int k,
+                              std::vector<std::vector<GalleryMatch> >& matches) const {
+    if (!m_useIndex) {
+        searchExact(probes, nmbrProbes, k, matches);
+        return;
+    }
+    matches.resize(nmbrProbes);
+    for (int p = 0; p < nmbrProbes; p++)
+        m_index.search(m_embeddings.data(), probes + size_t(p) * m_dim, k, matches[p]);
+}
+
+/**
+ * Finds the exact k nearest gallery embeddings for every probe. The gallery is walked in blocks of GALLERY_BLOCK rows
+ * and every block is compared against all probes, PROBE_BLOCK probes per gallery row load, before moving on to the next
+ * block, so each gallery row is read from memory once per search and not once per probe. Compressed rows are read in
+ * their storage type, which divides the memory traffic by two (fp16) or four (int8).
+ * @param probes nmbrProbes x dim floats, row-major
+ * @param nmbrProbes number of probe embeddings
+ * @param k number of matches per probe, fewer if the gallery is smaller
+ * @param matches nearest matches per probe sorted by ascending distance
+ */
+void EmbeddingGallery::searchExact(const float* probes, int nmbrProbes, int k,
+                                   std::vector<std::vector<GalleryMatch> >& matches) const {
+    matches.resize(nmbrProbes);
+    for (auto& probeMatches : matches) {
+        probeMatches.clear();
+        probeMatches.reserve(k + 1);
+    }
+    if (k <= 0)
+        return;
+
+    std::vector<float> probeNorms(nmbrProbes, 0.f);
+    for (int p = 0; p < nmbrProbes; p++) {
+        const float* probe = probes + size_t(p) * m_dim;
+        for (int j = 0; j < m_dim; j++)
+            probeNorms[p] += probe[j] * probe[j];
+    }
+
+    int gallerySize = size();
+    float dots[PROBE_BLOCK];
+    const float* probeBlock[PROBE_BLOCK];
+    for (int blockStart = 0; blockStart < gallerySize; blockStart += GALLERY_BLOCK) {
+        int blockEnd = std::min(gallerySize, blockStart + GALLERY_BLOCK);
+        for (int firstProbe = 0; firstProbe < nmbrProbes; firstProbe += PROBE_BLOCK) {
+            int nmbrBlockProbes = std::min(PROBE_BLOCK, nmbrProbes - firstProbe);
+            // a partial probe block repeats its last probe, the surplus dot products are discarded
+            for (int p = 0; p < PROBE_BLOCK; p++)
+                probeBlock[p] = probes + size_t(firstProbe + std::min(p, nmbrBlockProbes - 1)) * m_dim;
+            for (int i = blockStart; i < blockEnd; i++) {
+                if (m_removed[i])
+                    continue;
+                ProbeAccumulators acc(probeBlock);
+                this->accumulate(i, acc);
+                acc.sum(dots);
+                for (int p = 0; p < nmbrBlockProbes; p++) {
+                    float squaredDistance = probeNorms[firstProbe + p] + m_squaredNorms[i] - 2.f * dots[p];
+                    pushMatch(matches[firstProbe + p], k, i, std::max(squaredDistance, 0.f));
+                }
+            }
+        }
+    }
+
+    for (auto& probeMatches : matches) {
+        std::sort_heap(probeMatches.begin(), probeMatches.end(), closerMatch);
+        for (auto& match : probeMatches)
+            match.distance = std::sqrt(match.distance);
+    }
+}
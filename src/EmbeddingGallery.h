@@ -0,0 +1,103 @@
+#ifndef FACE_RECOGNITION_EMBEDDINGGALLERY_H
+#define FACE_RECOGNITION_EMBEDDINGGALLERY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "HnswIndex.h"
+
+/**
+ * Allocator for the embedding matrix, cv::fastMalloc returns memory aligned for the widest vector loads.
+ */
+template <typename T>
+struct AlignedAllocator {
+    typedef T value_type;
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+    T* allocate(size_t n) { return static_cast<T*>(cv::fastMalloc(n * sizeof(T))); }
+    void deallocate(T* p, size_t) { cv::fastFree(p); }
+};
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return false; }
+
+// value type of stored embeddings, in memory and in gallery files
+enum GalleryStorage {
+    GALLERY_FLOAT32 = 0,
+    GALLERY_FLOAT16 = 1,
+    GALLERY_INT8 = 2    // one float scale per embedding
+};
+
+struct GalleryMatch {
+    int index;          // row of the matched embedding in the gallery
+    float distance;     // euclidean distance between probe and gallery embedding
+};
+
+// squared euclidean distance of two embeddings, vectorized like the gallery scan
+float squaredL2Distance(const float* a, const float* b, int dim);
+// IEEE half precision conversion, round to nearest
+uint16_t floatToHalf(float value);
+float halfToFloat(uint16_t half);
+// symmetric int8 quantization with one scale per embedding, value = code * scale
+float quantizeInt8(const float* embedding, int dim, int8_t* codes);
+
+/**
+ * Known face embeddings stored as one contiguous, aligned [size x dim] float matrix together with their squared norms
+ * and class names. search computes the distances of a batch of probes to all rows with a blocked dot product kernel,
+ * using |p - g|^2 = |p|^2 + |g|^2 - 2 p.g, and returns the k nearest rows per probe. For large galleries an HNSW index
+ * can be enabled, search then returns approximate matches from the index instead.
+ * Removed rows keep their index (the class number) and are skipped by both search paths.
+ * Rows can be stored compressed as fp16 (half the memory) or as int8 with one scale per row (a quarter), the exact scan
+ * then computes the dot products straight from the compressed rows and returns the distances of the decoded rows.
+ * The HNSW index works on float rows, a compressed gallery keeps a decoded copy while the index is enabled.
+ * The original floats of compressed rows are not kept, exact re-ranking needs a float gallery, e.g. the float exemplars
+ * of an IdentityGallery with compressed centroids.
+ */
+class EmbeddingGallery {
+private:
+    int m_dim;
+    GalleryStorage m_storage;
+    std::vector<float, AlignedAllocator<float> > m_embeddings;  // float32 rows, or decoded rows for the index
+    std::vector<uint16_t, AlignedAllocator<uint16_t> > m_halfs;
+    std::vector<int8_t, AlignedAllocator<int8_t> > m_codes;
+    std::vector<float> m_scales;
+    std::vector<float> m_squaredNorms;      // of the decoded rows
+    std::vector<std::string> m_classNames;
+    std::vector<char> m_removed;
+    int m_nmbrRemoved = 0;
+    HnswIndex m_index;
+    bool m_useIndex = false;
+    void store(int index, const float* embedding);
+    template <typename Accumulators>
+    void accumulate(int index, Accumulators& acc) const;
+public:
+    explicit EmbeddingGallery(int dim = 512, GalleryStorage storage = GALLERY_FLOAT32);
+    int add(const std::string& className, const float* embedding);
+    void update(int index, const float* embedding);
+    void remove(int index);
+    bool isRemoved(int index) const;
+    void reserve(int capacity);
+    void clear();
+    void enableIndex(const HnswConfig& config);
+    void disableIndex();
+    void setIndexEfSearch(int efSearch);
+    bool isIndexEnabled() const;
+    int getIndexTombstones() const;
+    int size() const;
+    int count() const;
+    int dim() const;
+    GalleryStorage storage() const;
+    size_t memoryBytes() const;
+    const std::string& getClassName(int index) const;
+    const float* getEmbedding(int index) const;
+    void readEmbedding(int index, float* embedding) const;
+    float squaredDistance(int index, const float* probe) const;
+    void search(const float* probes, int nmbrProbes, int k, std::vector<std::vector<GalleryMatch> >& matches) const;
+    void searchExact(const float* probes, int nmbrProbes, int k,
+                     std::vector<std::vector<GalleryMatch> >& matches) const;
+};
+
+
+#endif //FACE_RECOGNITION_EMBEDDINGGALLERY_H
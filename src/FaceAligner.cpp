@@ -0,0 +1,104 @@
+#include "FaceAligner.h"
+#include <iostream>
+#include <map>
+#include <mutex>
+#include "ImageStandardizer.h"
+
+/**
+ * Creates an aligner, the shape predictor is shared with all aligners of the same file.
+ * @param config path of shape_predictor_5_face_landmarks.dat and the margin around the face
+ */
+FaceAligner::FaceAligner(const AlignmentConfig& config) : m_config(config) {
+    m_predictor = loadShapePredictor(config.shapePredictorPath);
+}
+
+/**
+ * Loads a shape predictor or returns the one already loaded from path. Predictors stay loaded as long as an aligner
+ * uses them.
+ * @param path serialized dlib shape predictor
+ * @return the predictor, null if the file could not be read
+ */
+std::shared_ptr<const dlib::shape_predictor> FaceAligner::loadShapePredictor(const std::string& path) {
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<const dlib::shape_predictor> > predictors;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<const dlib::shape_predictor> predictor = predictors[path].lock();
+    if (predictor)
+        return predictor;
+    std::shared_ptr<dlib::shape_predictor> loaded = std::make_shared<dlib::shape_predictor>();
+    try {
+        dlib::deserialize(path) >> *loaded;
+    }
+    catch (const dlib::serialization_error& e) {
+        std::cerr << "Unable to load shape predictor " << path << ": " << e.what() << std::endl;
+        return nullptr;
+    }
+    if (loaded->num_parts() != 5 && loaded->num_parts() != 68) {
+        std::cerr << "Shape predictor " << path << " has " << loaded->num_parts() << " parts, 5 or 68 expected" <<
+                  std::endl;
+        return nullptr;
+    }
+    predictors[path] = loaded;
+    return loaded;
+}
+
+bool FaceAligner::isLoaded() const {
+    return m_predictor != nullptr;
+}
+
+/**
+ * Finds the landmarks of a face and the transform from the frame onto the aligned face.
+ * @param frame BGR frame
+ * @param faceRect detected face, may reach outside of the frame
+ * @param faceSize width and height of the aligned face
+ * @param transform 2x3 affine matrix (CV_64F) mapping frame coordinates to aligned face coordinates
+ */
+void FaceAligner::getTransform(const cv::Mat& frame, const cv::Rect& faceRect, int faceSize,
+                               cv::Mat& transform) const {
+    // dlib reads the BGR frame in place and converts only the sampled pixels to gray
+    dlib::cv_image<dlib::bgr_pixel> image(frame);
+    dlib::rectangle box(faceRect.x, faceRect.y, faceRect.br().x - 1, faceRect.br().y - 1);
+    dlib::full_object_detection shape = (*m_predictor)(image, box);
+    dlib::chip_details chip = dlib::get_face_chip_details(shape, faceSize, m_config.padding);
+    dlib::point_transform_affine toChip = dlib::get_mapping_to_chip(chip);
+    const dlib::matrix<double, 2, 2>& m = toChip.get_m();
+    const dlib::vector<double, 2>& b = toChip.get_b();
+    transform = (cv::Mat_<double>(2, 3) << m(0, 0), m(0, 1), b.x(), m(1, 0), m(1, 1), b.y());
+}
+
+/**
+ * Aligns one face: landmarks, then a single bilinear warp from the frame into faceSize x faceSize. Parts of the
+ * aligned face outside of the frame are black, as for unaligned crops.
+ * @param frame BGR frame, only read
+ * @param faceRect detected face
+ * @param faceSize width and height of the aligned face
+ * @param alignedFace 8-bit BGR face
+ */
+void FaceAligner::alignFace(const cv::Mat& frame, const cv::Rect& faceRect, int faceSize, cv::Mat& alignedFace) const {
+    cv::Mat transform;
+    this->getTransform(frame, faceRect, faceSize, transform);
+    cv::warpAffine(frame, alignedFace, transform, cv::Size(faceSize, faceSize), cv::INTER_LINEAR,
+                   cv::BORDER_CONSTANT, cv::Scalar::all(0));
+}
+
+/**
+ * Aligned counterpart of cropStandardizeFaces: landmarks, warp and standardization of every face in one parallel pass
+ * over the faces, each thread warps into its own reused 8-bit scratch image.
+ * @param frames frame of every face
+ * @param faceRects detected faces
+ * @param firstFace index of the first face to process
+ * @param nmbrFaces number of faces to process
+ * @param faceSize width and height of a network input
+ * @param dst nmbrFaces * faceSize * faceSize * 3 floats
+ */
+void FaceAligner::alignStandardizeFaces(const std::vector<cv::Mat>& frames, const std::vector<cv::Rect>& faceRects,
+                                        int firstFace, int nmbrFaces, int faceSize, float* dst) const {
+    size_t faceLength = size_t(faceSize) * faceSize * 3;
+    cv::parallel_for_(cv::Range(0, nmbrFaces), [&](const cv::Range& faces) {
+        static thread_local cv::Mat alignedFace;
+        for (int i = faces.start; i < faces.end; i++) {
+            this->alignFace(frames[firstFace + i], faceRects[firstFace + i], faceSize, alignedFace);
+            standardizeFace(alignedFace, dst + i * faceLength);
+        }
+    });
+}
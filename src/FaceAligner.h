@@ -0,0 +1,39 @@
+#ifndef FACE_RECOGNITION_FACEALIGNER_H
+#define FACE_RECOGNITION_FACEALIGNER_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <dlib/image_processing.h>
+#include <dlib/opencv/cv_image.h>
+
+struct AlignmentConfig {
+    bool enabled = false;
+    std::string shapePredictorPath = "../models/shape_predictor_5_face_landmarks.dat";
+    double padding = 0.25;  // margin around the landmark template, relative to the face, as for dlib's face chips
+};
+
+/**
+ * Aligns faces with dlib's 5-point landmarks (eye corners and nose). The landmarks of a detected box are mapped onto
+ * dlib's face template by a similarity transform, and the face is warped from the frame straight into the network
+ * input size, so an aligned face costs one affine warp instead of a crop and a resize. The shape predictor is loaded
+ * once per file and shared by all aligners, it is only read, so one aligner may be used by many threads at once.
+ */
+class FaceAligner {
+private:
+    std::shared_ptr<const dlib::shape_predictor> m_predictor;
+    AlignmentConfig m_config;
+public:
+    explicit FaceAligner(const AlignmentConfig& config);
+    bool isLoaded() const;
+    void getTransform(const cv::Mat& frame, const cv::Rect& faceRect, int faceSize, cv::Mat& transform) const;
+    void alignFace(const cv::Mat& frame, const cv::Rect& faceRect, int faceSize, cv::Mat& alignedFace) const;
+    void alignStandardizeFaces(const std::vector<cv::Mat>& frames, const std::vector<cv::Rect>& faceRects,
+                               int firstFace, int nmbrFaces, int faceSize, float* dst) const;
+    static std::shared_ptr<const dlib::shape_predictor> loadShapePredictor(const std::string& path);
+};
+
+
+#endif //FACE_RECOGNITION_FACEALIGNER_H
@@ -0,0 +1,168 @@
+#include "FaceDetector.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include "GatedFaceDetector.h"
+#include "Profiler.h"
+
+// dlib's frontal face detector uses a fixed 80x80 pixel detection window
+static const int HOG_WINDOW_SIZE = 80;
+
+static double intersectionOverUnion(const cv::Rect& a, const cv::Rect& b) {
+    double intersection = (a & b).area();
+    double unionArea = a.area() + b.area() - intersection;
+    return unionArea > 0 ? intersection / unionArea : 0.;
+}
+
+/**
+ * Creates the detector that belongs to the requested backend, behind a GatedFaceDetector if the gate is enabled.
+ * Falls back to the CPU cascade if the CUDA backend was requested but OpenCV was built without the cudaobjdetect
+ * module. Throws a cv::Exception if the cascade cannot be loaded, instead of returning a detector that never finds a
+ * face.
+ * @param config backend and detection parameters
+ */
+cv::Ptr<FaceDetector> FaceDetector::create(const DetectorConfig& config) {
+    if (config.gate.enabled) {
+        DetectorConfig ungated = config;
+        ungated.gate.enabled = false;
+        return cv::makePtr<GatedFaceDetector>(config.gate, FaceDetector::create(ungated), config.minFaceSize);
+    }
+    switch (config.backend) {
+        case DETECTOR_CPU_HOG:
+            return cv::makePtr<HogFaceDetector>(config);
+        case DETECTOR_CUDA_CASCADE:
+#ifdef HAVE_OPENCV_CUDAOBJDETECT
+            return cv::makePtr<CudaCascadeFaceDetector>(config);
+#else
+            std::cerr << "OpenCV was built without CUDA, using CPU cascade detector instead." << std::endl;
+            // fall through to the CPU cascade
+#endif
+        case DETECTOR_CPU_CASCADE:
+        default: {
+            cv::Ptr<CascadeFaceDetector> detector = cv::makePtr<CascadeFaceDetector>(config);
+            if (!detector->isLoaded())
+                CV_Error(cv::Error::StsObjectNotFound, "Unable to load cascade from " + config.cascadePath);
+            return detector;
+        }
+    }
+}
+
+/**
+ * CPU cascade detector (Haar or LBP xml). cv::CascadeClassifier parallelizes over the scale pyramid internally, on
+ * OpenCV's process wide thread pool, which the application sizes once with cv::setNumThreads. Check isLoaded before
+ * use, FaceDetector::create does.
+ * @param config cascade path, pyramid step and face size limits
+ */
+CascadeFaceDetector::CascadeFaceDetector(const DetectorConfig& config) {
+    m_config = config;
+    m_cascade.load(m_config.cascadePath);
+}
+
+bool CascadeFaceDetector::isLoaded() const {
+    return !m_cascade.empty();
+}
+
+void CascadeFaceDetector::detect(const cv::Mat& frame, std::vector<cv::Rect>& faceRects) {
+    faceRects.clear();
+    if (frame.channels() == 3)
+        cv::cvtColor(frame, m_grayFrame, cv::COLOR_BGR2GRAY);
+    else
+        m_grayFrame = frame;
+    cv::Size minSize(m_config.minFaceSize, m_config.minFaceSize);
+    cv::Size maxSize(m_config.maxFaceSize, m_config.maxFaceSize);
+    m_cascade.detectMultiScale(m_grayFrame, faceRects, m_config.scaleFactor, m_config.minNeighbors, 0, minSize,
+                               maxSize);
+}
+
+/**
+ * dlib HOG detector. The frame is rescaled once so that minFaceSize maps onto the 80x80 HOG window (downscaling when
+ * only large faces are of interest). If maxFaceSize is set, the frame is split into horizontal bands that overlap by
+ * the largest face height and the bands are scanned in parallel, one detector copy per band. dlib uses its own
+ * pyramid step, scaleFactor is not used by this backend.
+ * @param config face size limits and number of threads
+ */
+HogFaceDetector::HogFaceDetector(const DetectorConfig& config) {
+    m_config = config;
+    int nmbrThreads = m_config.numThreads > 0 ? m_config.numThreads : cv::getNumThreads();
+    m_detectors.resize(std::max(1, nmbrThreads), dlib::get_frontal_face_detector());
+}
+
+void HogFaceDetector::detect(const cv::Mat& frame, std::vector<cv::Rect>& faceRects) {
+    faceRects.clear();
+    double scale = 1.;
+    if (m_config.minFaceSize > 0)
+        scale = double(HOG_WINDOW_SIZE) / m_config.minFaceSize;
+    if (std::abs(scale - 1.) > 1e-3)
+        cv::resize(frame, m_scaledFrame, cv::Size(), scale, scale, cv::INTER_LINEAR);
+    else
+        m_scaledFrame = frame;
+
+    int rows = m_scaledFrame.rows;
+    int overlap = rows;
+    int nmbrBands = 1;
+    if (m_config.maxFaceSize > 0) {
+        overlap = int(std::ceil(m_config.maxFaceSize * scale)) + 1;
+        nmbrBands = std::min<int>(m_detectors.size(), std::max(1, rows / std::max(overlap, HOG_WINDOW_SIZE)));
+    }
+    int bandHeight = (rows + nmbrBands - 1) / nmbrBands;
+
+    std::vector<std::vector<dlib::rect_detection> > bandDetections(nmbrBands);
+    cv::parallel_for_(cv::Range(0, nmbrBands), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; i++) {
+            int top = i * bandHeight;
+            int bottom = std::min(rows, top + bandHeight + (i + 1 < nmbrBands ? overlap : 0));
+            cv::Mat band = m_scaledFrame.rowRange(top, bottom);
+            dlib::cv_image<dlib::bgr_pixel> bandImg(band);
+            m_detectors[i](bandImg, bandDetections[i]);
+            for (auto& det : bandDetections[i])
+                det.rect = dlib::translate_rect(det.rect, 0, top);
+        }
+    });
+
+    std::vector<dlib::rect_detection> detections;
+    for (auto& band : bandDetections)
+        detections.insert(detections.end(), band.begin(), band.end());
+    std::sort(detections.begin(), detections.end(),
+              [](const dlib::rect_detection& a, const dlib::rect_detection& b) {
+                  return a.detection_confidence > b.detection_confidence;
+              });
+
+    // faces inside the overlap of two bands are found twice, keep the more confident one
+    for (auto& det : detections) {
+        cv::Rect rect(int(det.rect.left() / scale), int(det.rect.top() / scale),
+                      int(det.rect.width() / scale), int(det.rect.height() / scale));
+        if (m_config.maxFaceSize > 0 && std::max(rect.width, rect.height) > m_config.maxFaceSize)
+            continue;
+        bool duplicate = false;
+        for (auto& kept : faceRects) {
+            if (intersectionOverUnion(rect, kept) > 0.5) {
+                duplicate = true;
+                break;
+            }
+        }
+        if (!duplicate)
+            faceRects.push_back(rect);
+    }
+}
+
+#ifdef HAVE_OPENCV_CUDAOBJDETECT
+CudaCascadeFaceDetector::CudaCascadeFaceDetector(const DetectorConfig& config) {
+    m_cascade = cv::cuda::CascadeClassifier::create(config.cascadePath);
+    m_cascade->setScaleFactor(config.scaleFactor);
+    m_cascade->setMinNeighbors(config.minNeighbors);
+    m_cascade->setMinObjectSize(cv::Size(config.minFaceSize, config.minFaceSize));
+    if (config.maxFaceSize > 0)
+        m_cascade->setMaxObjectSize(cv::Size(config.maxFaceSize, config.maxFaceSize));
+}
+
+void CudaCascadeFaceDetector::detect(const cv::Mat& frame, std::vector<cv::Rect>& faceRects) {
+    faceRects.clear();
+    {
+        ScopedTimer timer(PROFILE_UPLOAD);
+        m_frame.upload(frame);
+    }
+    cv::cuda::cvtColor(m_frame, m_grayFrame, cv::COLOR_BGR2GRAY);
+    m_cascade->detectMultiScale(m_grayFrame, m_objBuf);
+    m_cascade->convert(m_objBuf, faceRects);
+}
+#endif
@@ -0,0 +1,96 @@
+#ifndef FACE_RECOGNITION_FACEDETECTOR_H
+#define FACE_RECOGNITION_FACEDETECTOR_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/objdetect.hpp>
+#include <opencv2/opencv_modules.hpp>
+#ifdef HAVE_OPENCV_CUDAOBJDETECT
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/cudaobjdetect.hpp>
+#include <opencv2/cudaimgproc.hpp>
+#endif
+#include <dlib/image_processing/frontal_face_detector.h>
+#include <dlib/opencv/cv_image.h>
+
+enum DetectorBackend {
+    DETECTOR_CPU_CASCADE,   // cv::CascadeClassifier, fastest on CPU (default)
+    DETECTOR_CPU_HOG,       // dlib HOG frontal face detector, more accurate but slower
+    DETECTOR_CUDA_CASCADE   // cv::cuda::CascadeClassifier, only if OpenCV was built with CUDA
+};
+
+struct DetectionGateConfig {
+    bool enabled = false;           // motion gate in front of the detector, see GatedFaceDetector
+    std::vector<cv::Rect> rois;     // the only regions of this camera ever searched, empty for the whole frame
+    int motionWidth = 160;          // width of the grayscale copy compared between frames
+    int motionThreshold = 20;       // gray level difference of a pixel counted as motion
+    double minMotionFraction = 0.001;   // of the ROI pixels that must change to count as motion
+    bool searchAroundFaces = true;  // search only moving regions and around previous faces, otherwise full scans
+    double regionMargin = 0.5;      // added on every side of a region, relative to its larger side
+    int fullScanInterval = 30;      // frames between forced full scans, 0 for none
+    double maxRegionFraction = 0.5; // full scan instead when the regions cover more of the ROIs
+};
+
+struct DetectorConfig {
+    DetectorBackend backend = DETECTOR_CPU_CASCADE;
+    std::string cascadePath = "../models/haarcascade_frontalface_default.xml";
+    double scaleFactor = 1.1;   // scale-pyramid step between two detection scales
+    int minNeighbors = 3;
+    int minFaceSize = 40;       // in pixels, faces smaller than this are ignored
+    int maxFaceSize = 0;        // in pixels, 0 means no upper limit
+    // HOG bands scanned in parallel, 0 uses OpenCV's thread count; the cascade runs on OpenCV's process wide pool,
+    // which the application sets once with cv::setNumThreads
+    int numThreads = 0;
+    DetectionGateConfig gate;   // per camera, keep disabled for unrelated images
+};
+
+/**
+ * Interface for face detectors. A detector finds face bounding boxes in a BGR frame on the host, so that
+ * FaceExtractor never needs to upload frames to a GPU unless a CUDA backend is selected explicitly.
+ */
+class FaceDetector {
+public:
+    virtual ~FaceDetector() {}
+    virtual void detect(const cv::Mat& frame, std::vector<cv::Rect>& faceRects) = 0;
+    virtual void printReport(std::ostream& out) const {}
+    virtual void reset() {}     // forgets earlier frames, e.g. before frames of another camera
+    static cv::Ptr<FaceDetector> create(const DetectorConfig& config);
+};
+
+class CascadeFaceDetector : public FaceDetector {
+private:
+    cv::CascadeClassifier m_cascade;
+    DetectorConfig m_config;
+    cv::Mat m_grayFrame;
+public:
+    explicit CascadeFaceDetector(const DetectorConfig& config);
+    bool isLoaded() const;
+    void detect(const cv::Mat& frame, std::vector<cv::Rect>& faceRects) override;
+};
+
+class HogFaceDetector : public FaceDetector {
+private:
+    std::vector<dlib::frontal_face_detector> m_detectors;   // one copy per band, detectors are not thread-safe
+    DetectorConfig m_config;
+    cv::Mat m_scaledFrame;
+public:
+    explicit HogFaceDetector(const DetectorConfig& config);
+    void detect(const cv::Mat& frame, std::vector<cv::Rect>& faceRects) override;
+};
+
+#ifdef HAVE_OPENCV_CUDAOBJDETECT
+class CudaCascadeFaceDetector : public FaceDetector {
+private:
+    cv::Ptr<cv::cuda::CascadeClassifier> m_cascade;
+    cv::cuda::GpuMat m_frame, m_grayFrame, m_objBuf;
+public:
+    explicit CudaCascadeFaceDetector(const DetectorConfig& config);
+    void detect(const cv::Mat& frame, std::vector<cv::Rect>& faceRects) override;
+};
+#endif
+
+
+#endif //FACE_RECOGNITION_FACEDETECTOR_H
@@ -1,104 +1,182 @@
 #include "FaceExtractor.h"
+#include <opencv2/imgcodecs.hpp>
+
+FaceExtractor::FaceExtractor() : FaceExtractor(160, 160, DetectorConfig()) {
+}
 
-FaceExtractor::FaceExtractor() {
 
-    this->m_faceWidth = 160;
-    this->m_faceHeight = 160;
-    this->m_haarDetector = cv::cuda::CascadeClassifier::create("../models/haarcascade_frontalface_default.xml");
+FaceExtractor::FaceExtractor(int faceWidth, int faceHeight) : FaceExtractor(faceWidth, faceHeight, DetectorConfig()) {
 }
 
+static DetectorConfig cascadeConfig(const std::string& haarCascadePath) {
+    DetectorConfig detectorConfig;
+    detectorConfig.cascadePath = haarCascadePath;
+    return detectorConfig;
+}
 
-FaceExtractor::FaceExtractor(int faceWidth, int faceHeight) {
+FaceExtractor::FaceExtractor(int faceWidth, int faceHeight, std::string haarCascadePath)
+        : FaceExtractor(faceWidth, faceHeight, cascadeConfig(haarCascadePath)) {
+}
 
+/**
+ * All other constructors delegate here, so the detector is created exactly once. The dlib detector of getCroppedFaces
+ * is only loaded on its first use.
+ */
+FaceExtractor::FaceExtractor(int faceWidth, int faceHeight, const DetectorConfig& detectorConfig) {
     this->m_faceWidth = faceWidth;
     this->m_faceHeight = faceHeight;
+    this->setDetector(detectorConfig);
 }
 
-FaceExtractor::FaceExtractor(int faceWidth, int faceHeight, std::string haarCascadePath) {
-    this->m_faceWidth = faceWidth;
-    this->m_faceHeight = faceHeight;
-    this->m_haarDetector = cv::cuda::CascadeClassifier::create(haarCascadePath);
-}
-
-void FaceExtractor::getCroppedFaces(cv::Mat frame, std::vector<cv::Mat> &croppedFaces, bool verbose) {
-
-    int frameHeight = frame.rows;
-    int frameWidth = frame.cols;
-    int faceWidth, faceHeight;
-    int padLeft = 0, padTop = 0, padRight = 0, padBottom = 0;
-    cv::Mat rgbFrame, paddedFrame;
-    cv::cvtColor(frame, rgbFrame, cv::COLOR_BGR2RGB);
-    dlib::cv_image<dlib::rgb_pixel> inputImg(rgbFrame);
-    std::vector<dlib::rectangle> faceRects = m_ffdetector(inputImg);
-
-    if (!faceRects.empty()){
-        for (auto itFace=faceRects.begin(); itFace!=faceRects.end(); itFace++) {
-            // check if face was detected close to edges, if yes pad frame to include the ROI
-            // and then update the position of the ROI --> face
-            if (itFace->left() < 0) {
-                padLeft = std::abs(itFace->left());
-                itFace->left() = 0;
-            }
-            if (itFace->top() < 0) {
-                padTop = std::abs(itFace->top());
-                itFace->top() = 0;
-            }
-            if (itFace->right() > frameWidth) {
-                padRight = (itFace->right() - frameWidth);
-                itFace->right() -= 1;
-            }
-            if (itFace->bottom() > frameHeight) {
-                padBottom = (itFace->bottom() - frameHeight);
-                itFace->bottom() -= 1;
-            }
-            cv::Scalar blackPixel(0,0,0);
-            cv::copyMakeBorder(frame, paddedFrame, padTop, padBottom, padLeft, padRight, cv::BORDER_CONSTANT, blackPixel);
-
-            // convert to OpenCV rectangles, crop, resize and append to croppedFaces vector for main
-            cv::Rect faceRectCV = this->dlibRectangleToOpenCV(*itFace);
-            cv::Mat tempCrop = paddedFrame(faceRectCV);
-            cv::resize(tempCrop, tempCrop, cv::Size(m_faceWidth, m_faceHeight), 0, 0, cv::INTER_CUBIC);
-            croppedFaces.push_back(tempCrop);
-        }
-    }
+void FaceExtractor::setDetector(const DetectorConfig& detectorConfig) {
+    m_detector = FaceDetector::create(detectorConfig);
+}
 
-    //show gui for debugging
-    if (verbose){
-//        cv::imshow("frame in function", frame);
-        std::cout << "Currently " << croppedFaces.size() << " face detected!" << std::endl;
-        if (croppedFaces.size() == 1) cv::imshow("face1", croppedFaces[0]);
-        if (croppedFaces.size() == 2) {
-            cv::imshow("face1", croppedFaces[0]);
-            cv::imshow("face2", croppedFaces[1]);
-        }
-    }
-    faceRects.clear();
+/**
+ * Enables or disables the alignment of every crop, see FaceAligner. Embeddings of aligned and unaligned crops are not
+ * comparable, so the gallery has to be enrolled with the same setting.
+ * @param alignmentConfig shape predictor and margin, alignment stays off if the shape predictor cannot be loaded
+ */
+void FaceExtractor::setAligner(const AlignmentConfig& alignmentConfig) {
+    m_aligner.release();
+    if (!alignmentConfig.enabled)
+        return;
+    cv::Ptr<FaceAligner> aligner(new FaceAligner(alignmentConfig));
+    if (aligner->isLoaded())
+        m_aligner = aligner;
+}
+
+bool FaceExtractor::isAligning() const {
+    return !m_aligner.empty();
+}
+
+void FaceExtractor::detectFaces(const cv::Mat& frame, std::vector<cv::Rect>& faceRects) {
+    ScopedTimer timer(PROFILE_DETECT);
+    m_detector->detect(frame, faceRects);
+}
+
+/**
+ * Clears the state the detector keeps between frames (the detection gate), so frames of an unrelated source start over.
+ */
+void FaceExtractor::resetDetector() {
+    m_detector->reset();
+}
+
+/**
+ * Prints the statistics of the detector, so far only the detection gate has any.
+ */
+void FaceExtractor::printDetectorReport(std::ostream& out) const {
+    m_detector->printReport(out);
 }
 
+/**
+ * Crops faceRect from frame and resizes it to the face size. The ROI is clamped to the frame, a face reaching over the
+ * edge of the frame is padded black on the crop only, so it keeps its aspect ratio without copying the frame. With
+ * alignment enabled the face is warped onto the landmark template instead.
+ * @param frame BGR frame, only read through a view
+ * @param faceRect face, may reach outside of the frame
+ * @param croppedFace resized face, empty if faceRect does not overlap the frame
+ */
+void FaceExtractor::cropFace(const cv::Mat& frame, const cv::Rect& faceRect, cv::Mat& croppedFace) {
+    ScopedTimer timer(PROFILE_CROP);
+    cv::Rect roi = faceRect & cv::Rect(0, 0, frame.cols, frame.rows);
+    if (roi.area() == 0) {
+        croppedFace.release();
+        return;
+    }
+    if (m_aligner) {
+        m_aligner->alignFace(frame, faceRect, m_faceWidth, croppedFace);
+        return;
+    }
+    cv::Size faceSize(m_faceWidth, m_faceHeight);
+    if (roi == faceRect) {
+        cv::resize(frame(roi), croppedFace, faceSize, 0, 0, cv::INTER_CUBIC);
+        return;
+    }
+    cv::Mat paddedFace;
+    cv::copyMakeBorder(frame(roi), paddedFace, roi.y - faceRect.y, faceRect.br().y - roi.br().y, roi.x - faceRect.x,
+                       faceRect.br().x - roi.br().x, cv::BORDER_CONSTANT, cv::Scalar(0, 0, 0));
+    cv::resize(paddedFace, croppedFace, faceSize, 0, 0, cv::INTER_CUBIC);
+}
 
-void FaceExtractor::getCroppedFacesHaar(cv::Mat& frame, cv::cuda::GpuMat d_frame, std::vector<cv::Mat> &croppedFaces, bool verbose) {
-    cv::cuda::GpuMat objBuf, d_grayFrame;
-    std::vector<cv::Rect> faceRects;
-    cv::cuda::cvtColor(d_frame, d_grayFrame, CV_BGR2GRAY);
-    this->m_haarDetector->detectMultiScale(d_grayFrame, objBuf);
-    this->m_haarDetector->convert(objBuf, faceRects);
-    for(auto itFace = faceRects.begin(); itFace != faceRects.end(); ++itFace) {
-        cv::Mat tempCrop = frame(*itFace);
+/**
+ * Appends the crops of all face rectangles to croppedFaces, see cropFace. The rectangles are clipped to the frame and
+ * the ones outside of it are dropped.
+ */
+void FaceExtractor::cropFaces(const cv::Mat& frame, std::vector<cv::Rect>& faceRects,
+                              std::vector<cv::Mat> &croppedFaces) {
+    cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+    std::vector<cv::Rect>::iterator kept = faceRects.begin();
+    for (auto itFace = faceRects.begin(); itFace != faceRects.end(); ++itFace) {
         cv::Mat finalCrop;
-        cv::resize(tempCrop, finalCrop, cv::Size(m_faceWidth, m_faceHeight), 0, 0, cv::INTER_CUBIC);
+        this->cropFace(frame, *itFace, finalCrop);
+        if (finalCrop.empty())
+            continue;
         croppedFaces.push_back(finalCrop);
+        *kept++ = *itFace & frameRect;
     }
-    //show gui for debugging
-    if (verbose){
+    faceRects.erase(kept, faceRects.end());
+}
+
+/**
+ * Drops the face rectangles outside of the frame, without cropping. The rectangles stay as they are, so they can be
+ * cropped later including the padding over the frame edges, e.g. by cropStandardizeFaces.
+ * @param faceRects detected faces, the ones not overlapping the frame are removed
+ * @param clippedRects faceRects clipped to the frame, for display and tracking
+ */
+void FaceExtractor::clipFaces(const cv::Mat& frame, std::vector<cv::Rect>& faceRects,
+                              std::vector<cv::Rect>& clippedRects) {
+    cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+    clippedRects.clear();
+    std::vector<cv::Rect>::iterator kept = faceRects.begin();
+    for (auto itFace = faceRects.begin(); itFace != faceRects.end(); ++itFace) {
+        cv::Rect clipped = *itFace & frameRect;
+        if (clipped.area() == 0)
+            continue;
+        clippedRects.push_back(clipped);
+        *kept++ = *itFace;
+    }
+    faceRects.erase(kept, faceRects.end());
+}
+
+void FaceExtractor::getCroppedFacesDetector(const cv::Mat& frame, std::vector<cv::Mat> &croppedFaces, bool verbose) {
+    this->detectFaces(frame, m_faceRects);
+    this->cropFaces(frame, m_faceRects, croppedFaces);
+    // the library has no GUI, callers show the crops themselves
+    if (verbose)
         std::cout << "Currently " << croppedFaces.size() << " face detected!" << std::endl;
-        if (croppedFaces.size() == 1) cv::imshow("face1", croppedFaces[0]);
-        if (croppedFaces.size() == 2) {
-            cv::imshow("face1", croppedFaces[0]);
-            cv::imshow("face2", croppedFaces[1]);
-        }
+}
+
+void FaceExtractor::getCroppedFaces(const cv::Mat& frame, std::vector<cv::Mat> &croppedFaces, bool verbose) {
+    if (m_ffdetector.num_detectors() == 0)
+        m_ffdetector = dlib::get_frontal_face_detector();
+    this->getCroppedFaces(frame, croppedFaces, verbose, m_ffdetector);
+}
+
+/**
+ * Same as above with a caller owned dlib detector. dlib detectors are not thread-safe, threads that crop faces in
+ * parallel pass one detector copy each.
+ */
+void FaceExtractor::getCroppedFaces(const cv::Mat& frame, std::vector<cv::Mat> &croppedFaces, bool verbose,
+                                    dlib::frontal_face_detector& detector) {
+    // dlib reads the BGR frame in place, the detector converts to gray itself
+    dlib::cv_image<dlib::bgr_pixel> inputImg(frame);
+    std::vector<dlib::rectangle> faceRects;
+    {
+        ScopedTimer timer(PROFILE_DETECT);
+        faceRects = detector(inputImg);
+    }
+    for (auto itFace = faceRects.begin(); itFace != faceRects.end(); itFace++) {
+        cv::Mat croppedFace;
+        this->cropFace(frame, this->dlibRectangleToOpenCV(*itFace), croppedFace);
+        if (!croppedFace.empty())
+            croppedFaces.push_back(croppedFace);
     }
-    faceRects.clear();
 
+    // the library has no GUI, callers show the crops themselves
+    if (verbose)
+        std::cout << "Currently " << croppedFaces.size() << " face detected!" << std::endl;
+    faceRects.clear();
 }
 
 
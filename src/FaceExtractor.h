@@ -3,30 +3,42 @@
 
 #include <iostream>
 #include <opencv2/imgproc.hpp>
-#include <opencv2/highgui.hpp>
-#include <opencv2/core/cuda.hpp>
-#include <opencv2/cudaobjdetect.hpp>
-#include <opencv2/cudaimgproc.hpp>
 #include <dlib/image_processing/frontal_face_detector.h>
 #include <dlib/image_processing.h>
 #include <dlib/matrix.h>
 #include <dlib/opencv.h>
 #include <dlib/opencv/cv_image.h>
-#include <dlib/gui_widgets.h>
+#include "FaceDetector.h"
+#include "FaceAligner.h"
+#include "Profiler.h"
 
 
 class FaceExtractor {
 protected:
     int m_faceWidth;
     int m_faceHeight;
-    dlib::frontal_face_detector m_ffdetector = dlib::get_frontal_face_detector();
-    cv::Ptr<cv::cuda::CascadeClassifier> m_haarDetector;
+    dlib::frontal_face_detector m_ffdetector;   // loaded by the first getCroppedFaces without a detector
+    cv::Ptr<FaceDetector> m_detector;
+    cv::Ptr<FaceAligner> m_aligner;     // null unless alignment is enabled
+    std::vector<cv::Rect> m_faceRects;
 public:
     FaceExtractor();
     FaceExtractor(int faceWidth, int faceHeight);
     FaceExtractor(int faceWidth, int faceHeight, std::string haarCascadePath);
-    void getCroppedFaces(cv::Mat frame, std::vector<cv::Mat> &croppedFaces, bool verbose);
-    void getCroppedFacesHaar(cv::Mat& frame, cv::cuda::GpuMat d_frame, std::vector<cv::Mat> &croppedFaces, bool verbose);
+    FaceExtractor(int faceWidth, int faceHeight, const DetectorConfig& detectorConfig);
+    void setDetector(const DetectorConfig& detectorConfig);
+    void setAligner(const AlignmentConfig& alignmentConfig);
+    bool isAligning() const;
+    void detectFaces(const cv::Mat& frame, std::vector<cv::Rect>& faceRects);
+    void printDetectorReport(std::ostream& out) const;
+    void resetDetector();
+    void cropFace(const cv::Mat& frame, const cv::Rect& faceRect, cv::Mat& croppedFace);
+    void cropFaces(const cv::Mat& frame, std::vector<cv::Rect>& faceRects, std::vector<cv::Mat> &croppedFaces);
+    void clipFaces(const cv::Mat& frame, std::vector<cv::Rect>& faceRects, std::vector<cv::Rect>& clippedRects);
+    void getCroppedFacesDetector(const cv::Mat& frame, std::vector<cv::Mat> &croppedFaces, bool verbose);
+    void getCroppedFaces(const cv::Mat& frame, std::vector<cv::Mat> &croppedFaces, bool verbose);
+    void getCroppedFaces(const cv::Mat& frame, std::vector<cv::Mat> &croppedFaces, bool verbose,
+                         dlib::frontal_face_detector& detector);
     void saveCroppedFaces(std::string pathToFile);
     static cv::Rect dlibRectangleToOpenCV(dlib::rectangle r);
     void setCropWidthHeight(int faceWidth, int faceHeight);
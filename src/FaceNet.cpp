@@ -1,18 +1,51 @@
 #include "FaceNet.h"
+#include <sys/stat.h>
+#include "tensorflow/core/lib/core/errors.h"
+#ifdef __linux__
+#include <sched.h>
+#endif
 /**
  * Constructor for FaceNetClassifier objects. It initializes the tensorflow session and creates the computation graph.
  * @param modelPath local path to the TensorFlow model as protobuf (.pb) file
  * @param knownPersonThreshold Threshold for the euclidean distance between face encodings to decide whether detected
  * face is known or not
  */
-FaceNetClassifier::FaceNetClassifier(std::string modelPath, float knownPersonThreshold) {
+FaceNetClassifier::FaceNetClassifier(std::string modelPath, float knownPersonThreshold)
+        : FaceNetClassifier(modelPath, knownPersonThreshold, DetectorConfig(), SessionConfig()) {
+}
+
+/**
+ * Same as above, but the face detector used by forward is chosen by detectorConfig (CPU cascade, dlib HOG or CUDA
+ * cascade).
+ * @param modelPath local path to the TensorFlow model as protobuf (.pb) file
+ * @param knownPersonThreshold Threshold for the euclidean distance between face encodings
+ * @param detectorConfig backend and parameters of the face detector used for live frames
+ */
+FaceNetClassifier::FaceNetClassifier(std::string modelPath, float knownPersonThreshold,
+                                     const DetectorConfig& detectorConfig)
+        : FaceNetClassifier(modelPath, knownPersonThreshold, detectorConfig, SessionConfig()) {
+}
+
+/**
+ * Same as above, additionally the thread pools, graph optimizations and warm-up of the TensorFlow session are chosen by
+ * sessionConfig. The warm-up is deferred until the batch size is final, see warmUp.
+ * @param modelPath local path to the TensorFlow model as protobuf (.pb) file
+ * @param knownPersonThreshold Threshold for the euclidean distance between face encodings
+ * @param detectorConfig backend and parameters of the face detector used for live frames
+ * @param sessionConfig thread pools, CPU affinity, graph optimizations and warm-up iterations
+ */
+FaceNetClassifier::FaceNetClassifier(std::string modelPath, float knownPersonThreshold,
+                                     const DetectorConfig& detectorConfig, const SessionConfig& sessionConfig)
+        : FaceExtractor(160, 160, detectorConfig) {
+    this->modelPath = modelPath;
     this->knownPersonThresh = knownPersonThreshold;
-    Status status = NewSession(SessionOptions(), &this->session);
-    this->checkStatus(status);
-    status = ReadBinaryProto(Env::Default(), modelPath, &this->graphDef);
-    this->checkStatus(status);
-    status = this->session->Create(this->graphDef);
-    this->checkStatus(status);
+    this->sessionConfig = sessionConfig;
+    this->createPhaseTensor();
+    this->createSession();
+}
+
+FaceNetClassifier::~FaceNetClassifier() {
+    this->deleteSession();
 }
 
 
@@ -27,6 +60,268 @@ void FaceNetClassifier::checkStatus(Status status) {
     }
 }
 
+/**
+ * Fills session options from sessionConfig: thread pools, devices and graph optimizations. Per-session thread pools
+ * are used whenever pool sizes or an affinity are given, so that they are created with the session and not shared with
+ * other sessions.
+ */
+void FaceNetClassifier::getSessionOptions(SessionOptions& options) const {
+    const SessionConfig& config = this->sessionConfig;
+    options.config.set_intra_op_parallelism_threads(config.intraOpThreads);
+    options.config.set_inter_op_parallelism_threads(config.interOpThreads);
+    options.config.set_use_per_session_threads(config.intraOpThreads > 0 || config.interOpThreads > 0 ||
+                                               !config.cpuAffinity.empty());
+    if (config.cpuOnly) {
+        (*options.config.mutable_device_count())["GPU"] = 0;
+        // nodes pinned to a GPU in the frozen graph run on the CPU instead
+        options.config.set_allow_soft_placement(true);
+    }
+
+    OptimizerOptions* optimizerOptions = options.config.mutable_graph_options()->mutable_optimizer_options();
+    optimizerOptions->set_opt_level(config.optimizeGraph ? OptimizerOptions::L1 : OptimizerOptions::L0);
+    optimizerOptions->set_do_constant_folding(config.optimizeGraph);
+    optimizerOptions->set_do_common_subexpression_elimination(config.optimizeGraph);
+    optimizerOptions->set_do_function_inlining(config.optimizeGraph);
+    if (config.enableXla)
+        optimizerOptions->set_global_jit_level(OptimizerOptions::ON_1);
+
+    RewriterConfig* rewriteOptions = options.config.mutable_graph_options()->mutable_rewrite_options();
+    if (config.rewriteGraph) {
+        rewriteOptions->set_constant_folding(RewriterConfig::ON);
+        rewriteOptions->set_arithmetic_optimization(RewriterConfig::ON);
+        rewriteOptions->set_dependency_optimization(RewriterConfig::ON);
+        rewriteOptions->set_layout_optimizer(RewriterConfig::ON);
+        rewriteOptions->set_remapping(RewriterConfig::ON);
+    }
+    else {
+        rewriteOptions->set_disable_meta_optimizer(true);
+    }
+}
+
+/**
+ * Creates the TensorFlow session with the options of sessionConfig and loads the graph into it. With cpuAffinity, the
+ * calling thread is pinned while the session creates its thread pools, which inherit the affinity, and restored
+ * afterwards.
+ */
+void FaceNetClassifier::createSession() {
+    const SessionConfig& config = this->sessionConfig;
+    this->deleteSession();
+    SessionOptions options;
+    this->getSessionOptions(options);
+
+#ifdef __linux__
+    cpu_set_t previousAffinity;
+    bool pinned = false;
+    if (!config.cpuAffinity.empty()) {
+        cpu_set_t affinity;
+        CPU_ZERO(&affinity);
+        for (int core : config.cpuAffinity)
+            CPU_SET(core, &affinity);
+        pinned = sched_getaffinity(0, sizeof(previousAffinity), &previousAffinity) == 0 &&
+                 sched_setaffinity(0, sizeof(affinity), &affinity) == 0;
+        if (!pinned)
+            std::cout << "Could not pin the session threads to the given cores" << std::endl;
+    }
+#endif
+
+    Session* newSession = nullptr;
+    Status status = NewSession(options, &newSession);
+    this->checkStatus(status);
+    this->session.reset(newSession);
+    this->loadGraph();
+    status = this->session->Create(this->graphDef);
+    this->checkStatus(status);
+
+#ifdef __linux__
+    if (pinned)
+        sched_setaffinity(0, sizeof(previousAffinity), &previousAffinity);
+#endif
+}
+
+/**
+ * Path of a transformed graph next to the model, with variant "optimized" models/20180402-114759.pb becomes
+ * models/20180402-114759.optimized.pb.
+ */
+std::string FaceNetClassifier::getModelVariantPath(const std::string& variant) const {
+    std::size_t index = this->modelPath.find_last_of(".");
+    std::size_t slash = this->modelPath.find_last_of("/");
+    if (index == std::string::npos || (slash != std::string::npos && index < slash))
+        return this->modelPath + "." + variant + ".pb";
+    return this->modelPath.substr(0, index) + "." + variant + ".pb";
+}
+
+/**
+ * Loads the graph into graphDef. With useOptimizedGraph or a reduced precision, the transformed graph next to the model
+ * (optimized, fp16 or int8) is loaded if it is at least as new as the model, otherwise it is computed by transformGraph
+ * and saved for the next start. If the optimization fails, the model is used as it is. If the conversion to fp16 or
+ * int8 fails, the program exits instead of silently running the float model. Delete the int8 file to calibrate again.
+ */
+void FaceNetClassifier::loadGraph() {
+    const SessionConfig& config = this->sessionConfig;
+    std::string variant;
+    if (config.precision == PRECISION_INT8)
+        variant = "int8";
+    else if (config.precision == PRECISION_FLOAT16_STORAGE)
+        variant = "fp16";
+    else if (config.useOptimizedGraph)
+        variant = "optimized";
+
+    struct stat modelStat, variantStat;
+    std::string variantPath = variant.empty() ? "" : this->getModelVariantPath(variant);
+    bool variantLoaded = false;
+    if (!variant.empty() && stat(this->modelPath.c_str(), &modelStat) == 0 &&
+        stat(variantPath.c_str(), &variantStat) == 0 && variantStat.st_mtime >= modelStat.st_mtime)
+        variantLoaded = ReadBinaryProto(Env::Default(), variantPath, &this->graphDef).ok();
+    this->graphTransformed = variantLoaded;
+
+    if (!variantLoaded) {
+        Status status = ReadBinaryProto(Env::Default(), this->modelPath, &this->graphDef);
+        this->checkStatus(status);
+        if (!variant.empty()) {
+            GraphDef transformed;
+            status = this->transformGraph(transformed);
+            if (status.ok()) {
+                this->graphDef.Swap(&transformed);
+                this->graphTransformed = true;
+                if (!WriteBinaryProto(Env::Default(), variantPath, this->graphDef).ok())
+                    std::cout << "Could not save the " << variant << " graph to " << variantPath << std::endl;
+            }
+            else if (config.precision != PRECISION_FLOAT32) {
+                std::cout << "Conversion of the model to " << variant << " failed" << std::endl;
+                this->checkStatus(status);
+            }
+            else {
+                std::cout << "Graph transformation failed, using the model as it is: " << status.ToString() <<
+                          std::endl;
+            }
+        }
+    }
+
+    this->feedPhaseTrain = false;
+    for (const NodeDef& node : this->graphDef.node())
+        this->feedPhaseTrain = this->feedPhaseTrain || node.name() == "phase_train";
+}
+
+/**
+ * Optimizes graphDef (phase_train bound to false, batch norms and constants folded, unused nodes removed) and converts
+ * it to the precision of sessionConfig: fp16 weights, or int8 convolutions and matmuls calibrated on the images in
+ * calibrationImagesPath.
+ * @param transformed the transformed graph, only valid if the returned status is ok
+ */
+Status FaceNetClassifier::transformGraph(GraphDef& transformed) {
+    GraphOptimizerStats stats;
+    TF_RETURN_IF_ERROR(optimizeGraph(this->graphDef, GraphOptimizerConfig(), transformed, stats));
+    std::cout << "Optimized graph from " << stats.nodesBefore << " to " << stats.nodesAfter << " nodes: " <<
+              stats.switchesResolved << " switches resolved, " << stats.batchNormsFolded << " batch norms and " <<
+              stats.constantsFolded << " constants folded" << std::endl;
+
+    GraphDef converted;
+    if (this->sessionConfig.precision == PRECISION_FLOAT16_STORAGE) {
+        TF_RETURN_IF_ERROR(convertWeightsToHalf(transformed, converted, stats));
+        std::cout << "Converted the weights of " << stats.nodesQuantized << " layers to fp16, for storage only" <<
+                  std::endl;
+        transformed.Swap(&converted);
+    }
+    else if (this->sessionConfig.precision == PRECISION_INT8) {
+        std::map<std::string, ActivationRange> inputRanges;
+        TF_RETURN_IF_ERROR(this->calibrate(transformed, inputRanges));
+        TF_RETURN_IF_ERROR(quantizeGraph(transformed, inputRanges, converted, stats));
+        std::cout << "Quantized " << stats.nodesQuantized << " layers to int8. Experimental: TensorFlow's reference "
+                     "int8 kernels are usually slower than float32" << std::endl;
+        transformed.Swap(&converted);
+    }
+    return Status::OK();
+}
+
+/**
+ * Post-training calibration for int8: runs the float32 graph on the first face of up to calibrationImages images of
+ * calibrationImagesPath (enrolment images work well) and records the smallest and largest value of the input of every
+ * quantizable node.
+ * @param floatGraph optimized float32 graph
+ * @param inputRanges input range per quantizable node name
+ */
+Status FaceNetClassifier::calibrate(const GraphDef& floatGraph, std::map<std::string, ActivationRange>& inputRanges) {
+    const SessionConfig& config = this->sessionConfig;
+    std::vector<struct Paths> paths;
+    if (!config.calibrationImagesPath.empty())
+        this->getFilePaths(config.calibrationImagesPath, paths);
+    std::sort(paths.begin(), paths.end(), [](const struct Paths& a, const struct Paths& b) {
+        return a.absPath < b.absPath;
+    });
+    // an evenly spaced sample of the images
+    std::vector<cv::Mat> croppedFaces;
+    int nmbrSamples = std::min<int>(paths.size(), config.calibrationImages);
+    for (int i = 0; i < nmbrSamples; i++) {
+        cv::Mat image = cv::imread(paths[size_t(i) * paths.size() / nmbrSamples].absPath);
+        std::vector<cv::Mat> faces;
+        if (!image.empty())
+            this->getCroppedFaces(image, faces, false);
+        if (!faces.empty())
+            croppedFaces.push_back(faces[0]);
+    }
+    if (croppedFaces.empty())
+        return errors::InvalidArgument("no faces for int8 calibration in \"", config.calibrationImagesPath, "\"");
+
+    std::vector<std::string> nodeNames, inputTensors;
+    findQuantizableNodes(floatGraph, nodeNames, inputTensors);
+    // same devices and thread pools as the inference session
+    SessionOptions options;
+    this->getSessionOptions(options);
+    std::unique_ptr<Session> calibrationSession(NewSession(options));
+    if (!calibrationSession)
+        return errors::Internal("could not create a session for int8 calibration");
+    TF_RETURN_IF_ERROR(calibrationSession->Create(floatGraph));
+    // activations of all layers are fetched at once, small batches bound the memory
+    const int calibrationBatchSize = 4;
+    for (int firstFace = 0; firstFace < croppedFaces.size(); firstFace += calibrationBatchSize) {
+        int batchSize = std::min<int>(calibrationBatchSize, croppedFaces.size() - firstFace);
+        Tensor batch(DT_FLOAT, TensorShape({batchSize, 160, 160, 3}));
+        for (int i = 0; i < batchSize; i++)
+            standardizeFace(croppedFaces[firstFace + i], batch.flat<float>().data() + i*160*160*3);
+        std::vector<Tensor> activations;
+        TF_RETURN_IF_ERROR(calibrationSession->Run({{"input:0", batch}}, inputTensors, {}, &activations));
+        for (int j = 0; j < nodeNames.size(); j++) {
+            auto values = activations[j].flat<float>();
+            auto range = inputRanges.find(nodeNames[j]);
+            if (range == inputRanges.end())
+                range = inputRanges.insert({nodeNames[j], {values(0), values(0)}}).first;
+            for (int64 v = 0; v < values.size(); v++) {
+                range->second.min = std::min(range->second.min, values(v));
+                range->second.max = std::max(range->second.max, values(v));
+            }
+        }
+    }
+    calibrationSession->Close();
+    std::cout << "Calibrated int8 ranges on " << croppedFaces.size() << " faces" << std::endl;
+    return Status::OK();
+}
+
+/**
+ * Runs the network warmUpIterations times on zero input for every batch bucket (1, 2, 4, ..., maxBatchSize) that was
+ * not warmed up yet. The first run of a session initializes kernels and memory lazily and every new input shape costs
+ * another one-off setup, the warm-up moves this from the first frames to the setup. Call it once the batch size is
+ * final, e.g. after setMaxBatchSize, otherwise the first embedding runs it. The pooled input tensors are allocated on
+ * the way, embeddings that were not fetched yet are kept.
+ */
+void FaceNetClassifier::warmUp() {
+    if (this->sessionConfig.warmUpIterations <= 0 || this->warmedUpBatchSize >= this->maxBatchSize)
+        return;
+    cv::Mat pendingOutputs;
+    std::swap(pendingOutputs, this->outputs);
+    for (int batchSize = 1; batchSize <= this->maxBatchSize; batchSize *= 2) {
+        if (batchSize <= this->warmedUpBatchSize)
+            continue;
+        Tensor& pooledTensor = this->getPooledInputTensor(batchSize);
+        pooledTensor.flat<float>().setZero();
+        this->inputTensor = pooledTensor.Slice(0, batchSize);
+        for (int it = 0; it < this->sessionConfig.warmUpIterations; it++)
+            this->inference(batchSize);
+        this->clearVariables();
+    }
+    this->warmedUpBatchSize = this->maxBatchSize;
+    std::swap(pendingOutputs, this->outputs);
+}
+
 /**
  * Checks image directory and returns all paths and filesnames. The directory structure should be imgs/class_name.jpg.
  * @param imagesPath absolute or relative path to the image directory.
@@ -61,61 +356,110 @@ void FaceNetClassifier::loadInputImage(std::string inputFilePath, cv::Mat& image
 }
 
 
-void FaceNetClassifier::preprocessInput(std::vector<cv::Mat>& croppedFaces) {
-    for (int i = 0; i < croppedFaces.size(); i++) {
-        //mean and std
-        cvtColor(croppedFaces[i], croppedFaces[i], CV_RGB2BGR);
-        cv::Mat temp = croppedFaces[i].reshape(1, croppedFaces[i].rows * 3);
-        cv::Mat     mean3;
-        cv::Mat     stddev3;
-        cv::meanStdDev(temp, mean3, stddev3);
+/**
+ * Sets the largest batch that is fed to the network in one run, more faces are embedded in several runs. The pooled
+ * input tensors are released and allocated again on demand.
+ * @param batchSize maximum number of faces per inference, rounded up to the next power of two
+ */
+void FaceNetClassifier::setMaxBatchSize(int batchSize) {
+    int bucketSize = 1;
+    while (bucketSize < batchSize)
+        bucketSize *= 2;
+    this->maxBatchSize = bucketSize;
+    this->inputTensorPool.clear();
+}
 
-        double mean_pxl = mean3.at<double>(0);
-        double stddev_pxl = stddev3.at<double>(0);
-        cv::Mat image2;
-        croppedFaces[i].convertTo(image2, CV_64FC1);
-        croppedFaces[i] = image2;
-        cv::Mat mat(4, 1, CV_64FC1);
-		mat.at <double>(0, 0) = mean_pxl;
-		mat.at <double>(1, 0) = mean_pxl;
-		mat.at <double>(2, 0) = mean_pxl;
-		mat.at <double>(3, 0) = 0;
-        croppedFaces[i] = croppedFaces[i] - mat;
-        croppedFaces[i] = croppedFaces[i] / stddev_pxl;
+/**
+ * Returns how many tensors were allocated for network inputs so far. Once every batch bucket was used, this must not
+ * grow from frame to frame anymore.
+ */
+size_t FaceNetClassifier::getTensorAllocations() const {
+    return this->tensorAllocations;
+}
+
+/**
+ * Returns the pooled input tensor of the smallest batch bucket (1, 2, 4, ..., maxBatchSize) that holds nmbrFaces faces.
+ * The tensor is allocated on first use of its bucket and reused afterwards.
+ * @param nmbrFaces number of faces of the current batch, at most maxBatchSize
+ */
+Tensor& FaceNetClassifier::getPooledInputTensor(int nmbrFaces) {
+    ScopedTimer timer(PROFILE_TENSOR);
+    int bucket = 0;
+    while ((1 << bucket) < nmbrFaces)
+        bucket++;
+    if (this->inputTensorPool.size() <= bucket)
+        this->inputTensorPool.resize(bucket + 1);
+    Tensor& pooledTensor = this->inputTensorPool[bucket];
+    if (!pooledTensor.IsInitialized()) {
+        pooledTensor = Tensor(DT_FLOAT, TensorShape({1 << bucket, 160, 160, 3}));
+        this->tensorAllocations++;
     }
+    return pooledTensor;
 }
 
 /**
- * Creates the input tensor for the feed dict for the network.
+ * Creates the input tensor for the feed dict for the network. Every face is standardized (BGR to RGB, zero mean,
+ * unit variance) directly into the memory of a pooled tensor, see standardizeFace, and the input tensor is a slice of
+ * the first nmbrFaces rows of it, so no tensor memory is allocated in steady state.
  * @param croppedFaces currently detected faces cropped from image or frame: Size: [nmbrFaces x 160 x 160 x 3]
+ * @param firstFace index of the first face of this batch in croppedFaces
+ * @param nmbrFaces number of faces of this batch, at most maxBatchSize
  */
-void FaceNetClassifier::createInputTensor(std::vector<cv::Mat> croppedFaces) {
-    int nmbrFaces = croppedFaces.size();
-    Tensor tempTensor(DT_FLOAT, TensorShape({nmbrFaces, 160, 160, 3}));
+void FaceNetClassifier::createInputTensor(const std::vector<cv::Mat>& croppedFaces, int firstFace, int nmbrFaces) {
+    Tensor& pooledTensor = this->getPooledInputTensor(nmbrFaces);
     // get pointer to memory for that Tensor
-    float *p = tempTensor.flat<float>().data();
-    int i;
+    float *p = pooledTensor.flat<float>().data();
 
-    for (i = 0; i < nmbrFaces ; i++) {
-        // create a "fake" cv::Mat from it
-
-        cv::Mat camera_image(160, 160, CV_32FC3, p + i*160*160*3);
-        croppedFaces[i].convertTo(camera_image, CV_32FC3);
+    {
+        ScopedTimer timer(PROFILE_PREPROCESS);
+        for (int i = 0; i < nmbrFaces ; i++) {
+            standardizeFace(croppedFaces[firstFace + i], p + i*160*160*3);
+        }
     }
-//    std::cout << tempTensor.DebugString() << std::endl;
-    this->inputTensor = Tensor(tempTensor);
-    for (i = 0; i < croppedFaces.size(); i++) {
-        croppedFaces[i].release();
+    // slicing along the first dimension shares the buffer of the pooled tensor
+    this->inputTensor = pooledTensor.Slice(0, nmbrFaces);
+//    std::cout << this->inputTensor.DebugString() << std::endl;
+}
+
+/**
+ * Same as above, but the faces are cropped from their frames, resized and standardized into the pooled tensor in one
+ * parallel pass, see cropStandardizeFaces, so no cropped face is ever allocated. With alignment enabled every face is
+ * warped onto the landmark template instead, see FaceAligner::alignStandardizeFaces.
+ * @param frames frame of every face
+ * @param faceRects face rectangles in their frames, may reach over the frame edges
+ * @param firstFace index of the first face of this batch
+ * @param nmbrFaces number of faces of this batch, at most maxBatchSize
+ */
+void FaceNetClassifier::createInputTensor(const std::vector<cv::Mat>& frames, const std::vector<cv::Rect>& faceRects,
+                                          int firstFace, int nmbrFaces) {
+    Tensor& pooledTensor = this->getPooledInputTensor(nmbrFaces);
+    {
+        ScopedTimer timer(PROFILE_PREPROCESS);
+        if (m_aligner)
+            m_aligner->alignStandardizeFaces(frames, faceRects, firstFace, nmbrFaces, 160,
+                                             pooledTensor.flat<float>().data());
+        else
+            cropStandardizeFaces(frames, faceRects, firstFace, nmbrFaces, 160, this->cropInterpolation,
+                                 pooledTensor.flat<float>().data());
     }
+    this->inputTensor = pooledTensor.Slice(0, nmbrFaces);
 }
 
 /**
- * Creates the Phase tensor for the feed dict for the network.
+ * Sets the interpolation of the fused crop. Bilinear is cheaper, bicubic matches the crops of cropFace, which the
+ * gallery was enrolled with.
+ */
+void FaceNetClassifier::setCropInterpolation(CropInterpolation interpolation) {
+    this->cropInterpolation = interpolation;
+}
+
+/**
+ * Creates the Phase tensor for the feed dict for the network. It is constant, so this is only done once in the
+ * constructor.
  */
 void FaceNetClassifier::createPhaseTensor() {
-    Tensor phase_tensor(tensorflow::DT_BOOL, tensorflow::TensorShape());
-    phase_tensor.scalar<bool>()() = false;
-    this->phaseTensor = Tensor (phase_tensor);
+    this->phaseTensor = Tensor(tensorflow::DT_BOOL, tensorflow::TensorShape());
+    this->phaseTensor.scalar<bool>()() = false;
 }
 
 /**
@@ -129,11 +473,18 @@ void FaceNetClassifier::inference(int nmbrFaces) {
     std::vector<tensorflow::Tensor> outputTensor;
     std::vector<std::pair<string, tensorflow::Tensor>> feed_dict = {
             {input_layer, this->inputTensor},
-            {phase_train_layer, this->phaseTensor},
     };
+    // the optimized graph has phase_train bound to false already
+    if (this->feedPhaseTrain)
+        feed_dict.emplace_back(phase_train_layer, this->phaseTensor);
 
     // cout << "Input Tensor: " << inputTensor.DebugString() << endl;
-    Status run_status = this->session->Run(feed_dict, {output_layer}, {} , &outputTensor);
+    Profiler::count(PROFILE_BATCH_SIZE, nmbrFaces);
+    Status run_status;
+    {
+        ScopedTimer timer(PROFILE_SESSION_RUN);
+        run_status = this->session->Run(feed_dict, {output_layer}, {} , &outputTensor);
+    }
     if (!run_status.ok()) {
         LOG(ERROR) << "Running model failed: " << run_status << "\n";
         return;
@@ -141,147 +492,512 @@ void FaceNetClassifier::inference(int nmbrFaces) {
     // cout << "Output: " << outputs[0].DebugString() << endl;
 
     float *p = outputTensor[0].flat<float>().data();
-    cv::Mat output_mat;
-    for (int i = 0; i < nmbrFaces; i++) {
-        cv::Mat matRow(cv::Size(512, 1), CV_32F, p + i * 512);
-        this->outputs.push_back(matRow);
-        matRow.release();
+    // push_back copies the rows, outputTensor and its memory are released when this function returns
+    cv::Mat outputMat(nmbrFaces, 512, CV_32F, p);
+    this->outputs.push_back(outputMat);
+}
+
+/**
+ * Embeds all cropped faces in batches of at most maxBatchSize faces, the embeddings are appended as rows to outputs in
+ * the order of croppedFaces.
+ * @param croppedFaces currently detected faces cropped from image or frame
+ */
+void FaceNetClassifier::embedFaces(const std::vector<cv::Mat>& croppedFaces) {
+    this->warmUp();
+    int nmbrFaces = croppedFaces.size();
+    for (int firstFace = 0; firstFace < nmbrFaces; firstFace += this->maxBatchSize) {
+        int batchSize = std::min(this->maxBatchSize, nmbrFaces - firstFace);
+        this->createInputTensor(croppedFaces, firstFace, batchSize);
+        this->inference(batchSize);
+    }
+}
+
+/**
+ * Same as above for faces that were not cropped yet, see createInputTensor.
+ * @param frames frame of every face
+ * @param faceRects face rectangles in their frames
+ */
+void FaceNetClassifier::embedFaces(const std::vector<cv::Mat>& frames, const std::vector<cv::Rect>& faceRects) {
+    this->warmUp();
+    int nmbrFaces = faceRects.size();
+    for (int firstFace = 0; firstFace < nmbrFaces; firstFace += this->maxBatchSize) {
+        int batchSize = std::min(this->maxBatchSize, nmbrFaces - firstFace);
+        this->createInputTensor(frames, faceRects, firstFace, batchSize);
+        this->inference(batchSize);
     }
 }
 
 /**
  * Computes the Euclidean distance between the currently detected face encodings and all known encodings and classifies
- * using the distance. If there is more than one face encoding below threshold, it will use the one with the smallest
- * euclidean distance.
+ * using the distance. All faces are searched in one batch against the gallery, the nearest known face is taken if its
+ * distance is below threshold. The results stay in classNumbers and distances until the next call.
  */
 void FaceNetClassifier::computeEuclidDistanceAndClassify() {
+    this->classify(this->outputs, this->classNumbers, this->distances);
+}
 
-    for(int i = 0; i < this->outputs.size(); i++) {
-        double minDistance = 100.;
-        double currDistance = 0.;
-        int winner;
-        for (int j = 0; j < this->knownFaces.size(); j++) {
-            cv::Mat tempOutput;
-            this->outputs[i].copyTo(tempOutput);
-            currDistance = cv::norm(tempOutput, this->knownFaces[j].embeddedFace, cv::NORM_L2);
-            // for Debug distances between faces
-            // std::cout << "Distance to " << knownFaces[j].className << " is " << currDistance << std::endl;
-            if (currDistance < minDistance) {
-                minDistance = currDistance;
-                winner = j;
-            }
+/**
+ * Finds the nearest known face for every embedding.
+ * @param embeddings one embedding per row
+ * @param classNumbers class number of the nearest known face per embedding, -1 if its distance is not below threshold
+ * @param distances distance to the nearest known face per embedding
+ */
+void FaceNetClassifier::classify(const cv::Mat& embeddings, std::vector<int>& classNumbers,
+                                 std::vector<float>& distances) {
+    this->identify(embeddings, 1, classNumbers, distances);
+}
+
+/**
+ * Finds the k nearest known faces of every embedding, nothing is printed.
+ * @param embeddings one embedding per row
+ * @param k matches per embedding
+ * @param classNumbers k class numbers per embedding (row i at [i * k, i * k + k)), nearest first, -1 if the distance
+ *                     is not below threshold or the gallery has fewer than k identities
+ * @param distances k distances per embedding, laid out like classNumbers
+ */
+void FaceNetClassifier::identify(const cv::Mat& embeddings, int k, std::vector<int>& classNumbers,
+                                 std::vector<float>& distances) {
+    ScopedTimer timer(PROFILE_MATCH);
+    k = std::max(k, 1);
+    classNumbers.assign(size_t(embeddings.rows) * k, -1);
+    distances.assign(size_t(embeddings.rows) * k, std::numeric_limits<float>::max());
+    if (embeddings.empty())
+        return;
+    // updates of the gallery on other threads do not affect this search, and the matches are local, so identify can be
+    // called from many threads at once
+    std::shared_ptr<const GallerySnapshot> snapshot = this->gallery.snapshot();
+    std::vector<std::vector<GalleryMatch> > matches;
+    snapshot->search(embeddings.ptr<float>(), embeddings.rows, k, matches);
+    for (int i = 0; i < embeddings.rows; i++) {
+        for (int j = 0; j < matches[i].size() && j < k; j++) {
+            distances[i * k + j] = matches[i][j].distance;
+            if (distances[i * k + j] < this->knownPersonThresh)
+                classNumbers[i * k + j] = matches[i][j].index;
         }
-        if (minDistance < this->knownPersonThresh) {
-            std::cout << this->knownFaces[winner].className << std::endl;
+    }
+}
+
+/**
+ * Enables tracking in process: faces are associated across frames and only new or moved faces are embedded, see
+ * FaceTracker. Resets the tracks if tracking was enabled before.
+ */
+void FaceNetClassifier::enableTracking(const TrackerConfig& config) {
+    this->tracker.reset(config.enabled ? new FaceTracker(config) : nullptr);
+    this->processedFrames = 0;
+}
+
+/**
+ * Recognizes all faces of one frame without printing anything: detection, fused crop and standardization, inference
+ * and matching. With tracking enabled, faces whose track has a recent identity skip the network. All buffers are
+ * reused between calls, so after the first frames no memory is allocated unless the number of faces grows.
+ * @param frame BGR frame
+ * @param results faces, identities and embeddings of this frame, overwritten
+ */
+void FaceNetClassifier::process(const cv::Mat& frame, FaceResults& results) {
+    this->detectFaces(frame, this->processRects);
+    this->clipFaces(frame, this->processRects, results.faceRects);
+    int nmbrFaces = results.faceRects.size();
+    Profiler::count(PROFILE_FACES_PER_FRAME, nmbrFaces);
+    if (this->tracker) {
+        this->tracker->update(this->processedFrames, results.faceRects, results.trackIds, results.embedded);
+    }
+    else {
+        results.trackIds.assign(nmbrFaces, -1);
+        results.embedded.assign(nmbrFaces, 1);
+    }
+    this->processedFrames++;
+    int nmbrEmbedded = 0;
+    for (int i = 0; i < nmbrFaces; i++) {
+        if (results.embedded[i])
+            this->processRects[nmbrEmbedded++] = this->processRects[i];
+    }
+    this->processRects.resize(nmbrEmbedded);
+
+    if (nmbrEmbedded > 0) {
+        this->embed(frame, this->processRects, this->processEmbeddings);
+        this->classify(this->processEmbeddings, this->processClassNumbers, this->processDistances);
+    }
+
+    // resize keeps the capacity of earlier frames
+    if (results.embeddings.cols != this->gallery.dim() || results.embeddings.type() != CV_32F)
+        results.embeddings.create(0, this->gallery.dim(), CV_32F);
+    results.embeddings.resize(nmbrFaces);
+    results.classNumbers.assign(nmbrFaces, -1);
+    results.distances.assign(nmbrFaces, std::numeric_limits<float>::max());
+    for (int i = 0, embedded = 0; i < nmbrFaces; i++) {
+        cv::Mat row = results.embeddings.row(i);
+        if (!results.embedded[i]) {
+            row.setTo(0);
+            if (this->tracker)
+                this->tracker->getIdentity(results.trackIds[i], results.classNumbers[i], results.distances[i]);
+            continue;
         }
-        else {
-            std::cout << "New Person?" << std::endl;
+        // a failed inference leaves fewer embeddings than faces, those faces stay unknown
+        if (embedded >= this->processEmbeddings.rows) {
+            row.setTo(0);
+            results.embedded[i] = 0;
+            continue;
         }
+        this->processEmbeddings.row(embedded).copyTo(row);
+        results.classNumbers[i] = this->processClassNumbers[embedded];
+        results.distances[i] = this->processDistances[embedded];
+        if (results.trackIds[i] >= 0)
+            this->tracker->setIdentity(results.trackIds[i], results.classNumbers[i], results.distances[i]);
+        embedded++;
     }
-    std::cout << "\n";
+}
+
+/**
+ * Number of identities ever enrolled, class numbers are below this. Removed identities keep their class number.
+ */
+int FaceNetClassifier::getGallerySize() const {
+    return this->gallery.snapshot()->getIdentityCount();
+}
+
+/**
+ * Name of the identity of a class number. Returned by value, the gallery may change on another thread meanwhile.
+ */
+std::string FaceNetClassifier::getClassName(int classNumber) const {
+    return this->gallery.snapshot()->getIdentityName(classNumber);
+}
+
+/**
+ * The identity gallery, identities and exemplars can be added and removed through it at any time, also while other
+ * threads recognize faces.
+ */
+IdentityGallery& FaceNetClassifier::getGallery() {
+    return this->gallery;
+}
+
+/**
+ * Embeds the cropped faces into embeddings, one row per face. Unlike forward this does not touch the face detector or
+ * the gallery, so detection, embedding and classification can run on different threads.
+ * @param croppedFaces faces cropped from a frame
+ * @param embeddings one embedding per row
+ */
+void FaceNetClassifier::embed(const std::vector<cv::Mat>& croppedFaces, cv::Mat& embeddings) {
+    this->embedFaces(croppedFaces);
+    this->outputs.copyTo(embeddings);
+    this->clearVariables();
+}
+
+/**
+ * Embeds faces straight from their frames, one row per face, see embedFaces. Faces of different frames can share a
+ * batch, as the InferenceEngine does.
+ * @param frames frame of every face
+ * @param faceRects face rectangles in their frames
+ * @param embeddings one embedding per row
+ */
+void FaceNetClassifier::embed(const std::vector<cv::Mat>& frames, const std::vector<cv::Rect>& faceRects,
+                              cv::Mat& embeddings) {
+    this->embedFaces(frames, faceRects);
+    this->outputs.copyTo(embeddings);
+    this->clearVariables();
+}
+
+/**
+ * Embeds all faces of one frame without cropping them first.
+ * @param frame current frame
+ * @param faceRects faces in frame, may reach over its edges
+ * @param embeddings one embedding per row
+ */
+void FaceNetClassifier::embed(const cv::Mat& frame, const std::vector<cv::Rect>& faceRects, cv::Mat& embeddings) {
+    // headers sharing the frame, no pixels are copied
+    this->batchFrames.assign(faceRects.size(), frame);
+    this->embed(this->batchFrames, faceRects, embeddings);
+    this->batchFrames.clear();
+}
+
+/**
+ * Switches the centroid pass of the search over known identities to an approximate HNSW index, worth it for
+ * galleries of roughly 100k identities and more. Identities enrolled afterwards are added to the index.
+ * @param config graph degree and recall / latency parameters of the index
+ */
+void FaceNetClassifier::enableGalleryIndex(const HnswConfig& config) {
+    this->gallery.enableIndex(config);
 }
 
 /**
  * Performs a full foward pass including crop faces, preprocessing (images standardization), preparation of tensors,
- * inference using the tensorflow model, computation of euclidean distance and classification.
+ * inference using the tensorflow model, computation of euclidean distance and classification. Kept for existing
+ * callers, it is process under its old name.
  * @param currentImg an input image or a current frame from a camera.
+ * @param results boxes, class numbers and distances of the faces of currentImg, see process
  */
-void FaceNetClassifier::forward(cv::Mat currentImg) {
-    std::vector<cv::Mat> croppedFaces;
-    cv::cuda::GpuMat d_currentImg;
-    d_currentImg.upload(currentImg);
-    // You can log the times of the CropFace function here
-    //auto start = std::chrono::steady_clock::now();
-    this->getCroppedFacesHaar(currentImg, d_currentImg, croppedFaces, false);
-    //auto end = std::chrono::steady_clock::now();
-    //std::cout << "CropFace took " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() <<
-    //          "ms" << std::endl;
-    if(!croppedFaces.empty()) {
-        int nmbrFaces = croppedFaces.size();
-        this->preprocessInput(croppedFaces);
-        this->createInputTensor(croppedFaces);
-        this->createPhaseTensor();
-        this->inference(nmbrFaces);
-        this->computeEuclidDistanceAndClassify();
-        this->clearVariables();
+void FaceNetClassifier::forward(const cv::Mat& currentImg, FaceResults& results) {
+    this->process(currentImg, results);
+}
+
+/**
+ * Embeds many images with a pipeline: decodeThreads threads read the images, detectThreads threads with one dlib
+ * detector each crop the first face, and this thread collects the crops in image order into batches of maxBatchSize
+ * faces for one session run each. At most maxImagesInFlight images are decoded ahead of the batching, which bounds
+ * the memory for any number of images. Prints progress every progressInterval images.
+ * @param imagePaths images to embed
+ * @param config thread counts and progress interval
+ * @param embeddings one row per image, rows of images without a face are zero
+ * @param faceFound one flag per image
+ */
+void FaceNetClassifier::embedImages(const std::vector<std::string>& imagePaths, const EnrolmentConfig& config,
+                                    cv::Mat& embeddings, std::vector<char>& faceFound) {
+    int nmbrImages = imagePaths.size();
+    embeddings = cv::Mat::zeros(nmbrImages, this->gallery.dim(), CV_32F);
+    faceFound.assign(nmbrImages, 0);
+    if (nmbrImages == 0)
+        return;
+
+    int nmbrDecoders = std::max(1, config.decodeThreads);
+    int nmbrDetectors = config.detectThreads;
+    if (nmbrDetectors <= 0)
+        nmbrDetectors = std::max(1, int(std::thread::hardware_concurrency()) - nmbrDecoders);
+    int maxInFlight = std::max(config.maxImagesInFlight, this->maxBatchSize);
+
+    std::mutex mutex;
+    std::condition_variable decodeSlot, decodedReady, cropReady;
+    int nextToDecode = 0, nextToEmbed = 0, runningDecoders = nmbrDecoders;
+    std::deque<std::pair<int, cv::Mat> > decoded;
+    std::vector<cv::Mat> crops(nmbrImages);
+    std::vector<char> cropDone(nmbrImages, 0);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nmbrDecoders; t++) {
+        threads.emplace_back([&]() {
+            while (true) {
+                std::unique_lock<std::mutex> lock(mutex);
+                decodeSlot.wait(lock, [&]() {
+                    return nextToDecode >= nmbrImages || nextToDecode < nextToEmbed + maxInFlight;
+                });
+                if (nextToDecode >= nmbrImages)
+                    break;
+                int i = nextToDecode++;
+                lock.unlock();
+
+                cv::Mat image = cv::imread(imagePaths[i]);
+                lock.lock();
+                decoded.emplace_back(i, image);
+                decodedReady.notify_one();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            runningDecoders--;
+            decodedReady.notify_all();
+        });
     }
-    else {
-        std::cout << "No person found!" << std::endl;
+    for (int t = 0; t < nmbrDetectors; t++) {
+        threads.emplace_back([&]() {
+            dlib::frontal_face_detector detector = dlib::get_frontal_face_detector();
+            std::vector<cv::Mat> croppedFaces;
+            while (true) {
+                std::unique_lock<std::mutex> lock(mutex);
+                decodedReady.wait(lock, [&]() { return !decoded.empty() || runningDecoders == 0; });
+                if (decoded.empty())
+                    break;
+                std::pair<int, cv::Mat> item = decoded.front();
+                decoded.pop_front();
+                lock.unlock();
+
+                croppedFaces.clear();
+                if (!item.second.empty())
+                    this->getCroppedFaces(item.second, croppedFaces, false, detector);
+                lock.lock();
+                // should be one face when data is captured
+                if (!croppedFaces.empty())
+                    crops[item.first] = croppedFaces[0];
+                cropDone[item.first] = 1;
+                cropReady.notify_all();
+            }
+        });
     }
-    // release all data
-    for (auto face : croppedFaces) face.release();
-    croppedFaces.clear();
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<cv::Mat> batchFaces;
+    std::vector<int> batchImages;
+    for (int i = 0; i < nmbrImages; i++) {
+        cv::Mat crop;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cropReady.wait(lock, [&]() { return cropDone[i] != 0; });
+            crop = crops[i];
+            crops[i].release();
+            nextToEmbed = i + 1;
+            decodeSlot.notify_all();
+        }
+        if (!crop.empty()) {
+            batchFaces.push_back(crop);
+            batchImages.push_back(i);
+        }
+        if (batchFaces.size() == this->maxBatchSize || (i == nmbrImages - 1 && !batchFaces.empty())) {
+            this->embedFaces(batchFaces);
+            if (this->outputs.rows == batchFaces.size()) {
+                for (int j = 0; j < batchImages.size(); j++) {
+                    this->outputs.row(j).copyTo(embeddings.row(batchImages[j]));
+                    faceFound[batchImages[j]] = 1;
+                }
+            }
+            this->clearVariables();
+            batchFaces.clear();
+            batchImages.clear();
+        }
+        if (config.progressInterval > 0 && ((i + 1) % config.progressInterval == 0 || i == nmbrImages - 1)) {
+            double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start).count() / 1000.;
+            std::cout << "Embedded " << i + 1 << "/" << nmbrImages << " images, " <<
+                      (seconds > 0. ? (i + 1) / seconds : 0.) << " images/s" << std::endl;
+        }
+    }
+    for (auto& thread : threads)
+        thread.join();
+}
+
+// file name without extension and without a trailing "_<number>", e.g. anna_2.jpg -> anna
+static std::string identityName(const std::string& fileName) {
+    std::string name = fileName.substr(0, fileName.find_last_of("."));
+    std::size_t separator = name.find_last_of("_");
+    if (separator != std::string::npos && separator > 0 && separator + 1 < name.size() &&
+        name.find_first_not_of("0123456789", separator + 1) == std::string::npos)
+        name.erase(separator);
+    return name;
 }
 
 /**
  * Same as forward. Performs a full foward pass including crop faces, preprocessing (images standardization),
  * preparation of tensors, inference using the tensorflow model, computation of euclidean distance and classification,
  * but here the input is a directory containing images for the classes.
+ * If galleryPath is given, embeddings of images that did not change since the gallery file was written (same mtime and
+ * size, or same content hash) are read from the file instead of running the network, only new or changed images are
+ * embedded and the gallery file is written again if anything changed. The file is ignored if it was computed with
+ * another model.
+ * Images are embedded in batches by embedImages. Faces are added to the gallery in the order of their file paths,
+ * first the ones from the gallery file, then the newly embedded ones. Images of one person share an identity: the
+ * name of an image is its file name without extension and without a trailing "_<number>", so anna.jpg, anna_1.jpg
+ * and anna_2.jpg are three exemplars of the identity anna.
  * @param imagesPath path/to/image/directory - local path to images
+ * @param galleryPath path to the gallery file, empty to always embed all images
+ * @param config threads of the enrolment pipeline
  */
-void FaceNetClassifier::forwardPreprocessing(std::string imagesPath) {
-    std::vector<cv::Mat> croppedFaces;
+void FaceNetClassifier::forwardPreprocessing(std::string imagesPath, std::string galleryPath,
+                                             const EnrolmentConfig& config) {
     std::vector<struct Paths> paths;
-    cv::Mat image;
-
     this->getFilePaths(imagesPath, paths);
-    int classCounter = 0;
-    for (int i = 0; i < paths.size(); i++) {
-        loadInputImage(paths[i].absPath, image);
-        this->getCroppedFaces(image, croppedFaces, false);
-        if(!croppedFaces.empty()) {
-            int nmbrFaces = croppedFaces.size(); // should be one when data is captured
-            this->preprocessInput(croppedFaces);
-            this->createInputTensor(croppedFaces);
-            this->createPhaseTensor();
-            this->inference(nmbrFaces);
-
-            struct KnownID person;
-            std::size_t index = paths[i].fileName.find_last_of(".");
-            std::string rawName = paths[i].fileName.substr(0,index);
-            person.className = rawName;
-            person.classNumber = classCounter;
-            // ToDo optimize copy
-            this->outputs[0].copyTo(person.embeddedFace);
-            this->knownFaces.push_back(person);
-            classCounter++;
+    // readdir order depends on the file system
+    std::sort(paths.begin(), paths.end(), [](const struct Paths& a, const struct Paths& b) {
+        return a.absPath < b.absPath;
+    });
+
+    GalleryFile galleryFile;
+    std::map<std::string, int> cachedEntries;
+    if (!galleryPath.empty() && galleryFile.open(galleryPath)) {
+        if (galleryFile.modelHash() == this->getModelHash() && galleryFile.dim() == this->gallery.dim()) {
+            for (int j = 0; j < galleryFile.count(); j++)
+                cachedEntries[galleryFile.source(j).path] = j;
         }
         else {
-            std::cout << "No face found in this path:" << paths[i].absPath << std::endl;
+            std::cout << "Gallery file " << galleryPath << " belongs to another model, embedding all images" <<
+                      std::endl;
         }
-        for (int j = 0; j < this->outputs.size(); j++) {
-            this->outputs[j].release();
+    }
+
+    int nmbrCached = 0, nmbrEmbedded = 0;
+    int dim = this->gallery.dim();
+    std::vector<std::string> names;
+    std::vector<float> embeddingRows;
+    std::vector<std::string> pendingPaths, pendingNames;
+    std::vector<GallerySource> pendingSources;
+    for (int i = 0; i < paths.size(); i++) {
+        std::string rawName = identityName(paths[i].fileName);
+        GallerySource source;
+        statSource(paths[i].absPath, source, false);
+
+        auto cached = cachedEntries.find(paths[i].absPath);
+        if (cached != cachedEntries.end()) {
+            GallerySource cachedSource = galleryFile.source(cached->second);
+            bool unchanged = cachedSource.mtime == source.mtime && cachedSource.fileSize == source.fileSize;
+            if (!unchanged && cachedSource.fileSize == source.fileSize) {
+                source.contentHash = hashFile(source.path);
+                unchanged = source.contentHash == cachedSource.contentHash;
+            }
+            if (unchanged) {
+                source.contentHash = cachedSource.contentHash;
+                embeddingRows.resize(embeddingRows.size() + dim);
+                galleryFile.readEmbedding(cached->second, embeddingRows.data() + embeddingRows.size() - dim);
+                names.push_back(rawName);
+                this->gallerySources.push_back(source);
+                nmbrCached++;
+                continue;
+            }
         }
-        this->clearVariables();
-        croppedFaces.clear();
+
+        if (!galleryPath.empty() && source.contentHash == 0)
+            source.contentHash = hashFile(source.path);
+        pendingPaths.push_back(paths[i].absPath);
+        pendingNames.push_back(rawName);
+        pendingSources.push_back(source);
     }
 
+    cv::Mat embeddings;
+    std::vector<char> faceFound;
+    this->embedImages(pendingPaths, config, embeddings, faceFound);
+    for (int i = 0; i < pendingPaths.size(); i++) {
+        if (faceFound[i]) {
+            embeddingRows.insert(embeddingRows.end(), embeddings.ptr<float>(i), embeddings.ptr<float>(i) + dim);
+            names.push_back(pendingNames[i]);
+            this->gallerySources.push_back(pendingSources[i]);
+            nmbrEmbedded++;
+        }
+        else {
+            std::cout << "No face found in this path:" << pendingPaths[i] << std::endl;
+        }
+    }
+
+    // one snapshot for the whole directory, the exemplar row is the index into gallerySources
+    this->gallery.addExemplars(names, embeddingRows.data());
+    std::shared_ptr<const GallerySnapshot> snapshot = this->gallery.snapshot();
+    std::cout << "Enrolled " << nmbrCached + nmbrEmbedded << " faces of " << snapshot->countIdentities() <<
+              " identities, " << nmbrCached << " from gallery file" << std::endl;
+    bool galleryChanged = nmbrEmbedded > 0 || !galleryFile.isOpen() || nmbrCached != galleryFile.count();
+    galleryFile.close();
+    if (!galleryPath.empty() && galleryChanged)
+        GalleryFile::write(galleryPath, *snapshot, this->gallerySources, this->getModelHash());
+
     // for DEBUG
     /*
-    for (auto face : this->knownFaces) {
-        std::cout << face.className << "--->Class " << face.classNumber << " and Size = " <<
-            face.embeddedFace.size() << "\n"; // << face.embeddedFace << "\n\n";
-    }
-    for(auto it = knownFaces.begin(); it != knownFaces.end(); ++it) {
-        std::cout << it->className << " = " << it->embeddedFace << "\n\n";
+    for (int j = 0; j < snapshot->getIdentityCount(); j++) {
+        std::cout << snapshot->getIdentityName(j) << "--->Class " << j << " with " <<
+            snapshot->getExemplars(j).size() << " exemplars\n";
     }
     */
 }
 
+/**
+ * Hash of the model file, computed on first use. Gallery files store it to detect embeddings of another model. Aligned
+ * crops give other embeddings than plain crops, and optimized, fp16 and int8 graphs slightly other embeddings than the
+ * model as it is, so alignment, precision and the version of the graph transformations change the hash as well.
+ */
+uint64_t FaceNetClassifier::getModelHash() {
+    if (this->modelHash == 0)
+        this->modelHash = hashFile(this->modelPath);
+    uint64_t hash = this->isAligning() ? this->modelHash ^ 0x9e3779b97f4a7c15ULL : this->modelHash;
+    hash ^= uint64_t(this->sessionConfig.precision) * 0xc2b2ae3d27d4eb4fULL;
+    if (this->graphTransformed)
+        hash ^= uint64_t(GRAPH_OPTIMIZER_VERSION) * 0x165667b19e3779f9ULL;
+    return hash;
+}
+
 /**
  * Clears variables in the end of a forward.
  */
 void FaceNetClassifier::clearVariables() {
-    for(int i = 0; i < outputs.size(); i++) {
-        outputs[i].release();
-    }
-    outputs.clear();
+    outputs.release();
 }
 
 /**
- * Deletes the created TensorFlow session.
+ * Closes and deletes the created TensorFlow session, which frees its thread pools and device memory.
  */
 void FaceNetClassifier::deleteSession() {
-    // ToDo
+    if (!this->session)
+        return;
+    Status status = this->session->Close();
+    if (!status.ok())
+        std::cout << "Could not close the TensorFlow session: " << status.ToString() << std::endl;
+    this->session.reset();
 }
 
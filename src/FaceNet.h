@@ -5,9 +5,18 @@
 #include <fstream>
 #include <string>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "tensorflow/cc/client/client_session.h"
 #include "tensorflow/cc/ops/standard_ops.h"
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/protobuf/config.pb.h"
+#include "tensorflow/core/protobuf/rewriter_config.pb.h"
 #include "tensorflow/core/public/session.h"
 #include <opencv2/opencv.hpp>
 #include <opencv2/ml.hpp>
@@ -15,6 +24,12 @@
 #include <dlib/matrix.h>
 #include <dlib/opencv.h>
 #include "FaceExtractor.h"
+#include "FaceTracker.h"
+#include "ImageStandardizer.h"
+#include "EmbeddingGallery.h"
+#include "IdentityGallery.h"
+#include "GalleryFile.h"
+#include "GraphOptimizer.h"
 
 using namespace tensorflow;
 
@@ -23,33 +38,116 @@ struct Paths {
     std::string fileName;
 };
 
-struct KnownID {
-    std::string className;
-    int classNumber;
-    cv::Mat embeddedFace;
+struct EnrolmentConfig {
+    int decodeThreads = 2;          // threads reading images
+    int detectThreads = 0;          // threads detecting and cropping faces, 0 uses the remaining hardware threads
+    int maxImagesInFlight = 256;    // images decoded ahead of the batching, bounds the memory
+    int progressInterval = 1000;    // print progress every n images, 0 disables it
+};
+
+struct SessionConfig {
+    int intraOpThreads = 0;         // threads inside one op (convolutions, matmuls), 0 lets TensorFlow choose
+    int interOpThreads = 0;         // independent ops running in parallel, 0 lets TensorFlow choose
+    std::vector<int> cpuAffinity;   // cores the session threads are pinned to (Linux only), empty keeps the default
+    bool optimizeGraph = true;      // common subexpression elimination, constant folding and function inlining
+    bool rewriteGraph = true;       // grappler rewrites: arithmetic, layout, remapping (fused conv + bias + relu)
+    bool enableXla = false;         // JIT compilation of the graph, only if TensorFlow was built with XLA
+    bool useOptimizedGraph = true;  // load <model>.optimized.pb, written by optimizeGraph if missing or outdated
+    // keep float32 for speed; fp16 only shrinks the cached <model>.fp16.pb, int8 (<model>.int8.pb) is experimental and
+    // usually slower than float32 on the CPU, see ModelPrecision
+    ModelPrecision precision = PRECISION_FLOAT32;
+    std::string calibrationImagesPath;  // images with one face each for the int8 calibration, e.g. enrolment images
+    int calibrationImages = 64;         // evenly spaced sample of calibrationImagesPath
+    int warmUpIterations = 1;       // session runs per batch bucket before the first embedding, 0 disables the warm-up
+    bool cpuOnly = false;           // hide all GPUs from the session, e.g. for reproducible results
+};
+
+// results of FaceNetClassifier::process, reuse one instance for all frames so that its buffers are not reallocated
+struct FaceResults {
+    std::vector<cv::Rect> faceRects;    // clipped to the frame
+    std::vector<int> trackIds;          // -1 without tracking
+    std::vector<int> classNumbers;      // -1 for unknown faces, see getClassName
+    std::vector<float> distances;       // to the nearest known face
+    std::vector<char> embedded;         // 0 if the identity was taken from the track instead of the network
+    cv::Mat embeddings;                 // one row per face, zero for faces that were not embedded
 };
 
 class FaceNetClassifier : public FaceExtractor {
 private:
-    Session* session;
+    std::unique_ptr<Session> session;
     GraphDef graphDef;
-    std::vector<struct KnownID> knownFaces;
+    std::string modelPath;
+    SessionConfig sessionConfig;
+    bool feedPhaseTrain = true;     // false once phase_train was bound to a constant by the graph optimizer
+    bool graphTransformed = false;  // an optimized, fp16 or int8 graph was loaded instead of the model as it is
+    uint64_t modelHash = 0;
+    IdentityGallery gallery;
+    std::vector<GallerySource> gallerySources;  // enrolment image of every exemplar row of the gallery
+    std::vector<int> classNumbers;
+    std::vector<float> distances;
     Tensor inputTensor, phaseTensor;
-    std::vector<cv::Mat> outputs;
+    std::vector<Tensor> inputTensorPool;    // one tensor per batch bucket 1, 2, 4, ..., maxBatchSize, allocated lazily
+    int maxBatchSize = 8;
+    int warmedUpBatchSize = 0;      // largest batch bucket the warm-up ran, the smaller ones are warm as well
+    CropInterpolation cropInterpolation = CROP_CUBIC;
+    std::vector<cv::Mat> batchFrames;   // frame of every face for the fused crop, headers only
+    size_t tensorAllocations = 0;
+    cv::Mat outputs;    // one 512 float embedding per row
     float knownPersonThresh;
+    std::unique_ptr<FaceTracker> tracker;   // only used by process, null without tracking
+    long processedFrames = 0;
+    std::vector<cv::Rect> processRects;     // faces of the current frame that go through the network
+    cv::Mat processEmbeddings;
+    std::vector<int> processClassNumbers;
+    std::vector<float> processDistances;
 public:
     FaceNetClassifier(std::string modelPath, float knownPersonThreshold);
+    FaceNetClassifier(std::string modelPath, float knownPersonThreshold, const DetectorConfig& detectorConfig);
+    FaceNetClassifier(std::string modelPath, float knownPersonThreshold, const DetectorConfig& detectorConfig,
+                      const SessionConfig& sessionConfig);
+    ~FaceNetClassifier();
+    FaceNetClassifier(const FaceNetClassifier&) = delete;
+    FaceNetClassifier& operator=(const FaceNetClassifier&) = delete;
     void checkStatus(Status status);
+    void getSessionOptions(SessionOptions& options) const;
+    void createSession();
+    std::string getModelVariantPath(const std::string& variant) const;
+    void loadGraph();
+    Status transformGraph(GraphDef& transformed);
+    Status calibrate(const GraphDef& floatGraph, std::map<std::string, ActivationRange>& inputRanges);
+    void warmUp();
     void getFilePaths(std::string imagesPath, std::vector<struct Paths>& paths);
     void loadInputImage(std::string inputFilePath, cv::Mat& image);
-    void preprocessInput(std::vector<cv::Mat>& croppedFaces);
-    void createInputTensor(std::vector<cv::Mat> croppedFaces);
+    void setMaxBatchSize(int batchSize);
+    size_t getTensorAllocations() const;
+    Tensor& getPooledInputTensor(int nmbrFaces);
+    void createInputTensor(const std::vector<cv::Mat>& croppedFaces, int firstFace, int nmbrFaces);
+    void createInputTensor(const std::vector<cv::Mat>& frames, const std::vector<cv::Rect>& faceRects, int firstFace,
+                           int nmbrFaces);
+    void setCropInterpolation(CropInterpolation interpolation);
     void createPhaseTensor();
     void inference(int nmbrFaces);
+    void embedFaces(const std::vector<cv::Mat>& croppedFaces);
+    void embedFaces(const std::vector<cv::Mat>& frames, const std::vector<cv::Rect>& faceRects);
     void computeEuclidDistanceAndClassify();
+    void classify(const cv::Mat& embeddings, std::vector<int>& classNumbers, std::vector<float>& distances);
+    void identify(const cv::Mat& embeddings, int k, std::vector<int>& classNumbers, std::vector<float>& distances);
+    void enableTracking(const TrackerConfig& config);
+    void process(const cv::Mat& frame, FaceResults& results);
+    int getGallerySize() const;
+    std::string getClassName(int classNumber) const;
+    IdentityGallery& getGallery();
+    void embed(const std::vector<cv::Mat>& croppedFaces, cv::Mat& embeddings);
+    void embed(const std::vector<cv::Mat>& frames, const std::vector<cv::Rect>& faceRects, cv::Mat& embeddings);
+    void embed(const cv::Mat& frame, const std::vector<cv::Rect>& faceRects, cv::Mat& embeddings);
+    void enableGalleryIndex(const HnswConfig& config);
     void clearVariables();
-    void forward(cv::Mat currentImg);
-    void forwardPreprocessing(std::string imagesPath);
+    void forward(const cv::Mat& currentImg, FaceResults& results);
+    void embedImages(const std::vector<std::string>& imagePaths, const EnrolmentConfig& config, cv::Mat& embeddings,
+                     std::vector<char>& faceFound);
+    void forwardPreprocessing(std::string imagesPath, std::string galleryPath = "",
+                              const EnrolmentConfig& config = EnrolmentConfig());
+    uint64_t getModelHash();
     void deleteSession();
 };
 
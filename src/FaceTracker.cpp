@@ -0,0 +1,141 @@
+#include "FaceTracker.h"
+#include <algorithm>
+
+static float intersectionOverUnion(const cv::Rect2f& a, const cv::Rect2f& b) {
+    float intersection = (a & b).area();
+    float unionArea = a.area() + b.area() - intersection;
+    return unionArea > 0.f ? intersection / unionArea : 0.f;
+}
+
+// weight of the newest displacement in the velocity estimate
+static const float VELOCITY_SMOOTHING = 0.5f;
+
+FaceTracker::FaceTracker(const TrackerConfig& config) {
+    m_config = config;
+}
+
+FaceTracker::Track* FaceTracker::findTrack(int trackId) {
+    for (auto& track : m_tracks) {
+        if (track.id == trackId)
+            return &track;
+    }
+    return nullptr;
+}
+
+/**
+ * Assigns every detection of a frame to a track, greedily by descending IoU with the predicted track boxes.
+ * Unassigned detections start new tracks, tracks without detection for more than maxMissedFrames frames are deleted.
+ * @param frameNumber increasing number of the frame
+ * @param faceRects detected faces
+ * @param trackIds track of every face
+ * @param needsEmbedding per face, true if it has to be embedded, false if the cached identity of its track is used
+ */
+void FaceTracker::update(long frameNumber, const std::vector<cv::Rect>& faceRects, std::vector<int>& trackIds,
+                         std::vector<char>& needsEmbedding) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int nmbrFaces = faceRects.size();
+    trackIds.assign(nmbrFaces, -1);
+    needsEmbedding.assign(nmbrFaces, 1);
+
+    std::vector<cv::Rect2f> predicted(m_tracks.size());
+    for (size_t t = 0; t < m_tracks.size(); t++) {
+        predicted[t] = m_tracks[t].box;
+        predicted[t].x += m_tracks[t].velocity.x * (m_tracks[t].missedFrames + 1);
+        predicted[t].y += m_tracks[t].velocity.y * (m_tracks[t].missedFrames + 1);
+    }
+    struct Pair {
+        float iou;
+        int track;
+        int face;
+    };
+    std::vector<Pair> pairs;
+    for (size_t t = 0; t < m_tracks.size(); t++) {
+        for (int f = 0; f < nmbrFaces; f++) {
+            float iou = intersectionOverUnion(predicted[t], cv::Rect2f(faceRects[f]));
+            if (iou >= m_config.associationIou)
+                pairs.push_back({iou, int(t), f});
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const Pair& a, const Pair& b) { return a.iou > b.iou; });
+
+    std::vector<char> trackMatched(m_tracks.size(), 0);
+    for (const Pair& pair : pairs) {
+        if (trackMatched[pair.track] || trackIds[pair.face] >= 0)
+            continue;
+        trackMatched[pair.track] = 1;
+        Track& track = m_tracks[pair.track];
+        cv::Rect2f box(faceRects[pair.face]);
+        cv::Point2f displacement = (box.tl() - track.box.tl()) * (1.f / (track.missedFrames + 1));
+        track.velocity = VELOCITY_SMOOTHING * displacement + (1.f - VELOCITY_SMOOTHING) * track.velocity;
+        track.box = box;
+        track.missedFrames = 0;
+        trackIds[pair.face] = track.id;
+
+        long sinceRequest = frameNumber - track.embedRequestFrame;
+        bool moved = intersectionOverUnion(box, track.embeddedBox) < m_config.reembedIou;
+        bool expired = sinceRequest >= m_config.refreshInterval;
+        bool pendingLost = !track.hasIdentity && sinceRequest >= m_config.pendingTimeout;
+        needsEmbedding[pair.face] = moved || expired || pendingLost;
+    }
+
+    for (size_t t = m_tracks.size(); t-- > 0;) {
+        if (!trackMatched[t] && ++m_tracks[t].missedFrames > m_config.maxMissedFrames)
+            m_tracks.erase(m_tracks.begin() + t);
+    }
+    for (int f = 0; f < nmbrFaces; f++) {
+        if (trackIds[f] < 0) {
+            Track track;
+            track.id = m_nextId++;
+            track.box = cv::Rect2f(faceRects[f]);
+            m_tracks.push_back(track);
+            trackIds[f] = track.id;
+        }
+        if (needsEmbedding[f]) {
+            Track* track = this->findTrack(trackIds[f]);
+            track->embeddedBox = track->box;
+            track->embedRequestFrame = frameNumber;
+        }
+    }
+    m_faces += nmbrFaces;
+    m_cacheHits += std::count(needsEmbedding.begin(), needsEmbedding.end(), 0);
+}
+
+/**
+ * Stores the identity computed for the newest embedding of a track.
+ */
+void FaceTracker::setIdentity(int trackId, int classNumber, float distance) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Track* track = this->findTrack(trackId);
+    if (!track)
+        return;
+    track->hasIdentity = true;
+    track->classNumber = classNumber;
+    track->distance = distance;
+}
+
+/**
+ * Cached identity of a track.
+ * @return false if the track is gone or its first embedding was not matched yet
+ */
+bool FaceTracker::getIdentity(int trackId, int& classNumber, float& distance) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Track* track = this->findTrack(trackId);
+    if (!track || !track->hasIdentity)
+        return false;
+    classNumber = track->classNumber;
+    distance = track->distance;
+    return true;
+}
+
+/**
+ * Fraction of faces that used a cached identity instead of running the network.
+ */
+double FaceTracker::getCacheHitRate() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_faces > 0 ? double(m_cacheHits) / m_faces : 0.;
+}
+
+long FaceTracker::getFaces() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_faces;
+}
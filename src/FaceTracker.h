@@ -0,0 +1,54 @@
+#ifndef FACE_RECOGNITION_FACETRACKER_H
+#define FACE_RECOGNITION_FACETRACKER_H
+
+#include <mutex>
+#include <vector>
+#include <opencv2/core.hpp>
+
+struct TrackerConfig {
+    bool enabled = true;
+    float associationIou = 0.3f;    // minimum IoU between predicted track box and detection to continue a track
+    float reembedIou = 0.6f;        // embed again if the IoU to the box of the last embedding drops below this
+    int refreshInterval = 30;       // embed again after this many frames even if the box did not move
+    int pendingTimeout = 5;         // embed again if a requested embedding did not arrive after this many frames
+    int maxMissedFrames = 5;        // frames a track survives without detection
+};
+
+/**
+ * Associates face detections across frames by IoU with the constant velocity prediction of every track and caches
+ * the identity of each track. update decides which faces have to go through the network: new tracks, tracks whose box
+ * moved or changed size since their last embedding, and tracks whose refresh interval expired. All other faces take
+ * the cached identity. Thread-safe, so detection and matching may run on different threads.
+ */
+class FaceTracker {
+private:
+    struct Track {
+        int id;
+        cv::Rect2f box;
+        cv::Point2f velocity;
+        int missedFrames = 0;
+        cv::Rect2f embeddedBox;         // box when the last embedding was requested
+        long embedRequestFrame = -1;
+        bool hasIdentity = false;
+        int classNumber = -1;
+        float distance = 0.f;
+    };
+    TrackerConfig m_config;
+    std::vector<Track> m_tracks;
+    int m_nextId = 0;
+    long m_faces = 0;
+    long m_cacheHits = 0;
+    mutable std::mutex m_mutex;
+    Track* findTrack(int trackId);
+public:
+    explicit FaceTracker(const TrackerConfig& config = TrackerConfig());
+    void update(long frameNumber, const std::vector<cv::Rect>& faceRects, std::vector<int>& trackIds,
+                std::vector<char>& needsEmbedding);
+    void setIdentity(int trackId, int classNumber, float distance);
+    bool getIdentity(int trackId, int& classNumber, float& distance);
+    double getCacheHitRate() const;
+    long getFaces() const;
+};
+
+
+#endif //FACE_RECOGNITION_FACETRACKER_H
@@ -0,0 +1,283 @@
+#include "GalleryFile.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char GALLERY_MAGIC[8] = {'F', 'N', 'G', 'A', 'L', 'L', 'R', 'Y'};
+
+static uint64_t alignOffset(uint64_t offset) {
+    return (offset + 63) & ~uint64_t(63);
+}
+
+uint64_t hashFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return 0;
+    uint64_t hash = 14695981039346656037ull;
+    char buffer[1 << 16];
+    while (file) {
+        file.read(buffer, sizeof(buffer));
+        std::streamsize n = file.gcount();
+        for (std::streamsize i = 0; i < n; i++) {
+            hash ^= uint64_t(static_cast<unsigned char>(buffer[i]));
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+bool statSource(const std::string& path, GallerySource& source, bool withHash) {
+    struct stat fileStat;
+    if (stat(path.c_str(), &fileStat) != 0)
+        return false;
+    source.path = path;
+    source.mtime = int64_t(fileStat.st_mtime);
+    source.fileSize = uint64_t(fileStat.st_size);
+    source.contentHash = withHash ? hashFile(path) : 0;
+    return true;
+}
+
+GalleryFile::~GalleryFile() {
+    this->close();
+}
+
+/**
+ * Maps a gallery file into memory and checks its header.
+ * @param path gallery file
+ * @return false if the file does not exist, is not a gallery file, has another version or is truncated
+ */
+bool GalleryFile::open(const std::string& path) {
+    this->close();
+    m_fd = ::open(path.c_str(), O_RDONLY);
+    if (m_fd < 0)
+        return false;
+    struct stat fileStat;
+    if (fstat(m_fd, &fileStat) != 0 || size_t(fileStat.st_size) < sizeof(GalleryFileHeader)) {
+        this->close();
+        return false;
+    }
+    m_size = size_t(fileStat.st_size);
+    void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED) {
+        m_size = 0;
+        this->close();
+        return false;
+    }
+    m_data = static_cast<const unsigned char*>(data);
+    m_header = reinterpret_cast<const GalleryFileHeader*>(m_data);
+
+    if (std::memcmp(m_header->magic, GALLERY_MAGIC, sizeof(GALLERY_MAGIC)) != 0 || m_header->version != VERSION ||
+        m_header->fileSize != m_size || m_header->storage > GALLERY_INT8 ||
+        m_header->embeddingOffset + uint64_t(m_header->count) * m_header->dim *
+                (m_header->storage == GALLERY_FLOAT32 ? 4 : m_header->storage == GALLERY_FLOAT16 ? 2 : 1) > m_size ||
+        m_header->scaleOffset + (m_header->storage == GALLERY_INT8 ? m_header->count * sizeof(float) : 0) > m_size ||
+        m_header->entryOffset + uint64_t(m_header->count) * sizeof(GalleryFileEntry) > m_size ||
+        m_header->stringOffset + m_header->stringSize > m_size) {
+        std::cerr << "Invalid gallery file " << path << std::endl;
+        this->close();
+        return false;
+    }
+    return true;
+}
+
+void GalleryFile::close() {
+    if (m_data)
+        munmap(const_cast<unsigned char*>(m_data), m_size);
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+    m_data = nullptr;
+    m_size = 0;
+    m_header = nullptr;
+}
+
+bool GalleryFile::isOpen() const {
+    return m_header != nullptr;
+}
+
+uint64_t GalleryFile::modelHash() const {
+    return m_header->modelHash;
+}
+
+int GalleryFile::dim() const {
+    return int(m_header->dim);
+}
+
+int GalleryFile::count() const {
+    return int(m_header->count);
+}
+
+GalleryStorage GalleryFile::storage() const {
+    return GalleryStorage(m_header->storage);
+}
+
+std::string GalleryFile::readString(uint64_t offset, uint32_t length) const {
+    if (offset + length > m_header->stringSize)
+        return std::string();
+    return std::string(reinterpret_cast<const char*>(m_data + m_header->stringOffset + offset), length);
+}
+
+std::string GalleryFile::className(int index) const {
+    const GalleryFileEntry* entries = reinterpret_cast<const GalleryFileEntry*>(m_data + m_header->entryOffset);
+    return this->readString(entries[index].classNameOffset, entries[index].classNameLength);
+}
+
+GallerySource GalleryFile::source(int index) const {
+    const GalleryFileEntry& entry = reinterpret_cast<const GalleryFileEntry*>(m_data + m_header->entryOffset)[index];
+    GallerySource source;
+    source.path = this->readString(entry.sourcePathOffset, entry.sourcePathLength);
+    source.mtime = entry.mtime;
+    source.fileSize = entry.fileSize;
+    source.contentHash = entry.contentHash;
+    return source;
+}
+
+/**
+ * Reads one embedding as float, fp16 and int8 embeddings are converted back.
+ * @param index embedding number
+ * @param embedding dim floats
+ */
+void GalleryFile::readEmbedding(int index, float* embedding) const {
+    size_t dim = m_header->dim;
+    const unsigned char* block = m_data + m_header->embeddingOffset;
+    switch (this->storage()) {
+        case GALLERY_FLOAT16: {
+            const uint16_t* halfs = reinterpret_cast<const uint16_t*>(block) + index * dim;
+            for (size_t j = 0; j < dim; j++)
+                embedding[j] = halfToFloat(halfs[j]);
+            break;
+        }
+        case GALLERY_INT8: {
+            const int8_t* values = reinterpret_cast<const int8_t*>(block) + index * dim;
+            float scale = reinterpret_cast<const float*>(m_data + m_header->scaleOffset)[index];
+            for (size_t j = 0; j < dim; j++)
+                embedding[j] = values[j] * scale;
+            break;
+        }
+        case GALLERY_FLOAT32:
+        default:
+            std::memcpy(embedding, reinterpret_cast<const float*>(block) + index * dim, dim * sizeof(float));
+    }
+}
+
+/**
+ * Writes all embeddings of a gallery that were not removed. The file is written next to path and renamed, so a
+ * running reader never sees a partial file.
+ * @param path gallery file
+ * @param gallery embeddings and class names
+ * @param sources enrolment image of every gallery row
+ * @param modelHash hashFile of the model the embeddings were computed with
+ * @param storage value type of the embedding block
+ * @return false if the file could not be written
+ */
+template <typename Gallery>
+static bool writeGallery(const std::string& path, const Gallery& gallery, const std::vector<GallerySource>& sources,
+                         uint64_t modelHash, GalleryStorage storage) {
+    std::vector<int> rows;
+    for (int i = 0; i < gallery.size(); i++) {
+        if (!gallery.isRemoved(i))
+            rows.push_back(i);
+    }
+    uint64_t count = rows.size();
+    uint64_t dim = gallery.dim();
+    size_t valueSize = storage == GALLERY_FLOAT32 ? 4 : storage == GALLERY_FLOAT16 ? 2 : 1;
+
+    std::string strings;
+    std::vector<GalleryFileEntry> entries(count);
+    for (size_t i = 0; i < count; i++) {
+        GallerySource source = rows[i] < int(sources.size()) ? sources[rows[i]] : GallerySource();
+        const std::string& className = gallery.getClassName(rows[i]);
+        entries[i].classNameOffset = strings.size();
+        entries[i].classNameLength = uint32_t(className.size());
+        strings += className;
+        entries[i].sourcePathOffset = strings.size();
+        entries[i].sourcePathLength = uint32_t(source.path.size());
+        strings += source.path;
+        entries[i].mtime = source.mtime;
+        entries[i].fileSize = source.fileSize;
+        entries[i].contentHash = source.contentHash;
+    }
+
+    GalleryFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, GALLERY_MAGIC, sizeof(GALLERY_MAGIC));
+    header.version = GalleryFile::VERSION;
+    header.storage = storage;
+    header.modelHash = modelHash;
+    header.dim = uint32_t(dim);
+    header.count = uint32_t(count);
+    header.embeddingOffset = alignOffset(sizeof(header));
+    uint64_t end = header.embeddingOffset + count * dim * valueSize;
+    if (storage == GALLERY_INT8) {
+        header.scaleOffset = alignOffset(end);
+        end = header.scaleOffset + count * sizeof(float);
+    }
+    header.entryOffset = alignOffset(end);
+    header.stringOffset = header.entryOffset + count * sizeof(GalleryFileEntry);
+    header.stringSize = strings.size();
+    header.fileSize = header.stringOffset + header.stringSize;
+
+    std::vector<unsigned char> block(count * dim * valueSize);
+    std::vector<float> scales(storage == GALLERY_INT8 ? count : 0);
+    std::vector<float> embedding(dim);
+    for (size_t i = 0; i < count; i++) {
+        gallery.readEmbedding(rows[i], embedding.data());
+        if (storage == GALLERY_FLOAT32) {
+            std::memcpy(&block[i * dim * valueSize], embedding.data(), dim * sizeof(float));
+        }
+        else if (storage == GALLERY_FLOAT16) {
+            uint16_t* halfs = reinterpret_cast<uint16_t*>(&block[i * dim * valueSize]);
+            for (size_t j = 0; j < dim; j++)
+                halfs[j] = floatToHalf(embedding[j]);
+        }
+        else {
+            scales[i] = quantizeInt8(embedding.data(), int(dim), reinterpret_cast<int8_t*>(&block[i * dim]));
+        }
+    }
+
+    std::string tempPath = path + ".tmp";
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "Unable to write gallery file " << tempPath << std::endl;
+        return false;
+    }
+    auto writeAt = [&file](uint64_t offset, const void* data, size_t size) {
+        std::vector<char> padding(offset - uint64_t(file.tellp()), 0);
+        file.write(padding.data(), padding.size());
+        file.write(static_cast<const char*>(data), size);
+    };
+    writeAt(0, &header, sizeof(header));
+    writeAt(header.embeddingOffset, block.data(), block.size());
+    if (storage == GALLERY_INT8)
+        writeAt(header.scaleOffset, scales.data(), scales.size() * sizeof(float));
+    writeAt(header.entryOffset, entries.data(), entries.size() * sizeof(GalleryFileEntry));
+    writeAt(header.stringOffset, strings.data(), strings.size());
+    file.close();
+    if (!file || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::cerr << "Unable to write gallery file " << path << std::endl;
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool GalleryFile::write(const std::string& path, const EmbeddingGallery& gallery,
+                        const std::vector<GallerySource>& sources, uint64_t modelHash, GalleryStorage storage) {
+    return writeGallery(path, gallery, sources, modelHash, storage);
+}
+
+/**
+ * Writes all exemplars of an identity gallery that were not removed, one entry per exemplar with the name of its
+ * identity, so reading the file back and adding the entries in order restores the identities.
+ */
+bool GalleryFile::write(const std::string& path, const GallerySnapshot& gallery,
+                        const std::vector<GallerySource>& sources, uint64_t modelHash, GalleryStorage storage) {
+    return writeGallery(path, gallery, sources, modelHash, storage);
+}
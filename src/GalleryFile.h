@@ -0,0 +1,85 @@
+#ifndef FACE_RECOGNITION_GALLERYFILE_H
+#define FACE_RECOGNITION_GALLERYFILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "EmbeddingGallery.h"
+#include "IdentityGallery.h"
+
+// enrolment image an embedding was computed from, used to find new or changed images
+struct GallerySource {
+    std::string path;
+    int64_t mtime = 0;
+    uint64_t fileSize = 0;
+    uint64_t contentHash = 0;
+};
+
+struct GalleryFileHeader {
+    char magic[8];              // "FNGALLRY"
+    uint32_t version;
+    uint32_t storage;           // GalleryStorage
+    uint64_t modelHash;         // hashFile of the model the embeddings were computed with
+    uint32_t dim;
+    uint32_t count;
+    uint64_t embeddingOffset;   // count x dim values of the storage type, 64 byte aligned
+    uint64_t scaleOffset;       // count floats for GALLERY_INT8, 0 otherwise
+    uint64_t entryOffset;       // count GalleryFileEntry
+    uint64_t stringOffset;      // class names and source paths, not null terminated
+    uint64_t stringSize;
+    uint64_t fileSize;
+};
+
+struct GalleryFileEntry {
+    uint64_t classNameOffset;   // relative to stringOffset
+    uint64_t sourcePathOffset;
+    uint32_t classNameLength;
+    uint32_t sourcePathLength;
+    int64_t mtime;
+    uint64_t fileSize;
+    uint64_t contentHash;
+};
+
+// FNV-1a hash over the content of a file, 0 if it cannot be read
+uint64_t hashFile(const std::string& path);
+// fills mtime, size and (if withHash) the content hash of path, returns false if the file does not exist
+bool statSource(const std::string& path, GallerySource& source, bool withHash);
+
+/**
+ * Versioned binary file of an embedding gallery: header, one contiguous embedding block (float32, fp16 or int8 with a
+ * per-embedding scale), one entry per embedding with its enrolment image and a string table. The file is memory mapped
+ * on open, so opening is independent of the gallery size and embeddings are only touched when they are read.
+ */
+class GalleryFile {
+private:
+    int m_fd = -1;
+    const unsigned char* m_data = nullptr;
+    size_t m_size = 0;
+    const GalleryFileHeader* m_header = nullptr;
+    std::string readString(uint64_t offset, uint32_t length) const;
+public:
+    static const uint32_t VERSION = 1;
+    GalleryFile() {}
+    ~GalleryFile();
+    GalleryFile(const GalleryFile&) = delete;
+    GalleryFile& operator=(const GalleryFile&) = delete;
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const;
+    uint64_t modelHash() const;
+    int dim() const;
+    int count() const;
+    GalleryStorage storage() const;
+    std::string className(int index) const;
+    GallerySource source(int index) const;
+    void readEmbedding(int index, float* embedding) const;
+    static bool write(const std::string& path, const EmbeddingGallery& gallery,
+                      const std::vector<GallerySource>& sources, uint64_t modelHash,
+                      GalleryStorage storage = GALLERY_FLOAT32);
+    static bool write(const std::string& path, const GallerySnapshot& gallery,
+                      const std::vector<GallerySource>& sources, uint64_t modelHash,
+                      GalleryStorage storage = GALLERY_FLOAT32);
+};
+
+
+#endif //FACE_RECOGNITION_GALLERYFILE_H
@@ -0,0 +1,226 @@
+#include "GatedFaceDetector.h"
+#include <algorithm>
+#include <cmath>
+
+static double overlap(const cv::Rect& a, const cv::Rect& b) {
+    double intersection = (a & b).area();
+    double unionArea = a.area() + b.area() - intersection;
+    return unionArea > 0 ? intersection / unionArea : 0.;
+}
+
+static double microsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @param config motion threshold, regions of interest and scan intervals
+ * @param detector ungated detector doing the actual detection, on views of the frame
+ * @param minFaceSize smallest face of the detector, regions are never searched smaller than twice this size
+ */
+GatedFaceDetector::GatedFaceDetector(const DetectionGateConfig& config, const cv::Ptr<FaceDetector>& detector,
+                                     int minFaceSize)
+        : m_detector(detector), m_config(config), m_minFaceSize(std::max(minFaceSize, 20)) {
+}
+
+/**
+ * Starts over for a new frame size: regions of interest are clipped and scaled again and the next frame is scanned in
+ * full.
+ */
+void GatedFaceDetector::resetFrameSize(const cv::Size& frameSize) {
+    cv::Rect frameRect(cv::Point(0, 0), frameSize);
+    m_frameSize = frameSize;
+    m_motionScale = std::min(1., double(m_config.motionWidth) / frameSize.width);
+    m_rois.clear();
+    for (const cv::Rect& roi : m_config.rois) {
+        cv::Rect clipped = roi & frameRect;
+        if (!clipped.empty())
+            m_rois.push_back(clipped);
+    }
+    if (m_rois.empty())
+        m_rois.push_back(frameRect);
+
+    cv::Size smallSize(cvRound(frameSize.width * m_motionScale), cvRound(frameSize.height * m_motionScale));
+    m_roiMask = cv::Mat::zeros(smallSize, CV_8U);
+    for (const cv::Rect& roi : m_rois) {
+        cv::Rect smallRoi(cvFloor(roi.x * m_motionScale), cvFloor(roi.y * m_motionScale),
+                          cvCeil(roi.width * m_motionScale), cvCeil(roi.height * m_motionScale));
+        m_roiMask(smallRoi & cv::Rect(cv::Point(0, 0), smallSize)).setTo(255);
+    }
+    m_previousGray.release();
+    m_faces.clear();
+    m_framesSinceFullScan = 0;
+}
+
+/**
+ * Compares the frame with the previous one inside the regions of interest.
+ * @param regions bounding boxes of the changed areas in frame coordinates, if there was motion
+ * @return true if enough pixels changed, or if there is no previous frame to compare with
+ */
+bool GatedFaceDetector::findMotion(const cv::Mat& frame, std::vector<cv::Rect>& regions) {
+    if (m_motionScale < 1.)
+        cv::resize(frame, m_smallFrame, m_roiMask.size(), 0, 0, cv::INTER_AREA);
+    else
+        m_smallFrame = frame;
+    if (m_smallFrame.channels() == 3)
+        cv::cvtColor(m_smallFrame, m_smallGray, cv::COLOR_BGR2GRAY);
+    else
+        m_smallFrame.copyTo(m_smallGray);
+    bool first = m_previousGray.empty();
+    if (!first) {
+        cv::absdiff(m_smallGray, m_previousGray, m_difference);
+        cv::threshold(m_difference, m_difference, m_config.motionThreshold, 255, cv::THRESH_BINARY);
+        cv::bitwise_and(m_difference, m_roiMask, m_difference);
+    }
+    std::swap(m_smallGray, m_previousGray);
+    if (first)
+        return true;
+    double roiPixels = cv::countNonZero(m_roiMask);
+    if (cv::countNonZero(m_difference) < std::max(1., m_config.minMotionFraction * roiPixels))
+        return false;
+
+    // neighbouring changed pixels of one moving person become one region
+    cv::dilate(m_difference, m_difference, cv::Mat(), cv::Point(-1, -1), 2);
+    std::vector<std::vector<cv::Point> > contours;
+    cv::findContours(m_difference, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+    for (const auto& contour : contours) {
+        cv::Rect box = cv::boundingRect(contour);
+        regions.emplace_back(cvFloor(box.x / m_motionScale), cvFloor(box.y / m_motionScale),
+                             cvCeil(box.width / m_motionScale), cvCeil(box.height / m_motionScale));
+    }
+    return true;
+}
+
+/**
+ * Grows rect by margin times its larger side on every side, and to at least twice the smallest face.
+ */
+cv::Rect GatedFaceDetector::expand(const cv::Rect& rect, double margin) const {
+    int grow = cvRound(std::max(rect.width, rect.height) * margin);
+    cv::Rect expanded(rect.x - grow, rect.y - grow, rect.width + 2 * grow, rect.height + 2 * grow);
+    int minSide = 2 * m_minFaceSize;
+    if (expanded.width < minSide) {
+        expanded.x -= (minSide - expanded.width) / 2;
+        expanded.width = minSide;
+    }
+    if (expanded.height < minSide) {
+        expanded.y -= (minSide - expanded.height) / 2;
+        expanded.height = minSide;
+    }
+    return expanded;
+}
+
+/**
+ * Runs the detector on views of the regions, faces found twice in overlapping regions are kept once.
+ */
+void GatedFaceDetector::scan(const cv::Mat& frame, const std::vector<cv::Rect>& regions,
+                             std::vector<cv::Rect>& faceRects) {
+    faceRects.clear();
+    for (const cv::Rect& region : regions) {
+        m_detector->detect(frame(region), m_regionFaces);
+        m_detectorCalls++;
+        m_scannedPixels += region.area();
+        for (cv::Rect face : m_regionFaces) {
+            face += region.tl();
+            bool duplicate = std::any_of(faceRects.begin(), faceRects.end(),
+                                         [&](const cv::Rect& found) { return overlap(face, found) > 0.5; });
+            if (!duplicate)
+                faceRects.push_back(face);
+        }
+    }
+}
+
+void GatedFaceDetector::detect(const cv::Mat& frame, std::vector<cv::Rect>& faceRects) {
+    auto start = std::chrono::steady_clock::now();
+    if (m_frames == 0)
+        m_firstFrame = start;
+    if (frame.size() != m_frameSize)
+        this->resetFrameSize(frame.size());
+    m_frames++;
+    m_framePixels += frame.total();
+
+    m_regions.clear();
+    bool motion = this->findMotion(frame, m_regions);
+    // a new frame size resets the counter to 0
+    bool fullScan = m_framesSinceFullScan == 0 ||
+                    (m_config.fullScanInterval > 0 && m_framesSinceFullScan >= m_config.fullScanInterval);
+    if (!fullScan && !motion) {
+        // nothing moved, the faces are where they were
+        faceRects = m_faces;
+        m_skippedFrames++;
+    }
+    else {
+        if (!fullScan && m_config.searchAroundFaces) {
+            m_regions.insert(m_regions.end(), m_faces.begin(), m_faces.end());
+            for (cv::Rect& region : m_regions)
+                region = this->expand(region, m_config.regionMargin);
+            // overlapping regions are merged, so no part of the frame is searched twice
+            for (bool merged = true; merged;) {
+                merged = false;
+                for (size_t i = 0; i < m_regions.size() && !merged; i++) {
+                    for (size_t j = i + 1; j < m_regions.size() && !merged; j++) {
+                        if ((m_regions[i] & m_regions[j]).area() > 0) {
+                            m_regions[i] |= m_regions[j];
+                            m_regions.erase(m_regions.begin() + j);
+                            merged = true;
+                        }
+                    }
+                }
+            }
+            std::vector<cv::Rect> clipped;
+            double regionPixels = 0., roiPixels = 0.;
+            for (const cv::Rect& roi : m_rois) {
+                roiPixels += roi.area();
+                for (const cv::Rect& region : m_regions) {
+                    cv::Rect inside = region & roi;
+                    if (inside.width >= m_minFaceSize && inside.height >= m_minFaceSize) {
+                        clipped.push_back(inside);
+                        regionPixels += inside.area();
+                    }
+                }
+            }
+            m_regions.swap(clipped);
+            fullScan = regionPixels > m_config.maxRegionFraction * roiPixels;
+        }
+        else {
+            fullScan = true;
+        }
+
+        if (fullScan) {
+            auto scanStart = std::chrono::steady_clock::now();
+            this->scan(frame, m_rois, faceRects);
+            m_fullScanMicros += microsSince(scanStart);
+            m_fullScans++;
+            m_framesSinceFullScan = 0;
+        }
+        else {
+            this->scan(frame, m_regions, faceRects);
+            m_regionScans++;
+        }
+        m_faces = faceRects;
+    }
+    m_framesSinceFullScan++;
+    m_totalMicros += microsSince(start);
+    m_lastFrame = std::chrono::steady_clock::now();
+}
+
+/**
+ * Forgets the previous frame and its faces, the next frame is scanned in full. The statistics are kept.
+ */
+void GatedFaceDetector::reset() {
+    m_frameSize = cv::Size();
+    m_faces.clear();
+}
+
+/**
+ * Prints how often the detector ran and how much detection time the gate saved, estimated against a full scan of
+ * every frame. The scanned pixels show what the regions of interest save in addition.
+ */
+void GatedFaceDetector::printReport(std::ostream& out) const {
+    double seconds = std::chrono::duration_cast<std::chrono::microseconds>(m_lastFrame - m_firstFrame).count() / 1e6;
+    double fullScanMicros = m_fullScans > 0 ? m_fullScanMicros / m_fullScans : 0.;
+    double saved = m_frames > 0 && fullScanMicros > 0. ? 1. - m_totalMicros / (m_frames * fullScanMicros) : 0.;
+    out << "detection gate: " << m_frames << " frames, " << m_fullScans << " full scans, " << m_regionScans <<
+        " region scans, " << m_skippedFrames << " frames without detection" << std::endl;
+    out << "detector: " << (seconds > 0. ? m_detectorCalls / seconds : 0.) << " calls/s, " <<
+        100. * m_scannedPixels / std::max(m_framePixels, 1.) << "% of the frame pixels scanned, " <<
+        100. * saved << "% of the detection time saved, gate included" << std::endl;
+}
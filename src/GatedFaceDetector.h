@@ -0,0 +1,56 @@
+#ifndef FACE_RECOGNITION_GATEDFACEDETECTOR_H
+#define FACE_RECOGNITION_GATEDFACEDETECTOR_H
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "FaceDetector.h"
+
+/**
+ * Runs a detector only where a stream changed. Every frame is compared with the previous one on a small grayscale
+ * copy (about 0.1 ms for 640x480). Without motion the faces of the previous frame are returned again and the detector
+ * does not run. With motion only the moving regions and the surroundings of the previous faces are searched; a full
+ * scan of the regions of interest runs every fullScanInterval frames, on the first frame and whenever the regions to
+ * search cover most of the frame. Stateful, so one instance per stream: use it for consecutive frames of one camera,
+ * not for unrelated images.
+ */
+class GatedFaceDetector : public FaceDetector {
+private:
+    cv::Ptr<FaceDetector> m_detector;
+    DetectionGateConfig m_config;
+    int m_minFaceSize;
+
+    cv::Size m_frameSize;
+    double m_motionScale = 1.;
+    cv::Mat m_smallFrame, m_smallGray, m_previousGray, m_difference, m_roiMask;
+    std::vector<cv::Rect> m_rois;           // clipped to the frame, the whole frame without configured ROIs
+    std::vector<cv::Rect> m_faces;          // of the previous frame
+    std::vector<cv::Rect> m_regions, m_regionFaces;
+    int m_framesSinceFullScan = 0;
+
+    // statistics
+    long m_frames = 0;
+    long m_fullScans = 0;
+    long m_regionScans = 0;
+    long m_skippedFrames = 0;
+    long m_detectorCalls = 0;
+    double m_scannedPixels = 0.;
+    double m_framePixels = 0.;
+    double m_fullScanMicros = 0.;
+    double m_totalMicros = 0.;
+    std::chrono::steady_clock::time_point m_firstFrame, m_lastFrame;
+
+    void resetFrameSize(const cv::Size& frameSize);
+    bool findMotion(const cv::Mat& frame, std::vector<cv::Rect>& regions);
+    void scan(const cv::Mat& frame, const std::vector<cv::Rect>& regions, std::vector<cv::Rect>& faceRects);
+    cv::Rect expand(const cv::Rect& rect, double margin) const;
+public:
+    GatedFaceDetector(const DetectionGateConfig& config, const cv::Ptr<FaceDetector>& detector, int minFaceSize);
+    void detect(const cv::Mat& frame, std::vector<cv::Rect>& faceRects) override;
+    void printReport(std::ostream& out) const override;
+    void reset() override;
+};
+
+
+#endif //FACE_RECOGNITION_GATEDFACEDETECTOR_H
@@ -0,0 +1,658 @@
+#include "GraphOptimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include "tensorflow/core/framework/node_def.pb.h"
+#include "tensorflow/core/framework/op.h"
+#include "tensorflow/core/framework/op_def.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor.pb.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/public/session.h"
+
+using namespace tensorflow;
+
+// one input of a node: "node", "node:port" or "^node" for a control dependency
+struct InputRef {
+    std::string node;
+    int port = 0;
+    bool control = false;
+};
+
+static InputRef parseInput(const std::string& input) {
+    InputRef ref;
+    ref.control = !input.empty() && input[0] == '^';
+    ref.node = ref.control ? input.substr(1) : input;
+    size_t colon = ref.node.find_last_of(':');
+    if (!ref.control && colon != std::string::npos &&
+        ref.node.find_first_not_of("0123456789", colon + 1) == std::string::npos) {
+        ref.port = std::atoi(ref.node.c_str() + colon + 1);
+        ref.node = ref.node.substr(0, colon);
+    }
+    return ref;
+}
+
+// "node:port" with explicit port 0, the key of a tensor in the maps below
+static std::string tensorKey(const std::string& node, int port) {
+    return node + ":" + std::to_string(port);
+}
+
+static std::string inputString(const std::string& node, int port) {
+    return port == 0 ? node : tensorKey(node, port);
+}
+
+static std::unordered_map<std::string, int> indexNodes(const GraphDef& graph) {
+    std::unordered_map<std::string, int> byName;
+    for (int i = 0; i < graph.node_size(); i++)
+        byName[graph.node(i).name()] = i;
+    return byName;
+}
+
+static void setConst(NodeDef* node, const Tensor& value) {
+    node->set_op("Const");
+    node->clear_input();
+    node->clear_attr();
+    node->clear_device();
+    (*node->mutable_attr())["dtype"].set_type(value.dtype());
+    value.AsProtoTensorContent((*node->mutable_attr())["value"].mutable_tensor());
+}
+
+static std::string uniqueName(const std::unordered_map<std::string, int>& byName, const std::string& name) {
+    std::string unique = name;
+    for (int suffix = 1; byName.count(unique); suffix++)
+        unique = name + "_" + std::to_string(suffix);
+    return unique;
+}
+
+static NodeDef* addConst(GraphDef& graph, std::unordered_map<std::string, int>& byName, const std::string& name,
+                         const Tensor& value) {
+    NodeDef* node = graph.add_node();
+    node->set_name(uniqueName(byName, name));
+    setConst(node, value);
+    byName[node->name()] = graph.node_size() - 1;
+    return node;
+}
+
+/**
+ * Value of a tensor if it is a Const node, directly or through Identity nodes.
+ */
+static bool constValue(const GraphDef& graph, const std::unordered_map<std::string, int>& byName, InputRef ref,
+                       Tensor& value) {
+    for (int depth = 0; depth < graph.node_size(); depth++) {
+        auto found = byName.find(ref.node);
+        if (found == byName.end() || ref.control)
+            return false;
+        const NodeDef& node = graph.node(found->second);
+        if (node.op() == "Const" && ref.port == 0)
+            return value.FromProto(node.attr().at("value").tensor());
+        if (node.op() != "Identity" || node.input_size() == 0)
+            return false;
+        ref = parseInput(node.input(0));
+    }
+    return false;
+}
+
+/**
+ * Replaces every input that has an entry in substitutions, following chains of substitutions. Control dependencies on
+ * a substituted node become control dependencies on the node of its substitute.
+ */
+static void applySubstitutions(GraphDef& graph, const std::unordered_map<std::string, std::string>& substitutions) {
+    for (int i = 0; i < graph.node_size(); i++) {
+        NodeDef* node = graph.mutable_node(i);
+        for (int j = 0; j < node->input_size(); j++) {
+            InputRef ref = parseInput(node->input(j));
+            bool changed = false;
+            for (int depth = 0; depth < graph.node_size(); depth++) {
+                auto substitute = substitutions.find(tensorKey(ref.node, ref.port));
+                if (substitute == substitutions.end())
+                    break;
+                InputRef next = parseInput(substitute->second);
+                ref.node = next.node;
+                ref.port = ref.control ? 0 : next.port;
+                changed = true;
+            }
+            if (changed)
+                node->set_input(j, ref.control ? "^" + ref.node : inputString(ref.node, ref.port));
+        }
+    }
+}
+
+/**
+ * Removes all nodes the outputs and kept nodes do not depend on, the order of the remaining nodes is preserved.
+ */
+static void stripUnused(GraphDef& graph, const GraphOptimizerConfig& config) {
+    std::unordered_map<std::string, int> byName = indexNodes(graph);
+    std::vector<char> used(graph.node_size(), 0);
+    std::vector<int> stack;
+    for (const auto* names : {&config.outputNodes, &config.keepNodes}) {
+        for (const std::string& name : *names) {
+            auto found = byName.find(name);
+            if (found != byName.end() && !used[found->second]) {
+                used[found->second] = 1;
+                stack.push_back(found->second);
+            }
+        }
+    }
+    while (!stack.empty()) {
+        const NodeDef& node = graph.node(stack.back());
+        stack.pop_back();
+        for (const std::string& input : node.input()) {
+            auto found = byName.find(parseInput(input).node);
+            if (found != byName.end() && !used[found->second]) {
+                used[found->second] = 1;
+                stack.push_back(found->second);
+            }
+        }
+    }
+    GraphDef stripped;
+    *stripped.mutable_versions() = graph.versions();
+    *stripped.mutable_library() = graph.library();
+    for (int i = 0; i < graph.node_size(); i++) {
+        if (used[i])
+            *stripped.add_node() = graph.node(i);
+    }
+    graph.Swap(&stripped);
+}
+
+/**
+ * Resolves Switch nodes with a constant predicate and the Merge nodes behind them. Outputs of the untaken Switch port
+ * are dead, so is every node with a dead input except Merge, which forwards its single live input.
+ */
+static void resolveSwitches(GraphDef& graph, GraphOptimizerStats& stats) {
+    std::unordered_map<std::string, int> byName = indexNodes(graph);
+    std::unordered_map<std::string, int> livePorts;
+    for (const NodeDef& node : graph.node()) {
+        Tensor predicate;
+        if (node.op() == "Switch" && node.input_size() >= 2 &&
+            constValue(graph, byName, parseInput(node.input(1)), predicate) && predicate.dtype() == DT_BOOL) {
+            livePorts[node.name()] = predicate.scalar<bool>()() ? 1 : 0;
+        }
+    }
+
+    std::unordered_set<std::string> deadNodes;
+    auto isDead = [&](const InputRef& ref) {
+        if (deadNodes.count(ref.node))
+            return true;
+        auto livePort = livePorts.find(ref.node);
+        return !ref.control && livePort != livePorts.end() && ref.port != livePort->second;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (const NodeDef& node : graph.node()) {
+            if (deadNodes.count(node.name()) || node.input_size() == 0)
+                continue;
+            bool dead;
+            if (node.op() == "Merge") {
+                dead = true;
+                for (const std::string& input : node.input()) {
+                    InputRef ref = parseInput(input);
+                    dead = dead && (ref.control || isDead(ref));
+                }
+            }
+            else {
+                dead = false;
+                for (const std::string& input : node.input())
+                    dead = dead || isDead(parseInput(input));
+            }
+            if (dead) {
+                deadNodes.insert(node.name());
+                changed = true;
+            }
+        }
+    }
+
+    std::unordered_set<std::string> valueIndexUsed;
+    for (const NodeDef& node : graph.node()) {
+        for (const std::string& input : node.input()) {
+            InputRef ref = parseInput(input);
+            if (!ref.control && ref.port == 1)
+                valueIndexUsed.insert(ref.node);
+        }
+    }
+    std::unordered_map<std::string, std::string> substitutions;
+    for (const NodeDef& node : graph.node()) {
+        if (deadNodes.count(node.name()))
+            continue;
+        auto livePort = livePorts.find(node.name());
+        if (livePort != livePorts.end()) {
+            substitutions[tensorKey(node.name(), livePort->second)] = node.input(0);
+            stats.switchesResolved++;
+        }
+        else if (node.op() == "Merge" && !valueIndexUsed.count(node.name())) {
+            std::vector<std::string> liveInputs;
+            for (const std::string& input : node.input()) {
+                InputRef ref = parseInput(input);
+                if (!ref.control && !isDead(ref))
+                    liveInputs.push_back(input);
+            }
+            // a Merge of two live inputs depends on runtime values and stays
+            if (liveInputs.size() == 1)
+                substitutions[tensorKey(node.name(), 0)] = liveInputs[0];
+        }
+    }
+    applySubstitutions(graph, substitutions);
+}
+
+/**
+ * Bypasses Identity nodes without control dependencies, e.g. the read nodes of frozen variables.
+ */
+static void bypassIdentities(GraphDef& graph, const GraphOptimizerConfig& config) {
+    std::unordered_set<std::string> keep(config.outputNodes.begin(), config.outputNodes.end());
+    keep.insert(config.keepNodes.begin(), config.keepNodes.end());
+    std::unordered_map<std::string, std::string> substitutions;
+    for (const NodeDef& node : graph.node()) {
+        if (node.op() == "Identity" && node.input_size() == 1 && !keep.count(node.name()) &&
+            !parseInput(node.input(0)).control)
+            substitutions[tensorKey(node.name(), 0)] = node.input(0);
+    }
+    applySubstitutions(graph, substitutions);
+}
+
+/**
+ * Folds inference batch norms (FusedBatchNorm with is_training false, NHWC) that directly follow a Conv2D with a
+ * constant filter: filter * scale / sqrt(variance + epsilon) replaces the filter, the batch norm becomes a BiasAdd with
+ * offset - mean * scale / sqrt(variance + epsilon).
+ */
+static void foldBatchNorms(GraphDef& graph, GraphOptimizerStats& stats) {
+    std::unordered_map<std::string, int> byName = indexNodes(graph);
+    std::unordered_map<std::string, int> consumers;  // data consumers per tensor key
+    std::unordered_set<std::string> secondaryOutputUsed;
+    for (const NodeDef& node : graph.node()) {
+        for (const std::string& input : node.input()) {
+            InputRef ref = parseInput(input);
+            if (ref.control)
+                continue;
+            consumers[tensorKey(ref.node, ref.port)]++;
+            if (ref.port > 0)
+                secondaryOutputUsed.insert(ref.node);
+        }
+    }
+
+    int nmbrNodes = graph.node_size();
+    for (int i = 0; i < nmbrNodes; i++) {
+        const NodeDef& batchNorm = graph.node(i);
+        const std::string& op = batchNorm.op();
+        if (op != "FusedBatchNorm" && op != "FusedBatchNormV2" && op != "FusedBatchNormV3")
+            continue;
+        const auto& attr = batchNorm.attr();
+        if (!attr.count("is_training") || attr.at("is_training").b() || secondaryOutputUsed.count(batchNorm.name()) ||
+            (attr.count("data_format") && attr.at("data_format").s() != "NHWC") || batchNorm.input_size() < 5)
+            continue;
+        InputRef convRef = parseInput(batchNorm.input(0));
+        auto convIndex = byName.find(convRef.node);
+        if (convRef.port != 0 || convIndex == byName.end() || consumers[tensorKey(convRef.node, 0)] != 1)
+            continue;
+        const NodeDef& conv = graph.node(convIndex->second);
+        if (conv.op() != "Conv2D" || conv.input_size() < 2 ||
+            (conv.attr().count("data_format") && conv.attr().at("data_format").s() != "NHWC"))
+            continue;
+
+        Tensor filter, scale, offset, mean, variance;
+        if (!constValue(graph, byName, parseInput(conv.input(1)), filter) ||
+            !constValue(graph, byName, parseInput(batchNorm.input(1)), scale) ||
+            !constValue(graph, byName, parseInput(batchNorm.input(2)), offset) ||
+            !constValue(graph, byName, parseInput(batchNorm.input(3)), mean) ||
+            !constValue(graph, byName, parseInput(batchNorm.input(4)), variance) ||
+            filter.dtype() != DT_FLOAT || filter.dims() != 4)
+            continue;
+        int channels = filter.dim_size(3);
+        if (scale.NumElements() != channels || offset.NumElements() != channels || mean.NumElements() != channels ||
+            variance.NumElements() != channels)
+            continue;
+        float epsilon = attr.count("epsilon") ? attr.at("epsilon").f() : 0.0001f;
+
+        std::vector<float> multiplier(channels);
+        Tensor bias(DT_FLOAT, TensorShape({channels}));
+        for (int c = 0; c < channels; c++) {
+            multiplier[c] = scale.flat<float>()(c) / std::sqrt(variance.flat<float>()(c) + epsilon);
+            bias.flat<float>()(c) = offset.flat<float>()(c) - mean.flat<float>()(c) * multiplier[c];
+        }
+        Tensor foldedFilter(DT_FLOAT, filter.shape());
+        const float* src = filter.flat<float>().data();
+        float* dst = foldedFilter.flat<float>().data();
+        for (int64 j = 0; j < filter.NumElements(); j++)
+            dst[j] = src[j] * multiplier[j % channels];
+
+        std::string convName = conv.name(), batchNormName = batchNorm.name();
+        std::string filterName = addConst(graph, byName, convName + "/folded_filter", foldedFilter)->name();
+        std::string biasName = addConst(graph, byName, batchNormName + "/folded_bias", bias)->name();
+        graph.mutable_node(convIndex->second)->set_input(1, filterName);
+
+        NodeDef* biasAdd = graph.mutable_node(i);
+        std::vector<std::string> controlInputs;
+        for (const std::string& input : biasAdd->input()) {
+            if (parseInput(input).control)
+                controlInputs.push_back(input);
+        }
+        std::string convInput = biasAdd->input(0);
+        biasAdd->set_op("BiasAdd");
+        biasAdd->clear_attr();
+        (*biasAdd->mutable_attr())["T"].set_type(DT_FLOAT);
+        (*biasAdd->mutable_attr())["data_format"].set_s("NHWC");
+        biasAdd->clear_input();
+        biasAdd->add_input(convInput);
+        biasAdd->add_input(biasName);
+        for (const std::string& input : controlInputs)
+            biasAdd->add_input(input);
+        stats.batchNormsFolded++;
+    }
+}
+
+/**
+ * Evaluates every stateless node that only depends on constants in one session run and replaces the tensors that
+ * other nodes consume by Const nodes.
+ */
+static Status foldConstants(GraphDef& graph, const GraphOptimizerConfig& config, GraphOptimizerStats& stats) {
+    std::unordered_set<std::string> keep(config.outputNodes.begin(), config.outputNodes.end());
+    keep.insert(config.keepNodes.begin(), config.keepNodes.end());
+    std::unordered_set<std::string> constant, foldable;
+    for (const NodeDef& node : graph.node()) {
+        if (node.op() == "Const")
+            constant.insert(node.name());
+    }
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (const NodeDef& node : graph.node()) {
+            if (constant.count(node.name()) || foldable.count(node.name()) || keep.count(node.name()) ||
+                node.input_size() == 0 || node.op() == "Switch" || node.op() == "Merge")
+                continue;
+            const OpDef* opDef;
+            if (!OpRegistry::Global()->LookUpOpDef(node.op(), &opDef).ok() || opDef->is_stateful())
+                continue;
+            bool allConstant = true;
+            for (const std::string& input : node.input()) {
+                std::string inputNode = parseInput(input).node;
+                allConstant = allConstant && (constant.count(inputNode) || foldable.count(inputNode));
+            }
+            if (allConstant) {
+                foldable.insert(node.name());
+                changed = true;
+            }
+        }
+    }
+    if (foldable.empty())
+        return Status::OK();
+
+    // tensors of foldable nodes consumed by the rest of the graph
+    std::vector<std::string> fetches;
+    std::unordered_set<std::string> fetched;
+    for (int i = 0; i < graph.node_size(); i++) {
+        NodeDef* node = graph.mutable_node(i);
+        if (foldable.count(node->name()))
+            continue;
+        std::vector<std::string> inputs;
+        for (const std::string& input : node->input()) {
+            InputRef ref = parseInput(input);
+            if (!foldable.count(ref.node)) {
+                inputs.push_back(input);
+                continue;
+            }
+            // control dependencies on constant computations order nothing
+            if (ref.control)
+                continue;
+            inputs.push_back(input);
+            if (fetched.insert(tensorKey(ref.node, ref.port)).second)
+                fetches.push_back(tensorKey(ref.node, ref.port));
+        }
+        node->clear_input();
+        for (const std::string& input : inputs)
+            node->add_input(input);
+    }
+
+    GraphDef constantGraph;
+    *constantGraph.mutable_versions() = graph.versions();
+    *constantGraph.mutable_library() = graph.library();
+    for (const NodeDef& node : graph.node()) {
+        if (constant.count(node.name()) || foldable.count(node.name())) {
+            NodeDef* copy = constantGraph.add_node();
+            *copy = node;
+            copy->clear_device();
+        }
+    }
+    std::unique_ptr<Session> session(NewSession(SessionOptions()));
+    if (!session)
+        return errors::Internal("could not create a session for constant folding");
+    TF_RETURN_IF_ERROR(session->Create(constantGraph));
+    std::vector<Tensor> values;
+    TF_RETURN_IF_ERROR(session->Run({}, fetches, {}, &values));
+    session->Close();
+
+    std::unordered_map<std::string, int> byName = indexNodes(graph);
+    std::unordered_map<std::string, std::string> substitutions;
+    for (int i = 0; i < fetches.size(); i++) {
+        InputRef ref = parseInput(fetches[i]);
+        std::string name = ref.node + "/folded" + (ref.port > 0 ? "_" + std::to_string(ref.port) : "");
+        substitutions[fetches[i]] = addConst(graph, byName, name, values[i])->name();
+    }
+    applySubstitutions(graph, substitutions);
+    stats.constantsFolded += foldable.size();
+    return Status::OK();
+}
+
+/**
+ * See header. optimized is only valid if the returned status is ok.
+ * @param graphDef frozen graph as loaded from the model file
+ * @param config outputs, nodes to keep, the training phase placeholder and which passes run
+ * @param optimized the transformed graph
+ * @param stats node counts and what the passes changed
+ */
+Status optimizeGraph(const GraphDef& graphDef, const GraphOptimizerConfig& config, GraphDef& optimized,
+                     GraphOptimizerStats& stats) {
+    stats = GraphOptimizerStats();
+    stats.nodesBefore = graphDef.node_size();
+    optimized = graphDef;
+    std::unordered_map<std::string, int> byName = indexNodes(optimized);
+    for (const std::string& output : config.outputNodes) {
+        if (!byName.count(output))
+            return errors::NotFound("output node ", output, " is not in the graph");
+    }
+
+    if (!config.phaseTrainNode.empty()) {
+        auto phase = byName.find(config.phaseTrainNode);
+        if (phase != byName.end()) {
+            Tensor isTraining(DT_BOOL, TensorShape());
+            isTraining.scalar<bool>()() = false;
+            setConst(optimized.mutable_node(phase->second), isTraining);
+        }
+    }
+    resolveSwitches(optimized, stats);
+    bypassIdentities(optimized, config);
+    stripUnused(optimized, config);
+    if (config.foldBatchNorms) {
+        foldBatchNorms(optimized, stats);
+        stripUnused(optimized, config);
+    }
+    if (config.foldConstants) {
+        TF_RETURN_IF_ERROR(foldConstants(optimized, config, stats));
+        stripUnused(optimized, config);
+    }
+    stats.nodesAfter = optimized.node_size();
+    return Status::OK();
+}
+
+/**
+ * Conv2D (NHWC) and MatMul nodes with float32 input and constant weights, as left by optimizeGraph. These are the
+ * nodes convertWeightsToHalf and quantizeGraph convert.
+ * @param graphDef optimized graph
+ * @param nodeNames the convertible nodes
+ * @param inputTensors data input of every node, the activations whose range is calibrated for int8
+ */
+void findQuantizableNodes(const GraphDef& graphDef, std::vector<std::string>& nodeNames,
+                          std::vector<std::string>& inputTensors) {
+    nodeNames.clear();
+    inputTensors.clear();
+    std::unordered_map<std::string, int> byName = indexNodes(graphDef);
+    for (const NodeDef& node : graphDef.node()) {
+        const auto& attr = node.attr();
+        bool conv = node.op() == "Conv2D" &&
+                    (!attr.count("data_format") || attr.at("data_format").s() == "NHWC");
+        if ((!conv && node.op() != "MatMul") || node.input_size() < 2 || !attr.count("T") ||
+            attr.at("T").type() != DT_FLOAT)
+            continue;
+        auto weights = byName.find(parseInput(node.input(1)).node);
+        if (weights == byName.end() || graphDef.node(weights->second).op() != "Const")
+            continue;
+        nodeNames.push_back(node.name());
+        inputTensors.push_back(node.input(0));
+    }
+}
+
+/**
+ * Stores the weights of every quantizable node as fp16 followed by a Cast to float32. The file and the graph in memory
+ * shrink to half of the weights, the arithmetic stays float32 because TensorFlow's CPU kernels have no fast fp16 path;
+ * the session folds the casts when it is created.
+ * @param graphDef optimized graph
+ * @param converted graph with fp16 weights
+ * @param stats nodesQuantized counts the converted weights
+ */
+Status convertWeightsToHalf(const GraphDef& graphDef, GraphDef& converted, GraphOptimizerStats& stats) {
+    converted = graphDef;
+    std::vector<std::string> nodeNames, inputTensors;
+    findQuantizableNodes(converted, nodeNames, inputTensors);
+    std::unordered_map<std::string, int> byName = indexNodes(converted);
+    for (const std::string& name : nodeNames) {
+        int nodeIndex = byName.at(name);
+        const NodeDef& weightsNode = converted.node(byName.at(parseInput(converted.node(nodeIndex).input(1)).node));
+        Tensor weights;
+        if (!weights.FromProto(weightsNode.attr().at("value").tensor()) || weights.dtype() != DT_FLOAT)
+            continue;
+        Tensor halfWeights(DT_HALF, weights.shape());
+        const float* src = weights.flat<float>().data();
+        Eigen::half* dst = halfWeights.flat<Eigen::half>().data();
+        for (int64 j = 0; j < weights.NumElements(); j++)
+            dst[j] = Eigen::half(src[j]);
+        std::string halfName = addConst(converted, byName, name + "/half_weights", halfWeights)->name();
+
+        NodeDef* cast = converted.add_node();
+        cast->set_name(uniqueName(byName, name + "/weights_to_float"));
+        byName[cast->name()] = converted.node_size() - 1;
+        cast->set_op("Cast");
+        cast->add_input(halfName);
+        (*cast->mutable_attr())["SrcT"].set_type(DT_HALF);
+        (*cast->mutable_attr())["DstT"].set_type(DT_FLOAT);
+        converted.mutable_node(nodeIndex)->set_input(1, cast->name());
+        stats.nodesQuantized++;
+    }
+    GraphOptimizerConfig config;
+    stripUnused(converted, config);
+    stats.nodesAfter = converted.node_size();
+    return Status::OK();
+}
+
+static NodeDef* addNode(GraphDef& graph, std::unordered_map<std::string, int>& byName, const std::string& name,
+                        const std::string& op, const std::vector<std::string>& inputs) {
+    NodeDef* node = graph.add_node();
+    node->set_name(uniqueName(byName, name));
+    node->set_op(op);
+    for (const std::string& input : inputs)
+        node->add_input(input);
+    byName[node->name()] = graph.node_size() - 1;
+    return node;
+}
+
+static std::string addScalar(GraphDef& graph, std::unordered_map<std::string, int>& byName, const std::string& name,
+                             float value) {
+    Tensor scalar(DT_FLOAT, TensorShape());
+    scalar.scalar<float>()() = value;
+    return addConst(graph, byName, name, scalar)->name();
+}
+
+static std::string addQuantize(GraphDef& graph, std::unordered_map<std::string, int>& byName, const std::string& name,
+                               const std::string& input, float min, float max) {
+    // the range must contain zero and must not be empty
+    min = std::min(min, 0.f);
+    max = std::max(max, min + 1e-6f);
+    std::string minName = addScalar(graph, byName, name + "/min", min);
+    std::string maxName = addScalar(graph, byName, name + "/max", max);
+    NodeDef* quantize = addNode(graph, byName, name, "QuantizeV2", {input, minName, maxName});
+    (*quantize->mutable_attr())["T"].set_type(DT_QUINT8);
+    (*quantize->mutable_attr())["mode"].set_s("MIN_FIRST");
+    return quantize->name();
+}
+
+/**
+ * Converts every quantizable node to its 8 bit counterpart: the input is quantized with its calibrated range, the
+ * weights with their own range (quantized once here by constant folding), QuantizedConv2D or QuantizedMatMul
+ * accumulates in 32 bit and the result is dequantized to float32 under the name of the original node, so all other
+ * nodes keep working on float32. Nodes without a calibrated range stay float32.
+ * @param graphDef optimized graph
+ * @param inputRanges range of the data input of every quantizable node, by node name
+ * @param quantized graph with 8 bit convolutions and matmuls
+ * @param stats nodesQuantized counts the converted nodes
+ */
+Status quantizeGraph(const GraphDef& graphDef, const std::map<std::string, ActivationRange>& inputRanges,
+                     GraphDef& quantized, GraphOptimizerStats& stats) {
+    quantized = graphDef;
+    std::vector<std::string> nodeNames, inputTensors;
+    findQuantizableNodes(quantized, nodeNames, inputTensors);
+    std::unordered_map<std::string, int> byName = indexNodes(quantized);
+    for (int i = 0; i < nodeNames.size(); i++) {
+        const std::string& name = nodeNames[i];
+        auto range = inputRanges.find(name);
+        if (range == inputRanges.end())
+            continue;
+        int nodeIndex = byName.at(name);
+        NodeDef original = quantized.node(nodeIndex);
+        const NodeDef& weightsNode = quantized.node(byName.at(parseInput(original.input(1)).node));
+        Tensor weights;
+        if (!weights.FromProto(weightsNode.attr().at("value").tensor()) || weights.dtype() != DT_FLOAT)
+            continue;
+        auto weightsFlat = weights.flat<float>();
+        float weightsMin = weightsFlat(0), weightsMax = weightsFlat(0);
+        for (int64 j = 1; j < weights.NumElements(); j++) {
+            weightsMin = std::min(weightsMin, weightsFlat(j));
+            weightsMax = std::max(weightsMax, weightsFlat(j));
+        }
+
+        std::string input = addQuantize(quantized, byName, name + "/quantize_input", original.input(0),
+                                        range->second.min, range->second.max);
+        std::string filter = addQuantize(quantized, byName, name + "/quantize_weights", original.input(1),
+                                         weightsMin, weightsMax);
+        bool conv = original.op() == "Conv2D";
+        NodeDef* op = addNode(quantized, byName, name + "/quantized", conv ? "QuantizedConv2D" : "QuantizedMatMul",
+                              {input, filter, input + ":1", input + ":2", filter + ":1", filter + ":2"});
+        auto& attr = *op->mutable_attr();
+        if (conv) {
+            attr["Tinput"].set_type(DT_QUINT8);
+            attr["Tfilter"].set_type(DT_QUINT8);
+            attr["out_type"].set_type(DT_QINT32);
+            attr["strides"] = original.attr().at("strides");
+            attr["padding"] = original.attr().at("padding");
+            if (original.attr().count("dilations"))
+                attr["dilations"] = original.attr().at("dilations");
+        }
+        else {
+            attr["T1"].set_type(DT_QUINT8);
+            attr["T2"].set_type(DT_QUINT8);
+            attr["Toutput"].set_type(DT_QINT32);
+            attr["transpose_a"].set_b(original.attr().count("transpose_a") && original.attr().at("transpose_a").b());
+            attr["transpose_b"].set_b(original.attr().count("transpose_b") && original.attr().at("transpose_b").b());
+        }
+
+        std::string quantizedName = op->name();
+        NodeDef* dequantize = quantized.mutable_node(nodeIndex);
+        dequantize->clear_input();
+        dequantize->clear_attr();
+        dequantize->set_op("Dequantize");
+        dequantize->add_input(quantizedName);
+        dequantize->add_input(quantizedName + ":1");
+        dequantize->add_input(quantizedName + ":2");
+        for (const std::string& controlInput : original.input()) {
+            if (parseInput(controlInput).control)
+                dequantize->add_input(controlInput);
+        }
+        (*dequantize->mutable_attr())["T"].set_type(DT_QINT32);
+        (*dequantize->mutable_attr())["mode"].set_s("MIN_FIRST");
+        stats.nodesQuantized++;
+    }
+
+    // quantizes the weights once
+    GraphOptimizerConfig config;
+    TF_RETURN_IF_ERROR(foldConstants(quantized, config, stats));
+    stripUnused(quantized, config);
+    stats.nodesAfter = quantized.node_size();
+    return Status::OK();
+}
@@ -0,0 +1,70 @@
+#ifndef FACE_RECOGNITION_GRAPHOPTIMIZER_H
+#define FACE_RECOGNITION_GRAPHOPTIMIZER_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+
+/**
+ * Numeric format of the network. Only PRECISION_FLOAT32 is a performance choice: fp16 only shrinks the cached file, and
+ * int8 runs on TensorFlow 1.x's reference quantized CPU kernels with a QuantizeV2 / Dequantize pair around every
+ * layer, which is usually slower than float32 and never reaches VNNI. int8 is opt-in, to evaluate quantized accuracy
+ * or to prepare a graph for runtimes with fast int8 kernels.
+ */
+enum ModelPrecision {
+    PRECISION_FLOAT32,          // the graph as trained
+    PRECISION_FLOAT16_STORAGE,  // weights stored as fp16 in the file only, cast back to float32 when the session is
+                                // created, so memory and speed equal float32
+    PRECISION_INT8              // experimental: 8 bit convolutions and matmuls, calibrated activation ranges, see above
+};
+
+// bumped whenever a transformation below changes the values a graph computes, it is part of the model hash of gallery
+// files, so galleries enrolled with an older transformed graph are enrolled again
+static const int GRAPH_OPTIMIZER_VERSION = 1;
+
+struct ActivationRange {
+    float min;
+    float max;
+};
+
+struct GraphOptimizerConfig {
+    std::vector<std::string> outputNodes = {"embeddings"};
+    std::vector<std::string> keepNodes = {"input"};     // kept even if the outputs do not depend on them, e.g. feeds
+    std::string phaseTrainNode = "phase_train";         // bound to false, empty keeps the placeholder
+    bool foldBatchNorms = true;
+    bool foldConstants = true;
+};
+
+struct GraphOptimizerStats {
+    int nodesBefore = 0;
+    int nodesAfter = 0;
+    int switchesResolved = 0;
+    int batchNormsFolded = 0;
+    int constantsFolded = 0;
+    int nodesQuantized = 0;     // weights converted to fp16 or operations converted to int8
+};
+
+/**
+ * Transforms a frozen inference graph into an equivalent smaller one. The training phase placeholder is replaced by
+ * the constant false, every Switch / Merge depending on it is resolved to its inference branch, so the training-mode
+ * batch norm and dropout branches disappear. Inference batch norms after convolutions are folded into the filters
+ * and a bias, subgraphs of constants are evaluated once and replaced by their values, and nodes the outputs do not
+ * depend on are removed.
+ */
+tensorflow::Status optimizeGraph(const tensorflow::GraphDef& graphDef, const GraphOptimizerConfig& config,
+                                 tensorflow::GraphDef& optimized, GraphOptimizerStats& stats);
+
+void findQuantizableNodes(const tensorflow::GraphDef& graphDef, std::vector<std::string>& nodeNames,
+                          std::vector<std::string>& inputTensors);
+
+tensorflow::Status convertWeightsToHalf(const tensorflow::GraphDef& graphDef, tensorflow::GraphDef& converted,
+                                        GraphOptimizerStats& stats);
+
+tensorflow::Status quantizeGraph(const tensorflow::GraphDef& graphDef,
+                                 const std::map<std::string, ActivationRange>& inputRanges,
+                                 tensorflow::GraphDef& quantized, GraphOptimizerStats& stats);
+
+
+#endif //FACE_RECOGNITION_GRAPHOPTIMIZER_H
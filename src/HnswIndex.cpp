@@ -0,0 +1,313 @@
+#include "HnswIndex.h"
+#include "EmbeddingGallery.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+
+/**
+ * Creates an empty index.
+ * @param dim length of the embeddings
+ * @param config graph degree, candidate list sizes and seed
+ */
+HnswIndex::HnswIndex(int dim, const HnswConfig& config) : m_rng(config.seed) {
+    m_dim = dim;
+    m_config = config;
+    m_config.M = std::max(2, m_config.M);
+    m_levelFactor = 1. / std::log(double(m_config.M));
+}
+
+/**
+ * Rebuilds the graph over all rows of embeddings that are not marked as removed.
+ * @param embeddings nmbrEmbeddings x dim floats, row-major
+ * @param nmbrEmbeddings number of rows
+ * @param removed one flag per row, may be empty
+ */
+void HnswIndex::build(const float* embeddings, int nmbrEmbeddings, const std::vector<char>& removed) {
+    m_links.clear();
+    m_removed.assign(nmbrEmbeddings, 0);
+    m_nmbrRemoved = 0;
+    m_entryPoint = -1;
+    m_maxLevel = -1;
+    m_rng.seed(m_config.seed);
+    for (int row = 0; row < nmbrEmbeddings; row++) {
+        // removed rows are left out of the graph, no node links to them
+        if (row < int(removed.size()) && removed[row]) {
+            m_links.resize(row + 1);
+            continue;
+        }
+        add(embeddings, row);
+    }
+}
+
+int HnswIndex::randomLevel() {
+    std::uniform_real_distribution<double> uniform(std::numeric_limits<double>::min(), 1.);
+    return int(-std::log(uniform(m_rng)) * m_levelFactor);
+}
+
+// nodes visited by the current search of this thread, marked with its tag. Tags only grow, so marks left by earlier
+// searches, also on other indices, never equal the current tag.
+struct VisitedList {
+    std::vector<unsigned> marks;
+    unsigned tag = 0;
+
+    unsigned next(size_t nmbrNodes) {
+        if (marks.size() < nmbrNodes)
+            marks.resize(nmbrNodes, 0);
+        if (++tag == 0) {
+            std::fill(marks.begin(), marks.end(), 0);
+            tag = 1;
+        }
+        return tag;
+    }
+};
+
+static VisitedList& visitedList() {
+    static thread_local VisitedList visited;
+    return visited;
+}
+
+/**
+ * Walks from entry to the closest node of one layer by always moving to a closer neighbor, used on the upper layers.
+ */
+int HnswIndex::greedyClosest(const float* embeddings, const float* query, int entry, int level) const {
+    int current = entry;
+    float currentDistance = squaredL2Distance(query, embeddings + size_t(current) * m_dim, m_dim);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int neighbor : m_links[current][level]) {
+            float distance = squaredL2Distance(query, embeddings + size_t(neighbor) * m_dim, m_dim);
+            if (distance < currentDistance) {
+                currentDistance = distance;
+                current = neighbor;
+                changed = true;
+            }
+        }
+    }
+    return current;
+}
+
+/**
+ * Beam search on one layer, returns up to ef nodes closest to query sorted by ascending distance.
+ */
+void HnswIndex::searchLayer(const float* embeddings, const float* query, int entry, int ef, int level,
+                            std::vector<Candidate>& nearest) const {
+    VisitedList& visited = visitedList();
+    unsigned tag = visited.next(m_links.size());
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > candidates;
+    std::priority_queue<Candidate> results;
+
+    Candidate start = {squaredL2Distance(query, embeddings + size_t(entry) * m_dim, m_dim), entry};
+    visited.marks[entry] = tag;
+    candidates.push(start);
+    results.push(start);
+    while (!candidates.empty()) {
+        Candidate closest = candidates.top();
+        if (closest.distance > results.top().distance && int(results.size()) >= ef)
+            break;
+        candidates.pop();
+        for (int neighbor : m_links[closest.node][level]) {
+            if (visited.marks[neighbor] == tag)
+                continue;
+            visited.marks[neighbor] = tag;
+            float distance = squaredL2Distance(query, embeddings + size_t(neighbor) * m_dim, m_dim);
+            if (int(results.size()) < ef || distance < results.top().distance) {
+                Candidate candidate = {distance, neighbor};
+                candidates.push(candidate);
+                results.push(candidate);
+                if (int(results.size()) > ef)
+                    results.pop();
+            }
+        }
+    }
+
+    nearest.resize(results.size());
+    for (int i = int(results.size()) - 1; i >= 0; i--) {
+        nearest[i] = results.top();
+        results.pop();
+    }
+}
+
+/**
+ * Neighbor selection heuristic: a candidate is only linked if it is closer to the new node than to every neighbor
+ * selected so far, which keeps links pointing in different directions. Remaining slots are filled with the closest
+ * discarded candidates. candidates must be sorted by ascending distance.
+ */
+void HnswIndex::selectNeighbors(const float* embeddings, std::vector<Candidate>& candidates, int maxLinks) const {
+    if (int(candidates.size()) <= maxLinks)
+        return;
+    std::vector<Candidate> selected, discarded;
+    for (const Candidate& candidate : candidates) {
+        if (int(selected.size()) >= maxLinks)
+            break;
+        const float* embedding = embeddings + size_t(candidate.node) * m_dim;
+        bool diverse = true;
+        for (const Candidate& other : selected) {
+            if (squaredL2Distance(embedding, embeddings + size_t(other.node) * m_dim, m_dim) < candidate.distance) {
+                diverse = false;
+                break;
+            }
+        }
+        if (diverse)
+            selected.push_back(candidate);
+        else
+            discarded.push_back(candidate);
+    }
+    for (size_t i = 0; i < discarded.size() && int(selected.size()) < maxLinks; i++)
+        selected.push_back(discarded[i]);
+    candidates.swap(selected);
+}
+
+/**
+ * Shrinks the links of node on level back to the maximum degree after a new node was linked to it by keeping the
+ * closest ones. This runs for every neighbor of every inserted node, the diversity heuristic is only used for the links
+ * of the new node itself, where it matters most, because it costs a quadratic number of distances.
+ */
+void HnswIndex::pruneLinks(const float* embeddings, int node, int level) {
+    std::vector<int>& links = m_links[node][level];
+    int maxLinks = level == 0 ? 2 * m_config.M : m_config.M;
+    if (int(links.size()) <= maxLinks)
+        return;
+    const float* embedding = embeddings + size_t(node) * m_dim;
+    std::vector<Candidate> candidates(links.size());
+    for (size_t i = 0; i < links.size(); i++) {
+        candidates[i].node = links[i];
+        candidates[i].distance = squaredL2Distance(embedding, embeddings + size_t(links[i]) * m_dim, m_dim);
+    }
+    std::nth_element(candidates.begin(), candidates.begin() + maxLinks, candidates.end());
+    candidates.resize(maxLinks);
+    links.clear();
+    for (const Candidate& candidate : candidates)
+        links.push_back(candidate.node);
+}
+
+/**
+ * Inserts a row into the graph. Rows have to be added in ascending order, gaps (rows never added) are allowed.
+ * @param embeddings embedding matrix containing row
+ * @param row row of the new embedding
+ */
+void HnswIndex::add(const float* embeddings, int row) {
+    if (row >= int(m_links.size())) {
+        m_links.resize(row + 1);
+        m_removed.resize(row + 1, 0);
+    }
+    int level = randomLevel();
+    m_links[row].resize(level + 1);
+    if (m_entryPoint < 0) {
+        m_entryPoint = row;
+        m_maxLevel = level;
+        return;
+    }
+
+    this->link(embeddings, row, m_entryPoint, std::min(level, m_maxLevel));
+    if (level > m_maxLevel) {
+        m_maxLevel = level;
+        m_entryPoint = row;
+    }
+}
+
+/**
+ * Links row to its nearest nodes on the levels up to level and back, replacing the links it had. The search starts at
+ * entry on the top level.
+ */
+void HnswIndex::link(const float* embeddings, int row, int entry, int level) {
+    const float* query = embeddings + size_t(row) * m_dim;
+    for (int l = m_maxLevel; l > level; l--)
+        entry = greedyClosest(embeddings, query, entry, l);
+
+    // a row linked again finds itself, one more candidate keeps efConstruction others
+    int ef = m_config.efConstruction + (row == m_entryPoint || !m_links[row][0].empty());
+    std::vector<Candidate> nearest;
+    for (int l = level; l >= 0; l--) {
+        searchLayer(embeddings, query, entry, ef, l, nearest);
+        nearest.erase(std::remove_if(nearest.begin(), nearest.end(), [row](const Candidate& candidate) {
+            return candidate.node == row;
+        }), nearest.end());
+        m_links[row][l].clear();
+        if (nearest.empty())
+            continue;
+        entry = nearest[0].node;
+        selectNeighbors(embeddings, nearest, l == 0 ? 2 * m_config.M : m_config.M);
+        for (const Candidate& neighbor : nearest) {
+            m_links[row][l].push_back(neighbor.node);
+            std::vector<int>& backLinks = m_links[neighbor.node][l];
+            if (std::find(backLinks.begin(), backLinks.end(), row) != backLinks.end())
+                continue;
+            backLinks.push_back(row);
+            pruneLinks(embeddings, neighbor.node, l);
+        }
+    }
+}
+
+/**
+ * Links a row again after its embedding changed, e.g. a centroid that moved with a new exemplar. The row keeps its
+ * level; links of other nodes to it stay, they still lead close to it. Costs about as much as add.
+ * @param embeddings embedding matrix containing the changed row
+ * @param row row of the changed embedding
+ */
+void HnswIndex::update(const float* embeddings, int row) {
+    if (row >= int(m_links.size()) || m_links[row].empty() || m_removed[row])
+        return;
+    this->link(embeddings, row, m_entryPoint, int(m_links[row].size()) - 1);
+}
+
+/**
+ * Marks a row as removed. It is still used to navigate the graph but never returned.
+ */
+void HnswIndex::remove(int row) {
+    if (row < int(m_removed.size()) && !m_removed[row]) {
+        m_removed[row] = 1;
+        m_nmbrRemoved++;
+    }
+}
+
+/**
+ * Number of removed rows still in the graph, build drops them.
+ */
+int HnswIndex::removedCount() const {
+    return m_nmbrRemoved;
+}
+
+void HnswIndex::setEfSearch(int efSearch) {
+    m_config.efSearch = efSearch;
+}
+
+/**
+ * Number of searchable rows.
+ */
+int HnswIndex::size() const {
+    int nmbrNodes = 0;
+    for (const auto& links : m_links)
+        nmbrNodes += !links.empty();
+    return nmbrNodes - m_nmbrRemoved;
+}
+
+/**
+ * Approximate k nearest rows of query.
+ * @param embeddings embedding matrix the graph was built on
+ * @param query dim floats
+ * @param k number of matches, the candidate list holds at least k nodes
+ * @param matches nearest rows sorted by ascending euclidean distance
+ */
+void HnswIndex::search(const float* embeddings, const float* query, int k, std::vector<GalleryMatch>& matches) const {
+    matches.clear();
+    if (m_entryPoint < 0 || k <= 0)
+        return;
+    int entry = m_entryPoint;
+    for (int l = m_maxLevel; l > 0; l--)
+        entry = greedyClosest(embeddings, query, entry, l);
+
+    // removed nodes take up slots in the candidate list, widen it so that k live nodes remain
+    std::vector<Candidate> nearest;
+    searchLayer(embeddings, query, entry, std::max(m_config.efSearch, k) + std::min(m_nmbrRemoved, k), 0, nearest);
+    for (const Candidate& candidate : nearest) {
+        if (m_removed[candidate.node])
+            continue;
+        GalleryMatch match = {candidate.node, std::sqrt(candidate.distance)};
+        matches.push_back(match);
+        if (int(matches.size()) == k)
+            break;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef FACE_RECOGNITION_HNSWINDEX_H
+#define FACE_RECOGNITION_HNSWINDEX_H
+
+#include <random>
+#include <vector>
+
+struct GalleryMatch;
+
+struct HnswConfig {
+    int M = 16;                 // links per node on the upper layers, 2 * M on the bottom layer
+    int efConstruction = 200;   // candidate list size while inserting, higher builds a better graph but slower
+    int efSearch = 64;          // candidate list size while searching, the recall / latency trade-off
+    unsigned seed = 42;         // seed for the level of new nodes, makes builds reproducible
+};
+
+/**
+ * Hierarchical navigable small world graph (Malkov and Yashunin) over the rows of an embedding matrix for approximate
+ * nearest neighbour search. The index only stores the graph, the embeddings are owned by the caller and passed to every
+ * call, so the embedding matrix may grow (and move) between calls. Removed rows stay in the graph as tombstones to keep
+ * it navigable and are skipped in results, build compacts them away.
+ * Every thread marks visited nodes in its own list, so any number of searches may run at the same time, as long as no
+ * thread changes the index meanwhile.
+ */
+class HnswIndex {
+private:
+    int m_dim;
+    HnswConfig m_config;
+    double m_levelFactor;
+    std::mt19937 m_rng;
+    std::vector<std::vector<std::vector<int> > > m_links;  // [node][level] neighbor rows
+    std::vector<char> m_removed;
+    int m_nmbrRemoved = 0;
+    int m_entryPoint = -1;
+    int m_maxLevel = -1;
+
+    struct Candidate {
+        float distance;
+        int node;
+        bool operator<(const Candidate& other) const { return distance < other.distance; }
+        bool operator>(const Candidate& other) const { return distance > other.distance; }
+    };
+    int randomLevel();
+    void link(const float* embeddings, int row, int entry, int level);
+    int greedyClosest(const float* embeddings, const float* query, int entry, int level) const;
+    void searchLayer(const float* embeddings, const float* query, int entry, int ef, int level,
+                     std::vector<Candidate>& nearest) const;
+    void selectNeighbors(const float* embeddings, std::vector<Candidate>& candidates, int maxLinks) const;
+    void pruneLinks(const float* embeddings, int node, int level);
+public:
+    explicit HnswIndex(int dim = 512, const HnswConfig& config = HnswConfig());
+    void build(const float* embeddings, int nmbrEmbeddings, const std::vector<char>& removed);
+    void add(const float* embeddings, int row);
+    void update(const float* embeddings, int row);
+    void remove(int row);
+    int removedCount() const;
+    void setEfSearch(int efSearch);
+    int size() const;
+    void search(const float* embeddings, const float* query, int k, std::vector<GalleryMatch>& matches) const;
+};
+
+
+#endif //FACE_RECOGNITION_HNSWINDEX_H
@@ -0,0 +1,445 @@
+#include "IdentityGallery.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static bool closerMatch(const GalleryMatch& a, const GalleryMatch& b) {
+    return a.distance < b.distance || (a.distance == b.distance && a.index < b.index);
+}
+
+GallerySnapshot::GallerySnapshot(int dim, const IdentityGalleryConfig& config)
+        : m_dim(dim), m_segmentSize(std::max(config.segmentSize, 1)),
+          m_coarseCandidates(std::max(config.coarseCandidates, 1)) {
+}
+
+int GallerySnapshot::dim() const {
+    return m_dim;
+}
+
+/**
+ * Number of exemplar rows, removed ones included.
+ */
+int GallerySnapshot::size() const {
+    return m_nmbrExemplars;
+}
+
+/**
+ * Number of exemplars that were not removed.
+ */
+int GallerySnapshot::count() const {
+    return m_nmbrExemplars - m_removedExemplars;
+}
+
+bool GallerySnapshot::isRemoved(int row) const {
+    return m_exemplarSegments[row / m_segmentSize]->embeddings.isRemoved(row % m_segmentSize);
+}
+
+/**
+ * Name of the identity of an exemplar row.
+ */
+const std::string& GallerySnapshot::getClassName(int row) const {
+    return m_exemplarSegments[row / m_segmentSize]->embeddings.getClassName(row % m_segmentSize);
+}
+
+void GallerySnapshot::readEmbedding(int row, float* embedding) const {
+    m_exemplarSegments[row / m_segmentSize]->embeddings.readEmbedding(row % m_segmentSize, embedding);
+}
+
+int GallerySnapshot::getIdentity(int row) const {
+    return m_exemplarSegments[row / m_segmentSize]->identities[row % m_segmentSize];
+}
+
+/**
+ * Number of identity ids handed out, removed identities included. Valid class numbers are below this.
+ */
+int GallerySnapshot::getIdentityCount() const {
+    return m_nmbrIdentities;
+}
+
+/**
+ * Number of identities that were not removed.
+ */
+int GallerySnapshot::countIdentities() const {
+    return m_nmbrIdentities - m_removedIdentities;
+}
+
+bool GallerySnapshot::isIdentityRemoved(int identity) const {
+    return m_identitySegments[identity / m_segmentSize]->centroids.isRemoved(identity % m_segmentSize);
+}
+
+const std::string& GallerySnapshot::getIdentityName(int identity) const {
+    return m_identitySegments[identity / m_segmentSize]->centroids.getClassName(identity % m_segmentSize);
+}
+
+const std::vector<int>& GallerySnapshot::getExemplars(int identity) const {
+    return m_identitySegments[identity / m_segmentSize]->exemplars[identity % m_segmentSize];
+}
+
+void GallerySnapshot::readCentroid(int identity, float* centroid) const {
+    m_identitySegments[identity / m_segmentSize]->centroids.readEmbedding(identity % m_segmentSize, centroid);
+}
+
+/**
+ * Allocated bytes of all exemplar and centroid rows, see EmbeddingGallery::memoryBytes. Segments shared with other
+ * snapshots are counted in full.
+ */
+size_t GallerySnapshot::memoryBytes() const {
+    size_t bytes = 0;
+    for (const auto& segment : m_exemplarSegments)
+        bytes += segment->embeddings.memoryBytes() + segment->identities.capacity() * sizeof(int);
+    for (const auto& segment : m_identitySegments)
+        bytes += segment->centroids.memoryBytes();
+    return bytes;
+}
+
+/**
+ * Finds the k nearest identities of every probe. The centroids of all segments are searched first (blocked exact scan,
+ * or HNSW if enabled) for the coarseCandidates nearest identities, these are re-ranked by the distance of the probe to
+ * their closest exemplar. With compressed centroids the coarse pass is approximate, the re-ranked distances are exact
+ * as long as the exemplars are stored as float.
+ * @param probes nmbrProbes x dim floats, row-major
+ * @param nmbrProbes number of probe embeddings
+ * @param k number of identities per probe, fewer if the gallery has fewer identities
+ * @param matches nearest identities per probe sorted by ascending distance to their closest exemplar, index is the
+ *                identity id
+ */
+void GallerySnapshot::search(const float* probes, int nmbrProbes, int k,
+                             std::vector<std::vector<GalleryMatch> >& matches) const {
+    matches.resize(nmbrProbes);
+    for (auto& probeMatches : matches)
+        probeMatches.clear();
+    if (k <= 0 || countIdentities() == 0)
+        return;
+
+    int nmbrCandidates = std::max(k, m_coarseCandidates);
+    std::vector<std::vector<GalleryMatch> > candidates(nmbrProbes), segmentMatches;
+    for (size_t s = 0; s < m_identitySegments.size(); s++) {
+        const EmbeddingGallery& centroids = m_identitySegments[s]->centroids;
+        if (m_useIndex)
+            centroids.search(probes, nmbrProbes, nmbrCandidates, segmentMatches);
+        else
+            centroids.searchExact(probes, nmbrProbes, nmbrCandidates, segmentMatches);
+        int firstIdentity = int(s) * m_segmentSize;
+        for (int p = 0; p < nmbrProbes; p++) {
+            for (const GalleryMatch& match : segmentMatches[p])
+                candidates[p].push_back({firstIdentity + match.index, match.distance});
+        }
+    }
+
+    for (int p = 0; p < nmbrProbes; p++) {
+        std::vector<GalleryMatch>& probeCandidates = candidates[p];
+        if (probeCandidates.size() > size_t(nmbrCandidates)) {
+            std::nth_element(probeCandidates.begin(), probeCandidates.begin() + nmbrCandidates,
+                             probeCandidates.end(), closerMatch);
+            probeCandidates.resize(nmbrCandidates);
+        }
+        const float* probe = probes + size_t(p) * m_dim;
+        for (const GalleryMatch& candidate : probeCandidates) {
+            float nearest = std::numeric_limits<float>::max();
+            for (int row : this->getExemplars(candidate.index)) {
+                const EmbeddingGallery& exemplars = m_exemplarSegments[row / m_segmentSize]->embeddings;
+                nearest = std::min(nearest, exemplars.squaredDistance(row % m_segmentSize, probe));
+            }
+            if (nearest < std::numeric_limits<float>::max())
+                matches[p].push_back({candidate.index, std::sqrt(nearest)});
+        }
+        std::sort(matches[p].begin(), matches[p].end(), closerMatch);
+        if (matches[p].size() > size_t(k))
+            matches[p].resize(k);
+    }
+}
+
+/**
+ * Creates an empty gallery.
+ * @param dim length of the embeddings, 512 for the FaceNet models
+ * @param config segment size and number of identities re-ranked on their exemplars
+ */
+IdentityGallery::IdentityGallery(int dim, const IdentityGalleryConfig& config)
+        : m_dim(dim), m_config(config) {
+    // rows are mapped to segments by dividing by the segment size, here and in every snapshot
+    m_config.segmentSize = std::max(m_config.segmentSize, 1);
+    m_config.coarseCandidates = std::max(m_config.coarseCandidates, 1);
+    m_snapshot.reset(new GallerySnapshot(dim, m_config));
+}
+
+/**
+ * Current state of the gallery, stays valid and unchanged for as long as the caller holds it. Lock-free.
+ */
+std::shared_ptr<const GallerySnapshot> IdentityGallery::snapshot() const {
+    return std::atomic_load(&m_snapshot);
+}
+
+void IdentityGallery::beginUpdate(Update& update) {
+    // copies the segment pointers only
+    update.next.reset(new GallerySnapshot(*std::atomic_load(&m_snapshot)));
+    update.copiedExemplarSegments.assign(update.next->m_exemplarSegments.size(), 0);
+    update.copiedIdentitySegments.assign(update.next->m_identitySegments.size(), 0);
+    update.changedIdentities.clear();
+}
+
+/**
+ * Segment of an exemplar row that this update may change: copied on first access, appended for a new row.
+ */
+IdentityGallery::ExemplarSegment& IdentityGallery::exemplarSegment(Update& update, int row) {
+    auto& segments = update.next->m_exemplarSegments;
+    size_t s = row / m_config.segmentSize;
+    if (s == segments.size()) {
+        std::shared_ptr<ExemplarSegment> segment(new ExemplarSegment(m_dim, m_config.exemplarStorage));
+        segment->embeddings.reserve(m_config.segmentSize);
+        segments.push_back(segment);
+        update.copiedExemplarSegments.push_back(1);
+    }
+    else if (!update.copiedExemplarSegments[s]) {
+        segments[s] = std::make_shared<ExemplarSegment>(*segments[s]);
+        update.copiedExemplarSegments[s] = 1;
+    }
+    // segments of this update were created above and are not shared with any reader yet
+    return const_cast<ExemplarSegment&>(*segments[s]);
+}
+
+IdentityGallery::IdentitySegment& IdentityGallery::identitySegment(Update& update, int identity) {
+    auto& segments = update.next->m_identitySegments;
+    size_t s = identity / m_config.segmentSize;
+    if (s == segments.size()) {
+        std::shared_ptr<IdentitySegment> segment(new IdentitySegment(m_dim, m_config.centroidStorage));
+        segment->centroids.reserve(m_config.segmentSize);
+        segments.push_back(segment);
+        update.copiedIdentitySegments.push_back(1);
+    }
+    else if (!update.copiedIdentitySegments[s]) {
+        segments[s] = std::make_shared<IdentitySegment>(*segments[s]);
+        update.copiedIdentitySegments[s] = 1;
+    }
+    return const_cast<IdentitySegment&>(*segments[s]);
+}
+
+int IdentityGallery::addExemplar(Update& update, const std::string& name, const float* embedding) {
+    GallerySnapshot& next = *update.next;
+    int identity;
+    auto found = m_identityIds.find(name);
+    if (found == m_identityIds.end()) {
+        identity = next.m_nmbrIdentities++;
+        IdentitySegment& segment = this->identitySegment(update, identity);
+        segment.centroids.add(name, embedding);
+        segment.exemplars.emplace_back();
+        m_identityIds[name] = identity;
+    }
+    else {
+        identity = found->second;
+    }
+    int row = next.m_nmbrExemplars++;
+    ExemplarSegment& segment = this->exemplarSegment(update, row);
+    segment.embeddings.add(name, embedding);
+    segment.identities.push_back(identity);
+    this->identitySegment(update, identity).exemplars[identity % m_config.segmentSize].push_back(row);
+    update.changedIdentities.push_back(identity);
+    return identity;
+}
+
+void IdentityGallery::removeExemplar(Update& update, int row) {
+    GallerySnapshot& next = *update.next;
+    if (row < 0 || row >= next.m_nmbrExemplars || next.isRemoved(row))
+        return;
+    ExemplarSegment& segment = this->exemplarSegment(update, row);
+    segment.embeddings.remove(row % m_config.segmentSize);
+    next.m_removedExemplars++;
+    int identity = segment.identities[row % m_config.segmentSize];
+    std::vector<int>& rows = this->identitySegment(update, identity).exemplars[identity % m_config.segmentSize];
+    rows.erase(std::remove(rows.begin(), rows.end(), row), rows.end());
+    update.changedIdentities.push_back(identity);
+}
+
+/**
+ * Sets the centroid of an identity to the normalized mean of its exemplars, removes the identity without exemplars.
+ */
+void IdentityGallery::updateCentroid(Update& update, int identity) {
+    IdentitySegment& segment = this->identitySegment(update, identity);
+    int local = identity % m_config.segmentSize;
+    const std::vector<int>& rows = segment.exemplars[local];
+    if (rows.empty()) {
+        if (!segment.centroids.isRemoved(local)) {
+            m_identityIds.erase(segment.centroids.getClassName(local));
+            segment.centroids.remove(local);
+            update.next->m_removedIdentities++;
+        }
+        return;
+    }
+    std::vector<float> centroid(m_dim, 0.f), embedding(m_dim);
+    for (int row : rows) {
+        update.next->readEmbedding(row, embedding.data());
+        for (int j = 0; j < m_dim; j++)
+            centroid[j] += embedding[j];
+    }
+    float norm = 0.f;
+    for (int j = 0; j < m_dim; j++)
+        norm += centroid[j] * centroid[j];
+    norm = std::sqrt(norm);
+    if (norm > 0.f) {
+        for (int j = 0; j < m_dim; j++)
+            centroid[j] /= norm;
+    }
+    segment.centroids.update(local, centroid.data());
+}
+
+/**
+ * Updates the centroids of all identities the update changed, builds the HNSW index of new or mostly removed identity
+ * segments and makes the new snapshot visible to readers.
+ */
+void IdentityGallery::publish(Update& update) {
+    std::vector<int>& changed = update.changedIdentities;
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    for (int identity : changed)
+        this->updateCentroid(update, identity);
+    if (update.next->m_useIndex) {
+        // the copied indices already hold the added and moved centroids, they are only built for new segments and
+        // once removed identities make up a quarter of a graph
+        for (size_t s = 0; s < update.copiedIdentitySegments.size(); s++) {
+            if (!update.copiedIdentitySegments[s])
+                continue;
+            EmbeddingGallery& centroids = this->identitySegment(update, int(s) * m_config.segmentSize).centroids;
+            if (!centroids.isIndexEnabled() || 4 * centroids.getIndexTombstones() > centroids.size())
+                centroids.enableIndex(m_indexConfig);
+        }
+    }
+    std::atomic_store(&m_snapshot, std::shared_ptr<const GallerySnapshot>(update.next));
+    update.next.reset();
+}
+
+/**
+ * Adds one enrolment embedding to the identity name, the identity is created if there is none of that name.
+ * @return identity id, the class number of the identity
+ */
+int IdentityGallery::addExemplar(const std::string& name, const float* embedding) {
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    Update update;
+    this->beginUpdate(update);
+    int identity = this->addExemplar(update, name, embedding);
+    this->publish(update);
+    return identity;
+}
+
+/**
+ * Adds many exemplars as one update, e.g. at enrolment: every segment is copied at most once and readers see either
+ * none or all of them.
+ * @param names identity of every embedding
+ * @param embeddings names.size() x dim floats, row-major
+ */
+void IdentityGallery::addExemplars(const std::vector<std::string>& names, const float* embeddings) {
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    Update update;
+    this->beginUpdate(update);
+    for (size_t i = 0; i < names.size(); i++)
+        this->addExemplar(update, names[i], embeddings + i * m_dim);
+    this->publish(update);
+}
+
+/**
+ * Removes one exemplar row, its identity is removed with its last exemplar.
+ */
+void IdentityGallery::removeExemplar(int row) {
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    Update update;
+    this->beginUpdate(update);
+    this->removeExemplar(update, row);
+    this->publish(update);
+}
+
+/**
+ * Removes an identity with all its exemplars. Its id is not reused, enrolling the name again creates a new identity.
+ */
+void IdentityGallery::removeIdentity(int identity) {
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    Update update;
+    this->beginUpdate(update);
+    if (identity >= 0 && identity < update.next->m_nmbrIdentities) {
+        std::vector<int> rows = update.next->getExemplars(identity);
+        for (int row : rows)
+            this->removeExemplar(update, row);
+    }
+    this->publish(update);
+}
+
+/**
+ * @return id of the identity of that name, -1 if there is none
+ */
+int IdentityGallery::findIdentity(const std::string& name) {
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    auto found = m_identityIds.find(name);
+    return found == m_identityIds.end() ? -1 : found->second;
+}
+
+void IdentityGallery::clear() {
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    std::shared_ptr<GallerySnapshot> empty(new GallerySnapshot(m_dim, m_config));
+    empty->m_useIndex = std::atomic_load(&m_snapshot)->m_useIndex;
+    m_identityIds.clear();
+    std::atomic_store(&m_snapshot, std::shared_ptr<const GallerySnapshot>(empty));
+}
+
+/**
+ * Searches the centroids of every segment through an HNSW index. Updates insert new centroids into the index of their
+ * segment and link moved ones again, a segment is only built again once a quarter of its identities were removed.
+ * @param config graph degree and candidate list sizes, see HnswConfig
+ */
+void IdentityGallery::enableIndex(const HnswConfig& config) {
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    m_indexConfig = config;
+    Update update;
+    this->beginUpdate(update);
+    update.next->m_useIndex = true;
+    for (size_t s = 0; s < update.next->m_identitySegments.size(); s++)
+        this->identitySegment(update, int(s) * m_config.segmentSize);
+    this->publish(update);
+}
+
+/**
+ * Copies all rows into the given storage types, e.g. int8 centroids and float exemplars for a large gallery on a
+ * device with little memory. Centroids are computed again from the exemplars. Rows added later use the new types.
+ */
+void IdentityGallery::setStorage(GalleryStorage centroidStorage, GalleryStorage exemplarStorage) {
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    m_config.centroidStorage = centroidStorage;
+    m_config.exemplarStorage = exemplarStorage;
+    Update update;
+    this->beginUpdate(update);
+    GallerySnapshot& next = *update.next;
+    std::vector<float> embedding(m_dim);
+    for (auto& segment : next.m_exemplarSegments) {
+        std::shared_ptr<ExemplarSegment> converted(new ExemplarSegment(m_dim, exemplarStorage));
+        const EmbeddingGallery& rows = segment->embeddings;
+        converted->embeddings.reserve(m_config.segmentSize);
+        for (int i = 0; i < rows.size(); i++) {
+            rows.readEmbedding(i, embedding.data());
+            converted->embeddings.add(rows.getClassName(i), embedding.data());
+            if (rows.isRemoved(i))
+                converted->embeddings.remove(i);
+        }
+        converted->identities = segment->identities;
+        segment = converted;
+    }
+    for (auto& segment : next.m_identitySegments) {
+        std::shared_ptr<IdentitySegment> converted(new IdentitySegment(m_dim, centroidStorage));
+        const EmbeddingGallery& centroids = segment->centroids;
+        converted->centroids.reserve(m_config.segmentSize);
+        for (int i = 0; i < centroids.size(); i++) {
+            // overwritten by publish unless removed
+            converted->centroids.add(centroids.getClassName(i), embedding.data());
+            if (centroids.isRemoved(i))
+                converted->centroids.remove(i);
+        }
+        converted->exemplars = segment->exemplars;
+        segment = converted;
+    }
+    update.copiedExemplarSegments.assign(next.m_exemplarSegments.size(), 1);
+    update.copiedIdentitySegments.assign(next.m_identitySegments.size(), 1);
+    for (int identity = 0; identity < next.m_nmbrIdentities; identity++) {
+        if (!next.isIdentityRemoved(identity))
+            update.changedIdentities.push_back(identity);
+    }
+    this->publish(update);
+}
+
+int IdentityGallery::dim() const {
+    return m_dim;
+}
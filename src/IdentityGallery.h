@@ -0,0 +1,120 @@
+#ifndef FACE_RECOGNITION_IDENTITYGALLERY_H
+#define FACE_RECOGNITION_IDENTITYGALLERY_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "EmbeddingGallery.h"
+
+struct IdentityGalleryConfig {
+    int segmentSize = 4096;     // rows per copy-on-write segment, an update copies at most a few segments
+    int coarseCandidates = 16;  // nearest centroids whose exemplars are compared, at least k
+    // fp16 or int8 centroids shrink the scanned rows, float exemplars keep the re-ranked distances exact
+    GalleryStorage centroidStorage = GALLERY_FLOAT32;
+    GalleryStorage exemplarStorage = GALLERY_FLOAT32;
+};
+
+/**
+ * Immutable state of an IdentityGallery. Exemplars (one embedding per enrolment image) and identities (one centroid
+ * per person) are stored in fixed-size segments. Exemplar rows and identity ids are numbered in the order they were
+ * added and never change; removed ones stay as tombstones. Identity ids are the class numbers of the classifier.
+ * Segments are shared between consecutive snapshots, an update only copies the segments it changes.
+ */
+class GallerySnapshot {
+private:
+    friend class IdentityGallery;
+
+    struct ExemplarSegment {
+        EmbeddingGallery embeddings;    // class name of every row is the name of its identity
+        std::vector<int> identities;    // identity id of every row
+        ExemplarSegment(int dim, GalleryStorage storage) : embeddings(dim, storage) {}
+    };
+    struct IdentitySegment {
+        EmbeddingGallery centroids;     // normalized mean of the exemplars, class name is the identity name
+        std::vector<std::vector<int> > exemplars;   // exemplar rows of every identity, empty once removed
+        IdentitySegment(int dim, GalleryStorage storage) : centroids(dim, storage) {}
+    };
+
+    int m_dim;
+    int m_segmentSize;
+    int m_coarseCandidates;
+    bool m_useIndex = false;
+    std::vector<std::shared_ptr<const ExemplarSegment> > m_exemplarSegments;
+    std::vector<std::shared_ptr<const IdentitySegment> > m_identitySegments;
+    int m_nmbrExemplars = 0;
+    int m_nmbrIdentities = 0;
+    int m_removedExemplars = 0;
+    int m_removedIdentities = 0;
+
+    GallerySnapshot(int dim, const IdentityGalleryConfig& config);
+public:
+    int dim() const;
+    int size() const;
+    int count() const;
+    bool isRemoved(int row) const;
+    const std::string& getClassName(int row) const;
+    void readEmbedding(int row, float* embedding) const;
+    int getIdentity(int row) const;
+    int getIdentityCount() const;
+    int countIdentities() const;
+    bool isIdentityRemoved(int identity) const;
+    const std::string& getIdentityName(int identity) const;
+    const std::vector<int>& getExemplars(int identity) const;
+    void readCentroid(int identity, float* centroid) const;
+    size_t memoryBytes() const;
+    void search(const float* probes, int nmbrProbes, int k, std::vector<std::vector<GalleryMatch> >& matches) const;
+};
+
+/**
+ * Identity-centric gallery: N exemplar embeddings per person plus their centroid. search first compares the probes
+ * with the centroids only, then re-ranks the coarseCandidates nearest identities by the distance to their closest
+ * exemplar, so a person enrolled with 20 photos costs one centroid in the scan and matches as well as the best photo.
+ * Readers take a snapshot and keep using it without any lock while writers add or remove identities and exemplars:
+ * every update builds a new snapshot that shares all untouched segments with the old one and publishes it atomically
+ * (read-copy-update). Old snapshots are freed when their last reader drops them. Writers are serialized.
+ */
+class IdentityGallery {
+private:
+    typedef GallerySnapshot::ExemplarSegment ExemplarSegment;
+    typedef GallerySnapshot::IdentitySegment IdentitySegment;
+
+    int m_dim;
+    IdentityGalleryConfig m_config;
+    HnswConfig m_indexConfig;
+    std::shared_ptr<const GallerySnapshot> m_snapshot;  // only accessed through std::atomic_load / atomic_store
+    std::mutex m_writeMutex;
+    std::map<std::string, int> m_identityIds;   // identities that were not removed, by name, guarded by m_writeMutex
+
+    // copy-on-write state of the update in progress, guarded by m_writeMutex
+    struct Update {
+        std::shared_ptr<GallerySnapshot> next;
+        std::vector<char> copiedExemplarSegments, copiedIdentitySegments;
+        std::vector<int> changedIdentities;
+    };
+    void beginUpdate(Update& update);
+    ExemplarSegment& exemplarSegment(Update& update, int row);
+    IdentitySegment& identitySegment(Update& update, int identity);
+    int addExemplar(Update& update, const std::string& name, const float* embedding);
+    void removeExemplar(Update& update, int row);
+    void updateCentroid(Update& update, int identity);
+    void publish(Update& update);
+public:
+    explicit IdentityGallery(int dim = 512, const IdentityGalleryConfig& config = IdentityGalleryConfig());
+    IdentityGallery(const IdentityGallery&) = delete;
+    IdentityGallery& operator=(const IdentityGallery&) = delete;
+    std::shared_ptr<const GallerySnapshot> snapshot() const;
+    int addExemplar(const std::string& name, const float* embedding);
+    void addExemplars(const std::vector<std::string>& names, const float* embeddings);
+    void removeExemplar(int row);
+    void removeIdentity(int identity);
+    int findIdentity(const std::string& name);
+    void clear();
+    void enableIndex(const HnswConfig& config);
+    void setStorage(GalleryStorage centroidStorage, GalleryStorage exemplarStorage);
+    int dim() const;
+};
+
+
+#endif //FACE_RECOGNITION_IDENTITYGALLERY_H
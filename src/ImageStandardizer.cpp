@@ -0,0 +1,179 @@
+#include "ImageStandardizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <opencv2/imgproc.hpp>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Sums all bytes of a row and their squares. The vector paths use sad_epu8 for the sum and madd_epi16 for the
+ * squares, the 32 bit square accumulators cannot overflow for rows shorter than 128k bytes.
+ */
+static void sumRow(const unsigned char* row, int length, uint64_t& sum, uint64_t& sumSq) {
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i vSum = _mm256_setzero_si256();
+    __m256i vSumSq = _mm256_setzero_si256();
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+        vSum = _mm256_add_epi64(vSum, _mm256_sad_epu8(v, zero));
+        __m256i lo = _mm256_unpacklo_epi8(v, zero);
+        __m256i hi = _mm256_unpackhi_epi8(v, zero);
+        vSumSq = _mm256_add_epi32(vSumSq, _mm256_madd_epi16(lo, lo));
+        vSumSq = _mm256_add_epi32(vSumSq, _mm256_madd_epi16(hi, hi));
+    }
+    alignas(32) uint64_t sums[4];
+    alignas(32) uint32_t sumsSq[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(sums), vSum);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(sumsSq), vSumSq);
+    for (int k = 0; k < 4; k++) sum += sums[k];
+    for (int k = 0; k < 8; k++) sumSq += sumsSq[k];
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i vSum = _mm_setzero_si128();
+    __m128i vSumSq = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        vSum = _mm_add_epi64(vSum, _mm_sad_epu8(v, zero));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        vSumSq = _mm_add_epi32(vSumSq, _mm_madd_epi16(lo, lo));
+        vSumSq = _mm_add_epi32(vSumSq, _mm_madd_epi16(hi, hi));
+    }
+    alignas(16) uint64_t sums[2];
+    alignas(16) uint32_t sumsSq[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(sums), vSum);
+    _mm_store_si128(reinterpret_cast<__m128i*>(sumsSq), vSumSq);
+    sum += sums[0] + sums[1];
+    for (int k = 0; k < 4; k++) sumSq += sumsSq[k];
+#endif
+    uint32_t tailSum = 0, tailSumSq = 0;
+    for (; i < length; i++) {
+        uint32_t v = row[i];
+        tailSum += v;
+        tailSumSq += v * v;
+    }
+    sum += tailSum;
+    sumSq += tailSumSq;
+}
+
+/**
+ * Mean and variance of an 8-bit image, accumulated exactly in integers, mapped to a 256 entry lookup table of the
+ * standardized values.
+ */
+static void standardizationTable(const unsigned char* src, size_t srcStep, int rows, int cols, float* lut) {
+    int rowLength = cols * 3;
+    uint64_t sum = 0, sumSq = 0;
+    for (int y = 0; y < rows; y++)
+        sumRow(src + y * srcStep, rowLength, sum, sumSq);
+
+    double count = double(rows) * rowLength;
+    double mean = sum / count;
+    double variance = sumSq / count - mean * mean;
+    double stddev = std::sqrt(std::max(variance, 0.));
+    // same lower bound as facenet's prewhiten, only matters for constant images
+    stddev = std::max(stddev, 1. / std::sqrt(count));
+
+    for (int v = 0; v < 256; v++)
+        lut[v] = float((v - mean) / stddev);
+}
+
+// writes rows [firstRow, lastRow) as RGB floats, one table load per channel
+static void writeStandardizedRows(const unsigned char* src, size_t srcStep, int firstRow, int lastRow, int cols,
+                                  const float* lut, float* dst) {
+    int rowLength = cols * 3;
+    for (int y = firstRow; y < lastRow; y++) {
+        const unsigned char* row = src + y * srcStep;
+        float* out = dst + size_t(y) * rowLength;
+        for (int x = 0; x < rowLength; x += 3) {
+            out[x] = lut[row[x + 2]];
+            out[x + 1] = lut[row[x + 1]];
+            out[x + 2] = lut[row[x]];
+        }
+    }
+}
+
+/**
+ * Standardizes an 8-bit BGR image into an RGB float buffer. Mean and variance are accumulated exactly in integers,
+ * afterwards every possible pixel value is mapped through a 256 entry lookup table on the stack, so the write pass is
+ * one table load per channel.
+ * @param src first pixel of the image
+ * @param srcStep bytes per row of src
+ * @param rows image height
+ * @param cols image width
+ * @param dst output buffer of rows * cols * 3 floats in RGB order
+ */
+void standardizeImage(const unsigned char* src, size_t srcStep, int rows, int cols, float* dst) {
+    float lut[256];
+    standardizationTable(src, srcStep, rows, cols, lut);
+    writeStandardizedRows(src, srcStep, 0, rows, cols, lut, dst);
+}
+
+void standardizeFace(const cv::Mat& bgrFace, float* dst) {
+    CV_Assert(bgrFace.type() == CV_8UC3);
+    standardizeImage(bgrFace.ptr<unsigned char>(), bgrFace.step, bgrFace.rows, bgrFace.cols, dst);
+}
+
+/**
+ * Resizes faceRect of frame into the 8-bit faceSize x faceSize image resized. Only the part of faceRect inside the
+ * frame is resized, into the matching part of resized, the rest is black, so faces at the edge need no padded copy.
+ */
+static void cropResize(const cv::Mat& frame, const cv::Rect& faceRect, int faceSize, CropInterpolation interpolation,
+                       cv::Mat& resized) {
+    resized.create(faceSize, faceSize, CV_8UC3);
+    cv::Rect roi = faceRect & cv::Rect(0, 0, frame.cols, frame.rows);
+    if (roi == faceRect) {
+        cv::resize(frame(roi), resized, resized.size(), 0, 0, interpolation);
+        return;
+    }
+    resized.setTo(cv::Scalar::all(0));
+    if (roi.area() == 0)
+        return;
+    double scaleX = double(faceSize) / faceRect.width, scaleY = double(faceSize) / faceRect.height;
+    int left = cvRound((roi.x - faceRect.x) * scaleX), right = cvRound((roi.br().x - faceRect.x) * scaleX);
+    int top = cvRound((roi.y - faceRect.y) * scaleY), bottom = cvRound((roi.br().y - faceRect.y) * scaleY);
+    if (right > left && bottom > top)
+        cv::resize(frame(roi), resized(cv::Rect(left, top, right - left, bottom - top)), cv::Size(right - left,
+                   bottom - top), 0, 0, interpolation);
+}
+
+/**
+ * Fused batch preprocessing: crops every face from its frame, resizes it and writes it standardized (RGB, zero mean,
+ * unit variance) into consecutive slots of dst, without an intermediate crop per face. Faces run in parallel, each
+ * thread resizes into its own reused 8-bit scratch image that stays in cache for the standardization. A single face is
+ * parallelized over rows instead.
+ * @param frames frame of every face, headers of the same frame may repeat
+ * @param faceRects face rectangles, may reach over the frame edges (padded black)
+ * @param firstFace index of the first face to process
+ * @param nmbrFaces number of faces to process
+ * @param faceSize width and height of a network input
+ * @param interpolation CROP_BILINEAR is faster, CROP_CUBIC is what the crops of the enrolment use
+ * @param dst nmbrFaces * faceSize * faceSize * 3 floats
+ */
+void cropStandardizeFaces(const std::vector<cv::Mat>& frames, const std::vector<cv::Rect>& faceRects, int firstFace,
+                          int nmbrFaces, int faceSize, CropInterpolation interpolation, float* dst) {
+    size_t faceLength = size_t(faceSize) * faceSize * 3;
+    if (nmbrFaces == 1) {
+        static thread_local cv::Mat resized;
+        cropResize(frames[firstFace], faceRects[firstFace], faceSize, interpolation, resized);
+        float lut[256];
+        standardizationTable(resized.ptr<unsigned char>(), resized.step, faceSize, faceSize, lut);
+        cv::parallel_for_(cv::Range(0, faceSize), [&](const cv::Range& rows) {
+            writeStandardizedRows(resized.ptr<unsigned char>(), resized.step, rows.start, rows.end, faceSize, lut,
+                                  dst);
+        });
+        return;
+    }
+    cv::parallel_for_(cv::Range(0, nmbrFaces), [&](const cv::Range& faces) {
+        static thread_local cv::Mat resized;
+        for (int i = faces.start; i < faces.end; i++) {
+            cropResize(frames[firstFace + i], faceRects[firstFace + i], faceSize, interpolation, resized);
+            standardizeFace(resized, dst + i * faceLength);
+        }
+    });
+}
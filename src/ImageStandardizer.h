@@ -0,0 +1,31 @@
+#ifndef FACE_RECOGNITION_IMAGESTANDARDIZER_H
+#define FACE_RECOGNITION_IMAGESTANDARDIZER_H
+
+#include <cstddef>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+/**
+ * Fused image standardization for the network input: swaps BGR to RGB, computes mean and standard deviation over all
+ * pixels and channels and writes (pixel - mean) / stddev as float, in one reduction pass and one write pass without
+ * any heap allocation.
+ */
+
+// src points to rows x cols 8-bit BGR pixels with srcStep bytes per row, dst must hold rows * cols * 3 floats
+void standardizeImage(const unsigned char* src, size_t srcStep, int rows, int cols, float* dst);
+
+// bgrFace must be CV_8UC3, it may be a ROI view of a larger frame
+void standardizeFace(const cv::Mat& bgrFace, float* dst);
+
+enum CropInterpolation {
+    CROP_BILINEAR = cv::INTER_LINEAR,
+    CROP_CUBIC = cv::INTER_CUBIC
+};
+
+// crop, resize and standardize of faceRects[firstFace, firstFace + nmbrFaces) in one pass, face i is in frames[i]
+void cropStandardizeFaces(const std::vector<cv::Mat>& frames, const std::vector<cv::Rect>& faceRects, int firstFace,
+                          int nmbrFaces, int faceSize, CropInterpolation interpolation, float* dst);
+
+
+#endif //FACE_RECOGNITION_IMAGESTANDARDIZER_H
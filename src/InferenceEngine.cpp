@@ -0,0 +1,147 @@
+#include "InferenceEngine.h"
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+
+/**
+ * Starts the engine thread.
+ * @param classifier classifier with enrolled gallery, only used by the engine thread from now on
+ * @param config batch size and batching delay
+ */
+InferenceEngine::InferenceEngine(FaceNetClassifier& classifier, const EngineConfig& config)
+        : m_classifier(classifier), m_config(config) {
+    m_config.maxBatchSize = std::max(1, m_config.maxBatchSize);
+    m_classifier.setMaxBatchSize(m_config.maxBatchSize);
+    // only the buckets above the previous maximum batch size run
+    m_classifier.warmUp();
+    m_thread = std::thread(&InferenceEngine::run, this);
+}
+
+InferenceEngine::~InferenceEngine() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_requestReady.notify_all();
+    m_thread.join();
+}
+
+/**
+ * Embeds the faces of one frame and matches them against the gallery. Blocks until the batch containing them ran, so
+ * every stream calls this from its own thread.
+ * @param frame current frame of the stream, it must stay unchanged until recognize returns
+ * @param faceRects faces in frame, cropped by the engine straight into its input tensor
+ * @param embeddings one embedding per row, empty if the session run failed
+ * @param classNumbers class number of the nearest known face per embedding, -1 if unknown
+ * @param distances distance to the nearest known face per embedding
+ */
+void InferenceEngine::recognize(const cv::Mat& frame, const std::vector<cv::Rect>& faceRects, cv::Mat& embeddings,
+                                std::vector<int>& classNumbers, std::vector<float>& distances) {
+    embeddings.release();
+    classNumbers.clear();
+    distances.clear();
+    if (faceRects.empty())
+        return;
+    Request request;
+    request.frame = &frame;
+    request.faceRects = &faceRects;
+    request.embeddings = &embeddings;
+    request.classNumbers = &classNumbers;
+    request.distances = &distances;
+    request.arrival = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_requests.push_back(&request);
+    m_queuedFaces += faceRects.size();
+    m_requestReady.notify_one();
+    m_requestDone.wait(lock, [&]() { return request.done; });
+}
+
+void InferenceEngine::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_requestReady.wait(lock, [&]() { return m_stop || !m_requests.empty(); });
+        if (m_stop && m_requests.empty())
+            return;
+        // wait for more faces until the batch is full or the first request waited long enough
+        auto deadline = m_requests.front()->arrival + std::chrono::microseconds(m_config.maxWaitMicros);
+        m_requestReady.wait_until(lock, deadline, [&]() {
+            return m_stop || m_queuedFaces >= m_config.maxBatchSize;
+        });
+
+        // take whole requests, a request larger than a batch is embedded in several session runs
+        int nmbrFaces = 0;
+        while (!m_requests.empty()) {
+            Request* request = m_requests.front();
+            int requestFaces = request->faceRects->size();
+            if (nmbrFaces > 0 && nmbrFaces + requestFaces > m_config.maxBatchSize)
+                break;
+            m_requests.pop_front();
+            m_batchRequests.push_back(request);
+            nmbrFaces += requestFaces;
+        }
+        m_queuedFaces -= nmbrFaces;
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        this->runBatch();
+        double micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+
+        lock.lock();
+        for (Request* request : m_batchRequests)
+            request->done = true;
+        m_batchRequests.clear();
+        m_batches++;
+        m_faces += nmbrFaces;
+        m_fullBatches += nmbrFaces >= m_config.maxBatchSize;
+        m_totalMicros += micros;
+        m_requestDone.notify_all();
+    }
+}
+
+/**
+ * Runs the session on the faces of all requests of the current batch and copies every request its rows back. The faces
+ * of all frames are cropped into the input tensor in one parallel pass.
+ */
+void InferenceEngine::runBatch() {
+    m_batchFrames.clear();
+    m_batchRects.clear();
+    for (Request* request : m_batchRequests) {
+        m_batchFrames.insert(m_batchFrames.end(), request->faceRects->size(), *request->frame);
+        m_batchRects.insert(m_batchRects.end(), request->faceRects->begin(), request->faceRects->end());
+    }
+    m_classifier.embed(m_batchFrames, m_batchRects, m_embeddings);
+    m_batchFrames.clear();
+    // a failed session run returns fewer rows, the faces of this batch stay unknown
+    if (m_embeddings.rows != m_batchRects.size())
+        return;
+    m_classifier.classify(m_embeddings, m_classNumbers, m_distances);
+
+    int firstFace = 0;
+    for (Request* request : m_batchRequests) {
+        int requestFaces = request->faceRects->size();
+        m_embeddings.rowRange(firstFace, firstFace + requestFaces).copyTo(*request->embeddings);
+        request->classNumbers->assign(m_classNumbers.begin() + firstFace,
+                                      m_classNumbers.begin() + firstFace + requestFaces);
+        request->distances->assign(m_distances.begin() + firstFace, m_distances.begin() + firstFace + requestFaces);
+        firstFace += requestFaces;
+    }
+}
+
+FaceNetClassifier& InferenceEngine::getClassifier() {
+    return m_classifier;
+}
+
+/**
+ * Prints the number of session runs, the mean batch size, how many batches were full and the mean run time.
+ */
+void InferenceEngine::printReport(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    double batches = std::max<long>(m_batches, 1);
+    out << std::fixed << std::setprecision(2);
+    out << "inference engine: " << m_batches << " batches, " << m_faces << " faces, mean batch size " <<
+        m_faces / batches << ", " << 100. * m_fullBatches / batches << "% full, mean run " <<
+        m_totalMicros / batches / 1000. << " ms" << std::endl;
+    out.unsetf(std::ios::floatfield);
+}
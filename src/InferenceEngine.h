@@ -0,0 +1,73 @@
+#ifndef FACE_RECOGNITION_INFERENCEENGINE_H
+#define FACE_RECOGNITION_INFERENCEENGINE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "FaceNet.h"
+
+struct EngineConfig {
+    int maxBatchSize = 16;      // faces per session run, collected from all streams
+    int maxWaitMicros = 2000;   // longest time the first queued face waits for the batch to fill up
+};
+
+/**
+ * Shares one FaceNetClassifier, i.e. one TensorFlow session, one graph and one gallery, between many streams. Any
+ * number of threads call recognize, the engine thread collects their faces into dynamic batches: a batch runs as soon
+ * as it holds maxBatchSize faces or maxWaitMicros after its first request arrived, whichever comes first. The
+ * embeddings and matches of every request are handed back to its caller. The classifier must not be used by other
+ * threads while the engine runs.
+ */
+class InferenceEngine {
+private:
+    struct Request {
+        const cv::Mat* frame;
+        const std::vector<cv::Rect>* faceRects;
+        cv::Mat* embeddings;
+        std::vector<int>* classNumbers;
+        std::vector<float>* distances;
+        std::chrono::steady_clock::time_point arrival;
+        bool done = false;
+    };
+
+    FaceNetClassifier& m_classifier;
+    EngineConfig m_config;
+    std::mutex m_mutex;
+    std::condition_variable m_requestReady, m_requestDone;
+    std::deque<Request*> m_requests;
+    int m_queuedFaces = 0;
+    bool m_stop = false;
+    std::thread m_thread;
+
+    // engine thread only
+    std::vector<cv::Mat> m_batchFrames;    // frame of every face of the batch, headers only
+    std::vector<cv::Rect> m_batchRects;
+    std::vector<Request*> m_batchRequests;
+    cv::Mat m_embeddings;
+    std::vector<int> m_classNumbers;
+    std::vector<float> m_distances;
+
+    // statistics, guarded by m_mutex
+    long m_batches = 0;
+    long m_faces = 0;
+    long m_fullBatches = 0;
+    double m_totalMicros = 0.;
+
+    void run();
+    void runBatch();
+public:
+    InferenceEngine(FaceNetClassifier& classifier, const EngineConfig& config = EngineConfig());
+    ~InferenceEngine();
+    void recognize(const cv::Mat& frame, const std::vector<cv::Rect>& faceRects, cv::Mat& embeddings,
+                   std::vector<int>& classNumbers, std::vector<float>& distances);
+    FaceNetClassifier& getClassifier();
+    void printReport(std::ostream& out);
+};
+
+
+#endif //FACE_RECOGNITION_INFERENCEENGINE_H
@@ -0,0 +1,370 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// values below 8 have a bucket each, above that 8 buckets per power of two up to 2^63
+static const int nmbrBuckets = 62 * 8;
+
+static int bucketIndex(uint64_t value) {
+    if (value < 8)
+        return int(value);
+    int msb = 63 - __builtin_clzll(value);
+    return (msb - 2) * 8 + int((value >> (msb - 3)) & 7);
+}
+
+// midpoint of the values falling into bucket
+static double bucketValue(int bucket) {
+    if (bucket < 8)
+        return bucket;
+    int msb = bucket / 8 + 2;
+    double width = double(uint64_t(1) << (msb - 3));
+    return (8 + bucket % 8) * width + (width - 1.) / 2.;
+}
+
+struct Histogram {
+    std::atomic<uint64_t> buckets[nmbrBuckets];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+
+    Histogram() {
+        this->clear();
+    }
+    // only the owning thread writes, so plain loads and stores suffice and no locked instruction is needed
+    static void increment(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+    void add(uint64_t value) {
+        increment(buckets[bucketIndex(value)], 1);
+        increment(count, 1);
+        increment(sum, value);
+        if (value > max.load(std::memory_order_relaxed))
+            max.store(value, std::memory_order_relaxed);
+    }
+    void clear() {
+        for (auto& bucket : buckets)
+            bucket.store(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+};
+
+// histograms of one thread, allocated separately per thread, so threads do not write to the same cache lines
+struct ThreadHistograms {
+    Histogram stages[NMBR_PROFILE_STAGES];
+    Histogram counters[NMBR_PROFILE_COUNTERS];
+};
+
+// histograms of all threads. They stay registered after their thread ended so that no sample is lost, and are handed
+// to the next thread that starts recording, so a server starting a thread per connection does not grow the registry.
+static std::mutex registryMutex;
+static std::vector<std::unique_ptr<ThreadHistograms> >& registry() {
+    static std::vector<std::unique_ptr<ThreadHistograms> > histograms;
+    return histograms;
+}
+static std::vector<ThreadHistograms*>& unusedHistograms() {
+    static std::vector<ThreadHistograms*> histograms;
+    return histograms;
+}
+
+// the histograms a thread records into, returned to the unused ones when the thread exits
+struct ThreadHistogramsLease {
+    ThreadHistograms* histograms = nullptr;
+    ~ThreadHistogramsLease() {
+        if (!histograms)
+            return;
+        std::lock_guard<std::mutex> lock(registryMutex);
+        unusedHistograms().push_back(histograms);
+    }
+};
+
+static ThreadHistograms& threadHistograms() {
+    static thread_local ThreadHistogramsLease lease;
+    if (!lease.histograms) {
+        // the mutex orders the writes of the previous owner before ours
+        std::lock_guard<std::mutex> lock(registryMutex);
+        if (!unusedHistograms().empty()) {
+            lease.histograms = unusedHistograms().back();
+            unusedHistograms().pop_back();
+        }
+        else {
+            registry().emplace_back(new ThreadHistograms());
+            lease.histograms = registry().back().get();
+        }
+    }
+    return *lease.histograms;
+}
+
+// sums the histograms of one stage or counter over all threads
+template <typename Select>
+static void summarize(Select select, ProfileSummary& summary) {
+    std::vector<uint64_t> buckets(nmbrBuckets, 0);
+    uint64_t count = 0, sum = 0, max = 0;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (const auto& histograms : registry()) {
+            const Histogram& histogram = select(*histograms);
+            for (int b = 0; b < nmbrBuckets; b++)
+                buckets[b] += histogram.buckets[b].load(std::memory_order_relaxed);
+            count += histogram.count.load(std::memory_order_relaxed);
+            sum += histogram.sum.load(std::memory_order_relaxed);
+            max = std::max(max, histogram.max.load(std::memory_order_relaxed));
+        }
+    }
+    summary = ProfileSummary();
+    summary.count = count;
+    summary.sum = double(sum);
+    summary.max = double(max);
+    if (count == 0)
+        return;
+    summary.mean = summary.sum / count;
+    double quantiles[3] = {0.5, 0.95, 0.99};
+    double* results[3] = {&summary.p50, &summary.p95, &summary.p99};
+    // the bucket counts may be read slightly after count, so the rank is taken from their own total
+    uint64_t total = 0;
+    for (uint64_t bucket : buckets)
+        total += bucket;
+    if (total == 0)
+        return;
+    for (int q = 0; q < 3; q++) {
+        uint64_t rank = uint64_t(quantiles[q] * (total - 1)) + 1, seen = 0;
+        for (int b = 0; b < nmbrBuckets; b++) {
+            seen += buckets[b];
+            if (seen >= rank) {
+                *results[q] = std::min(bucketValue(b), summary.max);
+                break;
+            }
+        }
+    }
+}
+
+std::atomic<bool> Profiler::s_enabled(false);
+
+void Profiler::setEnabled(bool enabled) {
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+/**
+ * Adds one duration of stage to the histograms of the calling thread, usually through a ScopedTimer.
+ * @param stage profiled stage
+ * @param nanos duration in nanoseconds
+ */
+void Profiler::record(ProfileStage stage, int64_t nanos) {
+    threadHistograms().stages[stage].add(uint64_t(std::max<int64_t>(nanos, 0)));
+}
+
+/**
+ * Adds one value of a counter, e.g. the number of faces of a frame. Ignored while the profiler is disabled.
+ */
+void Profiler::count(ProfileCounter counter, int64_t value) {
+    if (!isEnabled())
+        return;
+    threadHistograms().counters[counter].add(uint64_t(std::max<int64_t>(value, 0)));
+}
+
+/**
+ * Clears all histograms. A sample recorded concurrently may survive the reset or undo it for its histogram, so reset
+ * between runs.
+ */
+void Profiler::reset() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (auto& histograms : registry()) {
+        for (auto& histogram : histograms->stages)
+            histogram.clear();
+        for (auto& histogram : histograms->counters)
+            histogram.clear();
+    }
+}
+
+/**
+ * Number of per-thread histogram sets, at most the number of threads that recorded at the same time.
+ */
+size_t Profiler::getHistogramSets() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    return registry().size();
+}
+
+void Profiler::getStageSummary(ProfileStage stage, ProfileSummary& summary) {
+    summarize([stage](const ThreadHistograms& histograms) -> const Histogram& {
+        return histograms.stages[stage];
+    }, summary);
+}
+
+void Profiler::getCounterSummary(ProfileCounter counter, ProfileSummary& summary) {
+    summarize([counter](const ThreadHistograms& histograms) -> const Histogram& {
+        return histograms.counters[counter];
+    }, summary);
+}
+
+const char* Profiler::getStageName(ProfileStage stage) {
+    static const char* names[NMBR_PROFILE_STAGES] = {"capture", "upload", "detect", "crop", "preprocess", "tensor",
+                                                     "session_run", "match", "display"};
+    return names[stage];
+}
+
+const char* Profiler::getCounterName(ProfileCounter counter) {
+    static const char* names[NMBR_PROFILE_COUNTERS] = {"faces_per_frame", "batch_size"};
+    return names[counter];
+}
+
+/**
+ * Writes all stages and counters in the Prometheus text exposition format: one summary per stage in seconds with the
+ * 0.5, 0.95 and 0.99 quantiles, a gauge with the maximum, and one summary per counter.
+ */
+void Profiler::writePrometheus(std::ostream& out) {
+    const char* quantiles[3] = {"0.5", "0.95", "0.99"};
+    ProfileSummary summary;
+    out << std::setprecision(9);
+    out << "# HELP facenet_stage_seconds Latency of the recognition stages.\n";
+    out << "# TYPE facenet_stage_seconds summary\n";
+    for (int s = 0; s < NMBR_PROFILE_STAGES; s++) {
+        getStageSummary(ProfileStage(s), summary);
+        const char* name = getStageName(ProfileStage(s));
+        double values[3] = {summary.p50, summary.p95, summary.p99};
+        for (int q = 0; q < 3; q++)
+            out << "facenet_stage_seconds{stage=\"" << name << "\",quantile=\"" << quantiles[q] << "\"} " <<
+                values[q] * 1e-9 << "\n";
+        out << "facenet_stage_seconds_sum{stage=\"" << name << "\"} " << summary.sum * 1e-9 << "\n";
+        out << "facenet_stage_seconds_count{stage=\"" << name << "\"} " << summary.count << "\n";
+    }
+    out << "# HELP facenet_stage_max_seconds Longest run of the recognition stages.\n";
+    out << "# TYPE facenet_stage_max_seconds gauge\n";
+    for (int s = 0; s < NMBR_PROFILE_STAGES; s++) {
+        getStageSummary(ProfileStage(s), summary);
+        out << "facenet_stage_max_seconds{stage=\"" << getStageName(ProfileStage(s)) << "\"} " << summary.max * 1e-9 <<
+            "\n";
+    }
+    for (int c = 0; c < NMBR_PROFILE_COUNTERS; c++) {
+        getCounterSummary(ProfileCounter(c), summary);
+        std::string name = std::string("facenet_") + getCounterName(ProfileCounter(c));
+        double values[3] = {summary.p50, summary.p95, summary.p99};
+        out << "# TYPE " << name << " summary\n";
+        for (int q = 0; q < 3; q++)
+            out << name << "{quantile=\"" << quantiles[q] << "\"} " << values[q] << "\n";
+        out << name << "_sum " << summary.sum << "\n";
+        out << name << "_count " << summary.count << "\n";
+    }
+}
+
+static void writeJsonSummary(std::ostream& out, const char* name, const ProfileSummary& summary, double scale,
+                             const char* unit) {
+    out << "    \"" << name << "\": {\"count\": " << summary.count << ", \"mean" << unit << "\": " <<
+        summary.mean * scale << ", \"p50" << unit << "\": " << summary.p50 * scale << ", \"p95" << unit << "\": " <<
+        summary.p95 * scale << ", \"p99" << unit << "\": " << summary.p99 * scale << ", \"max" << unit << "\": " <<
+        summary.max * scale << "}";
+}
+
+/**
+ * Writes all stages (in milliseconds) and counters as one JSON object.
+ */
+void Profiler::writeJson(std::ostream& out) {
+    ProfileSummary summary;
+    out << std::setprecision(6);
+    out << "{\n  \"enabled\": " << (isEnabled() ? "true" : "false") << ",\n  \"stages\": {\n";
+    for (int s = 0; s < NMBR_PROFILE_STAGES; s++) {
+        getStageSummary(ProfileStage(s), summary);
+        writeJsonSummary(out, getStageName(ProfileStage(s)), summary, 1e-6, "_ms");
+        out << (s + 1 < NMBR_PROFILE_STAGES ? ",\n" : "\n");
+    }
+    out << "  },\n  \"counters\": {\n";
+    for (int c = 0; c < NMBR_PROFILE_COUNTERS; c++) {
+        getCounterSummary(ProfileCounter(c), summary);
+        writeJsonSummary(out, getCounterName(ProfileCounter(c)), summary, 1., "");
+        out << (c + 1 < NMBR_PROFILE_COUNTERS ? ",\n" : "\n");
+    }
+    out << "  }\n}\n";
+}
+
+/**
+ * Writes a snapshot to path, as JSON if path ends with .json and as Prometheus text otherwise. The snapshot is written
+ * to a temporary file first and renamed, so a scraper never reads a partial file.
+ * @return false if the file could not be written
+ */
+bool Profiler::writeFile(const std::string& path) {
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath);
+        if (!file)
+            return false;
+        bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        if (json)
+            writeJson(file);
+        else
+            writePrometheus(file);
+        if (!file)
+            return false;
+    }
+    return std::rename(tempPath.c_str(), path.c_str()) == 0;
+}
+
+// the thread of the periodic dump
+static std::mutex dumpMutex;
+static std::condition_variable dumpWakeUp;
+static std::thread dumpThread;
+static bool dumpStop = false;
+
+/**
+ * Writes a snapshot to path every intervalMillis milliseconds from a background thread, see writeFile, and a last one
+ * in stopPeriodicDump. A dump already running is replaced.
+ */
+void Profiler::startPeriodicDump(const std::string& path, int intervalMillis) {
+    stopPeriodicDump();
+    std::lock_guard<std::mutex> lock(dumpMutex);
+    dumpStop = false;
+    dumpThread = std::thread([path, intervalMillis]() {
+        std::unique_lock<std::mutex> lock(dumpMutex);
+        while (!dumpStop) {
+            dumpWakeUp.wait_for(lock, std::chrono::milliseconds(intervalMillis), []() { return dumpStop; });
+            lock.unlock();
+            if (!writeFile(path))
+                std::cerr << "Unable to write metrics to " << path << std::endl;
+            lock.lock();
+        }
+    });
+}
+
+void Profiler::stopPeriodicDump() {
+    {
+        std::lock_guard<std::mutex> lock(dumpMutex);
+        if (!dumpThread.joinable())
+            return;
+        dumpStop = true;
+    }
+    dumpWakeUp.notify_all();
+    dumpThread.join();
+}
+
+/**
+ * Prints samples, mean, p50, p95, p99 and max per stage in milliseconds and the counters, stages without samples are
+ * skipped.
+ */
+void Profiler::printReport(std::ostream& out) {
+    ProfileSummary summary;
+    out << std::fixed << std::setprecision(2);
+    out << "stage          samples   mean ms    p50 ms    p95 ms    p99 ms    max ms" << std::endl;
+    for (int s = 0; s < NMBR_PROFILE_STAGES; s++) {
+        getStageSummary(ProfileStage(s), summary);
+        if (summary.count == 0)
+            continue;
+        out << std::left << std::setw(12) << getStageName(ProfileStage(s)) << std::right << std::setw(10) <<
+            summary.count << std::setw(10) << summary.mean * 1e-6 << std::setw(10) << summary.p50 * 1e-6 <<
+            std::setw(10) << summary.p95 * 1e-6 << std::setw(10) << summary.p99 * 1e-6 << std::setw(10) <<
+            summary.max * 1e-6 << std::endl;
+    }
+    for (int c = 0; c < NMBR_PROFILE_COUNTERS; c++) {
+        getCounterSummary(ProfileCounter(c), summary);
+        if (summary.count == 0)
+            continue;
+        out << getCounterName(ProfileCounter(c)) << ": mean " << summary.mean << ", p50 " << summary.p50 << ", p95 " <<
+            summary.p95 << ", max " << summary.max << std::endl;
+    }
+    out.unsetf(std::ios::floatfield);
+}
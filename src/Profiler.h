@@ -0,0 +1,95 @@
+#ifndef FACE_RECOGNITION_PROFILER_H
+#define FACE_RECOGNITION_PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+enum ProfileStage {
+    PROFILE_CAPTURE,        // VideoStreamer::getFrame, decoding into a pooled buffer
+    PROFILE_UPLOAD,         // host to GPU copy of the frame, CUDA detector only
+    PROFILE_DETECT,         // face detector
+    PROFILE_CROP,           // crop or alignment of faces into separate images
+    PROFILE_PREPROCESS,     // standardization into the input tensor, fused with crop and resize for live frames
+    PROFILE_TENSOR,         // pooled input tensor lookup and slicing
+    PROFILE_SESSION_RUN,    // session->Run
+    PROFILE_MATCH,          // gallery search
+    PROFILE_DISPLAY,        // drawing and imshow
+    NMBR_PROFILE_STAGES
+};
+
+enum ProfileCounter {
+    PROFILE_FACES_PER_FRAME,
+    PROFILE_BATCH_SIZE,     // faces per session run
+    NMBR_PROFILE_COUNTERS
+};
+
+struct ProfileSummary {
+    uint64_t count = 0;
+    double sum = 0.;    // nanoseconds for stages, values for counters
+    double mean = 0.;
+    double p50 = 0.;
+    double p95 = 0.;
+    double p99 = 0.;
+    double max = 0.;
+};
+
+/**
+ * Process wide, low overhead stage profiler. Every thread records into its own log-linear histograms (8 buckets per
+ * power of two, at most 12.5% relative error) with relaxed atomic stores only the owning thread makes, so recording
+ * takes no lock and no locked instruction, about two clock reads per sample (see bench/profiler_bench). Reading sums
+ * the histograms of all threads that ever recorded, which only happens for reports and dumps. The histograms of an
+ * exited thread keep their samples and are reused by the next thread that records. Disabled by default: a disabled
+ * ScopedTimer is one relaxed load and no clock read. It can be toggled at any time, e.g. from a key press.
+ */
+class Profiler {
+public:
+    static void setEnabled(bool enabled);
+    static bool isEnabled() {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+    static void record(ProfileStage stage, int64_t nanos);
+    static void count(ProfileCounter counter, int64_t value);
+    static void reset();
+    static size_t getHistogramSets();
+    static void getStageSummary(ProfileStage stage, ProfileSummary& summary);
+    static void getCounterSummary(ProfileCounter counter, ProfileSummary& summary);
+    static const char* getStageName(ProfileStage stage);
+    static const char* getCounterName(ProfileCounter counter);
+    static void writePrometheus(std::ostream& out);
+    static void writeJson(std::ostream& out);
+    static bool writeFile(const std::string& path);
+    static void startPeriodicDump(const std::string& path, int intervalMillis);
+    static void stopPeriodicDump();
+    static void printReport(std::ostream& out);
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+/**
+ * Records the time from construction to destruction as one sample of stage, if the profiler was enabled at
+ * construction.
+ */
+class ScopedTimer {
+private:
+    ProfileStage m_stage;
+    bool m_enabled;
+    std::chrono::steady_clock::time_point m_start;
+public:
+    explicit ScopedTimer(ProfileStage stage) : m_stage(stage), m_enabled(Profiler::isEnabled()) {
+        if (m_enabled)
+            m_start = std::chrono::steady_clock::now();
+    }
+    ~ScopedTimer() {
+        if (m_enabled)
+            Profiler::record(m_stage, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - m_start).count());
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+
+#endif //FACE_RECOGNITION_PROFILER_H
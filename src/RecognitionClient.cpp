@@ -0,0 +1,241 @@
+#include "RecognitionClient.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <opencv2/imgproc.hpp>
+
+bool readFully(int fd, void* data, size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = recv(fd, bytes, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool writeFully(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        // a closed peer fails the call instead of killing the process with SIGPIPE
+        ssize_t n = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+RecognitionClient::RecognitionClient() {
+}
+
+RecognitionClient::~RecognitionClient() {
+    this->close();
+    if (m_sharedData) {
+        munmap(m_sharedData, m_sharedSize);
+        shm_unlink(m_sharedName.c_str());
+    }
+}
+
+bool RecognitionClient::connectUnix(const std::string& socketPath) {
+    this->close();
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+        return false;
+    std::strcpy(address.sun_path, socketPath.c_str());
+    m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_fd < 0 || connect(m_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        this->close();
+        return false;
+    }
+    return true;
+}
+
+bool RecognitionClient::connectTcp(int port) {
+    this->close();
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    m_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_fd < 0 || connect(m_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        this->close();
+        return false;
+    }
+    int noDelay = 1;
+    setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return true;
+}
+
+void RecognitionClient::close() {
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+}
+
+bool RecognitionClient::request(RequestType type, uint32_t flags, const void* payload, size_t payloadSize,
+                                RecognitionReply& reply) {
+    if (m_fd < 0)
+        return false;
+    RequestHeader header;
+    header.magic = REQUEST_MAGIC;
+    header.version = PROTOCOL_VERSION;
+    header.type = type;
+    header.flags = flags;
+    header.requestId = m_nextRequestId++;
+    header.payloadSize = payloadSize;
+    if (!writeFully(m_fd, &header, sizeof(header)) || !writeFully(m_fd, payload, payloadSize))
+        return false;
+    return this->readReply(header.requestId, reply);
+}
+
+bool RecognitionClient::readReply(uint32_t requestId, RecognitionReply& reply) {
+    ResponseHeader header;
+    if (!readFully(m_fd, &header, sizeof(header)) || header.magic != RESPONSE_MAGIC || header.requestId != requestId)
+        return false;
+    m_buffer.resize(header.payloadSize);
+    if (!readFully(m_fd, m_buffer.data(), m_buffer.size()))
+        return false;
+    reply.status = header.status;
+    reply.faces.clear();
+    reply.embeddings.release();
+    if (header.status != STATUS_OK || header.nmbrFaces == 0)
+        return true;
+    size_t recordBytes = header.nmbrFaces * sizeof(FaceRecord);
+    if (m_buffer.size() != recordBytes + header.nmbrFaces * header.embeddingDim * sizeof(float))
+        return false;
+    const FaceRecord* records = reinterpret_cast<const FaceRecord*>(m_buffer.data());
+    reply.faces.assign(records, records + header.nmbrFaces);
+    if (header.embeddingDim > 0) {
+        reply.embeddings.create(header.nmbrFaces, header.embeddingDim, CV_32F);
+        std::memcpy(reply.embeddings.ptr<float>(), m_buffer.data() + recordBytes, m_buffer.size() - recordBytes);
+    }
+    return true;
+}
+
+/**
+ * Detects and recognizes the faces of an encoded image, the server decodes it.
+ * @return false if the connection failed, reply.status tells whether the server could answer
+ */
+bool RecognitionClient::recognizeEncoded(const std::vector<unsigned char>& encoded, RecognitionReply& reply,
+                                         bool embeddings) {
+    return this->request(REQUEST_ENCODED_FRAME, embeddings ? FLAG_EMBEDDINGS : 0, encoded.data(), encoded.size(),
+                         reply);
+}
+
+/**
+ * Returns a BGR image living in the shared memory object of this client. Frames decoded or drawn into it are sent
+ * by recognizeFrame without any copy. Valid until the next call with a larger size.
+ */
+cv::Mat RecognitionClient::getSharedFrame(int width, int height) {
+    if (!this->reserveShared(size_t(width) * height * 3))
+        return cv::Mat();
+    return cv::Mat(height, width, CV_8UC3, m_sharedData);
+}
+
+bool RecognitionClient::reserveShared(size_t size) {
+    if (size <= m_sharedSize)
+        return true;
+    // a new object for every size, the server keeps the mapping of a name and would not see it grow
+    static std::atomic<int> s_nmbrObjects(0);
+    std::string name = "/facenet_" + std::to_string(getpid()) + "_" + std::to_string(s_nmbrObjects++);
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return false;
+    void* data = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return false;
+    }
+    if (m_sharedData) {
+        munmap(m_sharedData, m_sharedSize);
+        shm_unlink(m_sharedName.c_str());
+    }
+    m_sharedName = name;
+    m_sharedData = static_cast<unsigned char*>(data);
+    m_sharedSize = size;
+    return true;
+}
+
+/**
+ * Detects and recognizes the faces of a BGR frame passed through shared memory. Frames from getSharedFrame are not
+ * copied at all, any other frame is copied once into the shared object.
+ * @return false if the connection failed, reply.status tells whether the server could answer
+ */
+bool RecognitionClient::recognizeFrame(const cv::Mat& frame, RecognitionReply& reply, bool embeddings) {
+    if (frame.empty() || frame.type() != CV_8UC3)
+        return false;
+    size_t frameBytes = frame.step[0] * frame.rows;
+    const unsigned char* data = frame.data;
+    bool inShared = m_sharedData && data >= m_sharedData && data + frameBytes <= m_sharedData + m_sharedSize;
+    SharedFrame shared;
+    std::memset(&shared, 0, sizeof(shared));
+    if (inShared) {
+        shared.offset = data - m_sharedData;
+        shared.step = frame.step[0];
+    }
+    else {
+        if (!this->reserveShared(size_t(frame.cols) * frame.rows * 3))
+            return false;
+        cv::Mat target(frame.rows, frame.cols, CV_8UC3, m_sharedData);
+        frame.copyTo(target);
+        shared.offset = 0;
+        shared.step = frame.cols * 3;
+    }
+    std::strncpy(shared.name, m_sharedName.c_str(), sizeof(shared.name) - 1);
+    shared.width = frame.cols;
+    shared.height = frame.rows;
+    return this->request(REQUEST_SHARED_FRAME, embeddings ? FLAG_EMBEDDINGS : 0, &shared, sizeof(shared), reply);
+}
+
+/**
+ * Recognizes faces the client already detected and cropped, no detection on the server. Faces of another size than
+ * 160x160 are resized.
+ * @return false if the connection failed, reply.status tells whether the server could answer
+ */
+bool RecognitionClient::recognizeFaces(const std::vector<cv::Mat>& faces, RecognitionReply& reply, bool embeddings) {
+    size_t faceBytes = PROTOCOL_FACE_SIZE * PROTOCOL_FACE_SIZE * 3;
+    m_buffer.resize(faces.size() * faceBytes);
+    for (size_t i = 0; i < faces.size(); i++) {
+        cv::Mat target(PROTOCOL_FACE_SIZE, PROTOCOL_FACE_SIZE, CV_8UC3, m_buffer.data() + i * faceBytes);
+        if (faces[i].size() == target.size())
+            faces[i].copyTo(target);
+        else
+            cv::resize(faces[i], target, target.size());
+    }
+    // request reads m_buffer before readReply reuses it
+    return this->request(REQUEST_FACES, embeddings ? FLAG_EMBEDDINGS : 0, m_buffer.data(), m_buffer.size(), reply);
+}
+
+/**
+ * Looks up the name of a class number of a FaceRecord.
+ */
+bool RecognitionClient::getClassName(int classNumber, std::string& name) {
+    int32_t number = classNumber;
+    RecognitionReply reply;
+    if (!this->request(REQUEST_CLASS_NAME, 0, &number, sizeof(number), reply) || reply.status != STATUS_OK)
+        return false;
+    name.assign(m_buffer.begin(), m_buffer.end());
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef FACE_RECOGNITION_RECOGNITIONCLIENT_H
+#define FACE_RECOGNITION_RECOGNITIONCLIENT_H
+
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "RecognitionProtocol.h"
+
+struct RecognitionReply {
+    uint16_t status = STATUS_OK;    // ResponseStatus, the other fields are empty unless STATUS_OK
+    std::vector<FaceRecord> faces;
+    cv::Mat embeddings;             // one row per face, only if requested
+};
+
+/**
+ * Client of RecognitionServer, one connection with one request in flight. Use a client per thread; the server
+ * batches the requests of all connections. Only links OpenCV core and imgcodecs, not TensorFlow.
+ */
+class RecognitionClient {
+private:
+    int m_fd = -1;
+    uint32_t m_nextRequestId = 0;
+    std::vector<unsigned char> m_buffer;
+
+    // shared memory object of recognizeFrame, created on first use and grown as needed
+    std::string m_sharedName;
+    unsigned char* m_sharedData = nullptr;
+    size_t m_sharedSize = 0;
+
+    bool request(RequestType type, uint32_t flags, const void* payload, size_t payloadSize, RecognitionReply& reply);
+    bool readReply(uint32_t requestId, RecognitionReply& reply);
+    bool reserveShared(size_t size);
+public:
+    RecognitionClient();
+    ~RecognitionClient();
+    RecognitionClient(const RecognitionClient&) = delete;
+    RecognitionClient& operator=(const RecognitionClient&) = delete;
+    bool connectUnix(const std::string& socketPath);
+    bool connectTcp(int port);
+    void close();
+    bool recognizeEncoded(const std::vector<unsigned char>& encoded, RecognitionReply& reply, bool embeddings = false);
+    bool recognizeFrame(const cv::Mat& frame, RecognitionReply& reply, bool embeddings = false);
+    bool recognizeFaces(const std::vector<cv::Mat>& faces, RecognitionReply& reply, bool embeddings = false);
+    cv::Mat getSharedFrame(int width, int height);
+    bool getClassName(int classNumber, std::string& name);
+};
+
+
+#endif //FACE_RECOGNITION_RECOGNITIONCLIENT_H
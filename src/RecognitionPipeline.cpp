@@ -0,0 +1,229 @@
+#include "RecognitionPipeline.h"
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+
+static double microsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void StageStats::addFrame(double micros, size_t occupancy) {
+    frames++;
+    totalMicros += micros;
+    maxMicros = std::max(maxMicros, micros);
+    occupancySum += occupancy;
+    occupancyMax = std::max(occupancyMax, occupancy);
+}
+
+/**
+ * Creates the pipeline, threads are only started by start.
+ * @param classifier classifier with enrolled gallery, used by the detection, embedding and matching threads
+ * @param videoStreamer frame source, read by the capture thread
+ * @param config queue depths and drop policy
+ */
+RecognitionPipeline::RecognitionPipeline(FaceNetClassifier& classifier, VideoStreamer& videoStreamer,
+                                         const PipelineConfig& config)
+        : m_classifier(classifier), m_engine(nullptr), m_extractor(&classifier), m_videoStreamer(videoStreamer),
+          m_config(config),
+          m_captured(config.captureQueueDepth, config.dropOldest),
+          m_detected(config.detectQueueDepth, config.dropOldest),
+          m_embedded(config.embedQueueDepth, false),
+          m_results(config.resultQueueDepth, false),
+          m_stop(false), m_tracker(config.tracker) {
+}
+
+/**
+ * Creates the pipeline of one of many streams sharing an inference engine.
+ * @param engine shared engine, embeds and matches the faces of all streams in common batches
+ * @param videoStreamer frame source of this stream, read by the capture thread
+ * @param detectorConfig backend and parameters of the face detector of this stream
+ * @param config queue depths, drop policy and tracking
+ */
+RecognitionPipeline::RecognitionPipeline(InferenceEngine& engine, VideoStreamer& videoStreamer,
+                                         const DetectorConfig& detectorConfig, const PipelineConfig& config)
+        : m_classifier(engine.getClassifier()), m_engine(&engine),
+          m_ownExtractor(new FaceExtractor(160, 160, detectorConfig)), m_videoStreamer(videoStreamer),
+          m_config(config),
+          m_captured(config.captureQueueDepth, config.dropOldest),
+          m_detected(config.detectQueueDepth, config.dropOldest),
+          m_embedded(config.embedQueueDepth, false),
+          m_results(config.resultQueueDepth, false),
+          m_stop(false), m_tracker(config.tracker) {
+    m_extractor = m_ownExtractor.get();
+}
+
+RecognitionPipeline::~RecognitionPipeline() {
+    this->stop();
+}
+
+void RecognitionPipeline::start() {
+    m_stop = false;
+    // every queue slot and stage may hold a frame, plus the result held and displayed by the caller
+    m_videoStreamer.setFramePoolSize(m_captured.capacity() + m_detected.capacity() + m_embedded.capacity() +
+                                     m_results.capacity() + NMBR_STAGES + 2);
+    m_threads.emplace_back(&RecognitionPipeline::captureLoop, this);
+    m_threads.emplace_back(&RecognitionPipeline::detectLoop, this);
+    m_threads.emplace_back(&RecognitionPipeline::embedLoop, this);
+    m_threads.emplace_back(&RecognitionPipeline::matchLoop, this);
+}
+
+/**
+ * Stops all stages, frames still in the queues are discarded.
+ */
+void RecognitionPipeline::stop() {
+    m_stop = true;
+    for (auto& thread : m_threads)
+        thread.join();
+    m_threads.clear();
+}
+
+void RecognitionPipeline::captureLoop() {
+    long frameNumber = 0;
+    while (!m_stop) {
+        FrameJob job;
+        auto start = std::chrono::steady_clock::now();
+        m_videoStreamer.getFrame(job.result.frame);
+        job.result.captureTime = std::chrono::steady_clock::now();
+        if (job.result.frame.empty()) {
+            job.endOfStream = true;
+            m_captured.push(job, m_stop, true);
+            return;
+        }
+        job.result.frameNumber = frameNumber++;
+        m_stats[STAGE_CAPTURE].addFrame(microsSince(start), 0);
+        m_captured.push(job, m_stop);
+    }
+}
+
+void RecognitionPipeline::detectLoop() {
+    FrameJob job;
+    while (m_captured.pop(job, m_stop)) {
+        if (!job.endOfStream) {
+            size_t occupancy = m_captured.occupancy();
+            auto start = std::chrono::steady_clock::now();
+            // faces are cropped by the embedding stage straight into the input tensor
+            m_extractor->detectFaces(job.result.frame, job.embedRects);
+            m_extractor->clipFaces(job.result.frame, job.embedRects, job.result.faceRects);
+            Profiler::count(PROFILE_FACES_PER_FRAME, job.result.faceRects.size());
+            if (m_config.tracker.enabled) {
+                m_tracker.update(job.result.frameNumber, job.result.faceRects, job.result.trackIds,
+                                 job.needsEmbedding);
+                // keep only the faces that go through the network
+                int kept = 0;
+                for (int i = 0; i < job.embedRects.size(); i++) {
+                    if (job.needsEmbedding[i])
+                        job.embedRects[kept++] = job.embedRects[i];
+                }
+                job.embedRects.resize(kept);
+            }
+            else {
+                job.result.trackIds.assign(job.result.faceRects.size(), -1);
+                job.needsEmbedding.assign(job.result.faceRects.size(), 1);
+            }
+            m_stats[STAGE_DETECT].addFrame(microsSince(start), occupancy);
+        }
+        if (!m_detected.push(job, m_stop, job.endOfStream) || job.endOfStream)
+            return;
+    }
+}
+
+void RecognitionPipeline::embedLoop() {
+    FrameJob job;
+    while (m_detected.pop(job, m_stop)) {
+        if (!job.endOfStream) {
+            size_t occupancy = m_detected.occupancy();
+            auto start = std::chrono::steady_clock::now();
+            if (m_engine)
+                m_engine->recognize(job.result.frame, job.embedRects, job.embeddings, job.classNumbers,
+                                    job.distances);
+            else if (!job.embedRects.empty())
+                m_classifier.embed(job.result.frame, job.embedRects, job.embeddings);
+            job.embedRects.clear();
+            m_stats[STAGE_EMBED].addFrame(microsSince(start), occupancy);
+        }
+        if (!m_embedded.push(job, m_stop, job.endOfStream) || job.endOfStream)
+            return;
+    }
+}
+
+void RecognitionPipeline::matchLoop() {
+    FrameJob job;
+    while (m_embedded.pop(job, m_stop)) {
+        if (!job.endOfStream) {
+            size_t occupancy = m_embedded.occupancy();
+            auto start = std::chrono::steady_clock::now();
+            if (!m_engine)
+                m_classifier.classify(job.embeddings, job.classNumbers, job.distances);
+            int nmbrFaces = job.result.faceRects.size();
+            job.result.classNumbers.assign(nmbrFaces, -1);
+            job.result.distances.assign(nmbrFaces, std::numeric_limits<float>::max());
+            for (int i = 0, embedded = 0; i < nmbrFaces; i++) {
+                int trackId = job.result.trackIds[i];
+                if (job.needsEmbedding[i]) {
+                    // a failed inference leaves fewer embeddings than faces, those faces stay unknown
+                    if (embedded < job.classNumbers.size()) {
+                        job.result.classNumbers[i] = job.classNumbers[embedded];
+                        job.result.distances[i] = job.distances[embedded];
+                        if (trackId >= 0)
+                            m_tracker.setIdentity(trackId, job.classNumbers[embedded], job.distances[embedded]);
+                    }
+                    embedded++;
+                }
+                else {
+                    m_tracker.getIdentity(trackId, job.result.classNumbers[i], job.result.distances[i]);
+                }
+            }
+            m_stats[STAGE_MATCH].addFrame(microsSince(start), occupancy);
+        }
+        if (!m_results.push(job, m_stop, job.endOfStream) || job.endOfStream)
+            return;
+    }
+}
+
+/**
+ * Waits for the next recognized frame.
+ * @param result frame, face rectangles, class numbers and distances
+ * @return false at the end of the stream or after stop
+ */
+bool RecognitionPipeline::getResult(FrameResult& result) {
+    FrameJob job;
+    size_t occupancy = m_results.occupancy();
+    if (!m_results.pop(job, m_stop) || job.endOfStream)
+        return false;
+    result = job.result;
+    m_stats[STAGE_END_TO_END].addFrame(microsSince(result.captureTime), occupancy);
+    return true;
+}
+
+/**
+ * Prints frames, mean and max latency and input queue occupancy per stage, end-to-end is from capture until
+ * getResult. Call after stop or at the end of the stream.
+ */
+void RecognitionPipeline::printReport(std::ostream& out) const {
+    const char* names[NMBR_STAGES] = {"capture", "detect", "embed", "match", "end-to-end"};
+    size_t capacities[NMBR_STAGES] = {0, m_captured.capacity(), m_detected.capacity(), m_embedded.capacity(),
+                                      m_results.capacity()};
+    out << std::fixed << std::setprecision(2);
+    out << "stage       frames   mean ms    max ms   queue mean/max/capacity" << std::endl;
+    for (int s = 0; s < NMBR_STAGES; s++) {
+        const StageStats& stats = m_stats[s];
+        double frames = std::max<long>(stats.frames, 1);
+        out << std::left << std::setw(10) << names[s] << std::right << std::setw(8) << stats.frames <<
+            std::setw(10) << stats.totalMicros / frames / 1000. << std::setw(10) << stats.maxMicros / 1000.;
+        if (capacities[s] > 0)
+            out << "   " << stats.occupancySum / frames << "/" << stats.occupancyMax << "/" << capacities[s];
+        out << std::endl;
+    }
+    if (m_config.tracker.enabled)
+        out << "track cache hit rate: " << 100. * m_tracker.getCacheHitRate() << "% of " << m_tracker.getFaces() <<
+            " faces" << std::endl;
+    long frames = m_videoStreamer.getFrames();
+    out << "frame buffers: " << m_videoStreamer.getAllocations() << " allocations in " << frames << " frames, " <<
+        m_videoStreamer.getBytesCopied() / 1024. / std::max<long>(frames, 1) << " KB decoded per frame" << std::endl;
+    out << "decode: " << m_videoStreamer.getDecodeFps() << " fps, " << m_videoStreamer.getSkippedFrames() <<
+        " frames skipped, " << m_videoStreamer.getDroppedFrames() << " dropped for newer frames" << std::endl;
+    m_extractor->printDetectorReport(out);
+    out << "dropped frames: " << m_captured.dropped() << " before detection, " << m_detected.dropped() <<
+        " before embedding" << std::endl;
+    out.unsetf(std::ios::floatfield);
+}
@@ -0,0 +1,96 @@
+#ifndef FACE_RECOGNITION_RECOGNITIONPIPELINE_H
+#define FACE_RECOGNITION_RECOGNITIONPIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "FaceNet.h"
+#include "FaceTracker.h"
+#include "InferenceEngine.h"
+#include "SpscRing.h"
+#include "VideoStreamer.h"
+
+struct PipelineConfig {
+    int captureQueueDepth = 2;  // frames between capture and detection
+    int detectQueueDepth = 2;   // frames with face rectangles between detection and embedding
+    int embedQueueDepth = 2;    // frames with embeddings between embedding and matching
+    int resultQueueDepth = 4;   // recognized frames waiting for the caller
+    bool dropOldest = true;     // drop the oldest frame of a full capture or detection queue instead of waiting
+    TrackerConfig tracker;      // which faces are embedded again and which use the identity of their track
+};
+
+struct FrameResult {
+    long frameNumber = -1;
+    cv::Mat frame;
+    std::vector<cv::Rect> faceRects;
+    std::vector<int> trackIds;      // -1 if tracking is disabled
+    std::vector<int> classNumbers;  // -1 for unknown faces
+    std::vector<float> distances;
+    std::chrono::steady_clock::time_point captureTime;
+};
+
+struct StageStats {
+    long frames = 0;
+    double totalMicros = 0.;
+    double maxMicros = 0.;
+    double occupancySum = 0.;   // input queue occupancy, sampled whenever the stage takes a frame
+    size_t occupancyMax = 0;
+    void addFrame(double micros, size_t occupancy);
+};
+
+/**
+ * Live recognition as four threads connected by bounded lock-free rings: capture (VideoStreamer), detection, embedding
+ * (fused crop and standardization of all faces, TensorFlow) and matching against the gallery. Every stage handles one
+ * frame at a time in arrival order, so results come out in frame order, with gaps where frames were dropped. With
+ * tracking enabled, only faces of new or moved tracks or tracks due for a refresh are embedded, the others take the
+ * identity cached in their track. The classifier must not be used by other threads while the pipeline runs.
+ * For many streams, every stream gets its own pipeline built on a shared InferenceEngine: detection runs per stream
+ * with its own detector, embedding and matching go through the batches of the engine.
+ */
+class RecognitionPipeline {
+private:
+    struct FrameJob {
+        FrameResult result;
+        std::vector<cv::Rect> embedRects;   // only the faces that need an embedding, not clipped to the frame
+        std::vector<char> needsEmbedding;   // per face
+        cv::Mat embeddings;
+        std::vector<int> classNumbers;      // matches of the embedded faces
+        std::vector<float> distances;
+        bool endOfStream = false;
+    };
+    enum Stage { STAGE_CAPTURE, STAGE_DETECT, STAGE_EMBED, STAGE_MATCH, STAGE_END_TO_END, NMBR_STAGES };
+
+    FaceNetClassifier& m_classifier;
+    InferenceEngine* m_engine;          // null if the pipeline runs the classifier itself
+    FaceExtractor* m_extractor;         // the classifier, or m_ownExtractor with an engine
+    cv::Ptr<FaceExtractor> m_ownExtractor;
+    VideoStreamer& m_videoStreamer;
+    PipelineConfig m_config;
+    SpscRing<FrameJob> m_captured, m_detected, m_embedded, m_results;
+    std::atomic<bool> m_stop;
+    std::vector<std::thread> m_threads;
+    FaceTracker m_tracker;
+    StageStats m_stats[NMBR_STAGES];
+
+    void captureLoop();
+    void detectLoop();
+    void embedLoop();
+    void matchLoop();
+public:
+    RecognitionPipeline(FaceNetClassifier& classifier, VideoStreamer& videoStreamer,
+                        const PipelineConfig& config = PipelineConfig());
+    RecognitionPipeline(InferenceEngine& engine, VideoStreamer& videoStreamer, const DetectorConfig& detectorConfig,
+                        const PipelineConfig& config = PipelineConfig());
+    ~RecognitionPipeline();
+    void start();
+    void stop();
+    bool getResult(FrameResult& result);
+    void printReport(std::ostream& out) const;
+};
+
+
+#endif //FACE_RECOGNITION_RECOGNITIONPIPELINE_H
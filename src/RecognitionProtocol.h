@@ -0,0 +1,78 @@
+#ifndef FACE_RECOGNITION_RECOGNITIONPROTOCOL_H
+#define FACE_RECOGNITION_RECOGNITIONPROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Binary protocol between RecognitionServer and RecognitionClient. Every request is a RequestHeader followed by
+ * payloadSize bytes, every response a ResponseHeader followed by payloadSize bytes. Client and server run on the same
+ * machine, so all fields are in host byte order. A connection carries any number of requests, one at a time.
+ */
+
+static const uint32_t REQUEST_MAGIC = 0x51524e46;     // "FNRQ"
+static const uint32_t RESPONSE_MAGIC = 0x53524e46;    // "FNRS"
+static const uint16_t PROTOCOL_VERSION = 1;
+static const int PROTOCOL_FACE_SIZE = 160;            // width and height of pre-cropped faces
+
+enum RequestType {
+    REQUEST_ENCODED_FRAME = 1,  // payload: an encoded image, JPEG or anything else cv::imdecode reads
+    REQUEST_SHARED_FRAME = 2,   // payload: SharedFrame, the BGR pixels stay in a POSIX shared memory object
+    REQUEST_FACES = 3,          // payload: n x 160 x 160 x 3 BGR bytes, faces cropped by the client, no detection
+    REQUEST_CLASS_NAME = 4      // payload: int32 class number, response payload: the class name
+};
+
+enum RequestFlags {
+    FLAG_EMBEDDINGS = 1         // append the embeddings to the response
+};
+
+enum ResponseStatus {
+    STATUS_OK = 0,
+    STATUS_BAD_REQUEST = 1,     // unknown type, version or malformed payload
+    STATUS_DECODE_FAILED = 2,   // encoded frame or shared memory object could not be read
+    STATUS_INFERENCE_FAILED = 3
+};
+
+#pragma pack(push, 1)
+struct RequestHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t type;          // RequestType
+    uint32_t flags;         // RequestFlags
+    uint32_t requestId;     // echoed in the response
+    uint32_t payloadSize;
+};
+
+struct SharedFrame {
+    char name[64];          // shm_open name, null terminated
+    uint64_t offset;        // of the first pixel in the object
+    uint32_t width;
+    uint32_t height;
+    uint32_t step;          // bytes per row
+};
+
+struct ResponseHeader {
+    uint32_t magic;
+    uint16_t status;        // ResponseStatus
+    uint16_t nmbrFaces;
+    uint32_t requestId;
+    uint32_t embeddingDim;  // floats per embedding in the payload, 0 without FLAG_EMBEDDINGS
+    uint32_t payloadSize;   // nmbrFaces FaceRecords, then nmbrFaces x embeddingDim floats
+};
+
+struct FaceRecord {
+    int32_t x;              // face box in the frame, clipped to it
+    int32_t y;
+    int32_t width;
+    int32_t height;
+    int32_t classNumber;    // -1 for unknown faces, REQUEST_CLASS_NAME resolves it
+    float distance;         // to the nearest known face
+};
+#pragma pack(pop)
+
+// blocking socket I/O retrying short reads and writes, false on error or a closed connection (RecognitionClient.cpp)
+bool readFully(int fd, void* data, size_t size);
+bool writeFully(int fd, const void* data, size_t size);
+
+
+#endif //FACE_RECOGNITION_RECOGNITIONPROTOCOL_H
@@ -0,0 +1,163 @@
+#include "RecognitionRunner.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <opencv2/highgui.hpp>
+#include "InferenceEngine.h"
+#include "Profiler.h"
+#include "RecognitionServer.h"
+
+/**
+ * Recognizes the frames of videoStreamer in a window until the stream ends or q / Esc is pressed. Capture, detection,
+ * embedding and matching run on their own threads, see RecognitionPipeline.
+ * @param faceNetClassifier classifier with enrolled gallery
+ * @param videoStreamer camera or video
+ * @param pipelineConfig queue depths, drop policy and tracking
+ * @param metricsPath if not empty, the profiler writes a snapshot there every 5 seconds, as JSON for a .json path and
+ *                    as Prometheus text otherwise
+ * @return exit code
+ */
+int runCamera(FaceNetClassifier& faceNetClassifier, VideoStreamer& videoStreamer, const PipelineConfig& pipelineConfig,
+              const std::string& metricsPath) {
+    // the camera keeps the default batch size, warm it up before the first frame instead of on it
+    faceNetClassifier.warmUp();
+    RecognitionPipeline pipeline(faceNetClassifier, videoStreamer, pipelineConfig);
+    FrameResult result;
+    int nFrames = 0;
+
+    // per-stage latency histograms, printed at exit, 'p' toggles them at runtime
+    Profiler::setEnabled(true);
+    if (!metricsPath.empty())
+        Profiler::startPeriodicDump(metricsPath, 5000);
+
+    auto start = std::chrono::steady_clock::now();
+    pipeline.start();
+    while (true) {
+        if (!pipeline.getResult(result)) {
+            std::cout << "Empty frame! Exiting..." << std::endl;
+            break;
+        }
+        ScopedTimer displayTimer(PROFILE_DISPLAY);
+        for (int i = 0; i < result.faceRects.size(); i++) {
+            bool known = result.classNumbers[i] >= 0;
+            std::string name = known ? faceNetClassifier.getClassName(result.classNumbers[i]) : "New Person?";
+            cv::Scalar color = known ? cv::Scalar(0, 255, 0) : cv::Scalar(0, 0, 255);
+            cv::rectangle(result.frame, result.faceRects[i], color, 2);
+            cv::putText(result.frame, name, result.faceRects[i].tl() - cv::Point(0, 5), cv::FONT_HERSHEY_SIMPLEX,
+                        0.6, color, 2);
+        }
+        cv::imshow("InputFrame", result.frame);
+        nFrames++;
+        char keyboard = cv::waitKey(1);
+        if (keyboard == 'q' || keyboard == 27)
+            break;
+        if (keyboard == 'p') {
+            Profiler::setEnabled(!Profiler::isEnabled());
+            std::cout << "Profiler " << (Profiler::isEnabled() ? "enabled" : "disabled") << std::endl;
+        }
+    }
+    pipeline.stop();
+    Profiler::stopPeriodicDump();
+    auto end = std::chrono::steady_clock::now();
+    cv::destroyAllWindows();
+    auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    double seconds = double(milliseconds) / 1000.;
+    double fps = nFrames / seconds;
+
+    std::cout << "Counted " << nFrames << " frames in " << seconds << " seconds!" << " This equals " << fps << "fps." <<
+              std::endl;
+    pipeline.printReport(std::cout);
+    Profiler::printReport(std::cout);
+    return 0;
+}
+
+/**
+ * Recognizes faces in all videos at the same time without display. Every video has its own pipeline and face
+ * detector, all of them share the session of faceNetClassifier through one inference engine that batches the faces
+ * of all streams.
+ * @return exit code
+ */
+int runStreams(FaceNetClassifier& faceNetClassifier, const std::vector<std::string>& videoPaths,
+               const DetectorConfig& detectorConfig) {
+    EngineConfig engineConfig;
+    InferenceEngine engine(faceNetClassifier, engineConfig);
+    // files are read faster than they are processed, so no frame is dropped
+    PipelineConfig pipelineConfig;
+    pipelineConfig.dropOldest = false;
+
+    // files are decoded ahead on their own threads and scaled down to 640x480 right after decoding
+    DecodeConfig decodeConfig;
+    decodeConfig.threaded = true;
+
+    int nmbrStreams = videoPaths.size();
+    std::vector<std::unique_ptr<VideoStreamer> > streamers;
+    std::vector<std::unique_ptr<RecognitionPipeline> > pipelines;
+    std::vector<long> frames(nmbrStreams, 0), knownFaces(nmbrStreams, 0);
+    for (int s = 0; s < nmbrStreams; s++) {
+        streamers.emplace_back(new VideoStreamer(videoPaths[s], 640, 480, decodeConfig));
+        pipelines.emplace_back(new RecognitionPipeline(engine, *streamers[s], detectorConfig, pipelineConfig));
+    }
+
+    Profiler::setEnabled(true);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int s = 0; s < nmbrStreams; s++) {
+        threads.emplace_back([&, s]() {
+            FrameResult result;
+            pipelines[s]->start();
+            while (pipelines[s]->getResult(result)) {
+                frames[s]++;
+                knownFaces[s] += std::count_if(result.classNumbers.begin(), result.classNumbers.end(),
+                                               [](int classNumber) { return classNumber >= 0; });
+            }
+            pipelines[s]->stop();
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count() / 1000.;
+
+    long totalFrames = 0;
+    for (int s = 0; s < nmbrStreams; s++) {
+        std::cout << "Stream " << s << " (" << videoPaths[s] << "): " << frames[s] << " frames, " << knownFaces[s] <<
+                  " known faces" << std::endl;
+        pipelines[s]->printReport(std::cout);
+        totalFrames += frames[s];
+    }
+    std::cout << "Counted " << totalFrames << " frames of " << nmbrStreams << " streams in " << seconds <<
+              " seconds! This equals " << (seconds > 0. ? totalFrames / seconds : 0.) << "fps." << std::endl;
+    engine.printReport(std::cout);
+    Profiler::printReport(std::cout);
+    return 0;
+}
+
+/**
+ * Serves the recognizer on a Unix socket, or on a TCP port of 127.0.0.1 if address is a number, until stdin is closed
+ * or a line "q" is read. Concurrent requests of all clients are batched by one inference engine.
+ * @return exit code, EXIT_FAILURE if the socket could not be opened
+ */
+int runServer(FaceNetClassifier& faceNetClassifier, const std::string& address, const DetectorConfig& detectorConfig) {
+    EngineConfig engineConfig;
+    InferenceEngine engine(faceNetClassifier, engineConfig);
+    ServerConfig serverConfig;
+    if (!address.empty() && std::all_of(address.begin(), address.end(), ::isdigit))
+        serverConfig.tcpPort = std::stoi(address);
+    else
+        serverConfig.unixSocketPath = address;
+    RecognitionServer server(engine, detectorConfig, serverConfig);
+    if (!server.start())
+        return EXIT_FAILURE;
+
+    Profiler::setEnabled(true);
+    std::cout << "Serving on " << address << ", enter q to stop" << std::endl;
+    std::string line;
+    while (std::getline(std::cin, line) && line != "q")
+        ;
+    server.stop();
+    server.printReport(std::cout);
+    Profiler::printReport(std::cout);
+    return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef FACE_RECOGNITION_RECOGNITIONRUNNER_H
+#define FACE_RECOGNITION_RECOGNITIONRUNNER_H
+
+#include <string>
+#include <vector>
+#include "FaceNet.h"
+#include "RecognitionPipeline.h"
+#include "VideoStreamer.h"
+
+/**
+ * Complete recognition programs on top of an enrolled FaceNetClassifier: the live window, many streams at once and the
+ * recognition server. Each one runs until its input ends or it is stopped, prints its reports and returns the exit
+ * code for main. Built into the demo executable, not into facenet_core, which stays free of highgui.
+ */
+int runCamera(FaceNetClassifier& faceNetClassifier, VideoStreamer& videoStreamer,
+              const PipelineConfig& pipelineConfig = PipelineConfig(), const std::string& metricsPath = "");
+int runStreams(FaceNetClassifier& faceNetClassifier, const std::vector<std::string>& videoPaths,
+               const DetectorConfig& detectorConfig);
+int runServer(FaceNetClassifier& faceNetClassifier, const std::string& address, const DetectorConfig& detectorConfig);
+
+
+#endif //FACE_RECOGNITION_RECOGNITIONRUNNER_H
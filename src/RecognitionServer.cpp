@@ -0,0 +1,378 @@
+#include "RecognitionServer.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <opencv2/imgcodecs.hpp>
+
+/**
+ * Creates the server, it listens only after start.
+ * @param engine shared engine, embeds and matches the faces of all connections in common batches
+ * @param detectorConfig face detector of every connection
+ * @param config socket and limits
+ */
+RecognitionServer::RecognitionServer(InferenceEngine& engine, const DetectorConfig& detectorConfig,
+                                     const ServerConfig& config)
+        : m_engine(engine), m_detectorConfig(detectorConfig), m_config(config), m_stop(false), m_nmbrClients(0),
+          m_requests(0), m_faces(0), m_failedRequests(0) {
+}
+
+RecognitionServer::~RecognitionServer() {
+    this->stop();
+}
+
+/**
+ * Opens the listening socket and starts accepting connections.
+ * @return false if the socket could not be opened
+ */
+bool RecognitionServer::start() {
+    if (!m_config.unixSocketPath.empty()) {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (m_config.unixSocketPath.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Socket path too long: " << m_config.unixSocketPath << std::endl;
+            return false;
+        }
+        std::strcpy(address.sun_path, m_config.unixSocketPath.c_str());
+        // a socket file left behind by an earlier server
+        unlink(m_config.unixSocketPath.c_str());
+        m_listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m_listenFd < 0 || bind(m_listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+            std::cerr << "Unable to bind " << m_config.unixSocketPath << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    else {
+        sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(m_config.tcpPort);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        m_listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        if (m_listenFd >= 0)
+            setsockopt(m_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (m_listenFd < 0 || bind(m_listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+            std::cerr << "Unable to bind port " << m_config.tcpPort << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    if (listen(m_listenFd, m_config.maxClients) < 0) {
+        std::cerr << "Unable to listen: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    m_stop = false;
+    m_acceptThread = std::thread(&RecognitionServer::acceptLoop, this);
+    return true;
+}
+
+/**
+ * Stops accepting, closes all connections and waits for their threads. Requests in flight are answered first.
+ */
+void RecognitionServer::stop() {
+    if (m_listenFd < 0)
+        return;
+    m_stop = true;
+    // wakes up accept and every read blocked on a client
+    shutdown(m_listenFd, SHUT_RDWR);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (int fd : m_clientFds)
+            shutdown(fd, SHUT_RDWR);
+    }
+    if (m_acceptThread.joinable())
+        m_acceptThread.join();
+    for (auto& thread : m_clientThreads)
+        thread.join();
+    m_clientThreads.clear();
+    m_finishedClients.clear();
+    m_idleExtractors.clear();
+    close(m_listenFd);
+    m_listenFd = -1;
+    if (!m_config.unixSocketPath.empty())
+        unlink(m_config.unixSocketPath.c_str());
+}
+
+/**
+ * Joins the threads of connections that ended since the last call, so they do not pile up over the server lifetime.
+ */
+void RecognitionServer::reapClients() {
+    std::vector<std::thread> finished;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto thread = m_clientThreads.begin(); thread != m_clientThreads.end();) {
+            auto found = std::find(m_finishedClients.begin(), m_finishedClients.end(), thread->get_id());
+            if (found == m_finishedClients.end()) {
+                ++thread;
+                continue;
+            }
+            m_finishedClients.erase(found);
+            finished.push_back(std::move(*thread));
+            thread = m_clientThreads.erase(thread);
+        }
+    }
+    // the threads only have to return from serveClient, which already released the lock
+    for (auto& thread : finished)
+        thread.join();
+}
+
+void RecognitionServer::acceptLoop() {
+    while (!m_stop) {
+        int fd = accept(m_listenFd, nullptr, nullptr);
+        this->reapClients();
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (m_nmbrClients >= m_config.maxClients) {
+            close(fd);
+            continue;
+        }
+        if (m_config.unixSocketPath.empty()) {
+            // responses are small, do not hold them back
+            int noDelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stop) {
+            close(fd);
+            return;
+        }
+        m_nmbrClients++;
+        m_clientFds.push_back(fd);
+        m_clientThreads.emplace_back(&RecognitionServer::serveClient, this, fd);
+    }
+}
+
+/**
+ * Returns the mapping of a shared memory object of a client, mapped at the first request. The object is looked up by
+ * name on every request and mapped again when the client re-created or resized it since, so the server never reads a
+ * stale or truncated mapping. The client must not resize the object while a request on it is in flight.
+ * @param mappings mappings of the client, unmapped when it disconnects
+ * @param name shm_open name
+ * @return null if the object cannot be opened or mapped
+ */
+const RecognitionServer::Mapping* RecognitionServer::mapSharedFrame(std::map<std::string, Mapping>& mappings,
+                                                                    const char* name) {
+    int shmFd = shm_open(name, O_RDONLY, 0);
+    struct stat status;
+    bool opened = shmFd >= 0 && fstat(shmFd, &status) == 0 && status.st_size > 0;
+    auto found = mappings.find(name);
+    if (found != mappings.end() &&
+        (!opened || found->second.inode != status.st_ino || found->second.size != size_t(status.st_size))) {
+        munmap(const_cast<unsigned char*>(found->second.data), found->second.size);
+        mappings.erase(found);
+        found = mappings.end();
+    }
+    if (opened && found == mappings.end()) {
+        void* data = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, shmFd, 0);
+        if (data != MAP_FAILED)
+            found = mappings.insert({name, {static_cast<const unsigned char*>(data), size_t(status.st_size),
+                                            status.st_ino}}).first;
+    }
+    if (shmFd >= 0)
+        close(shmFd);
+    return found == mappings.end() ? nullptr : &found->second;
+}
+
+/**
+ * Answers the requests of one connection until the client closes it or the server stops.
+ */
+void RecognitionServer::serveClient(int fd) {
+    // face detectors are reused by later connections, so only as many are built as clients were connected at once
+    std::unique_ptr<FaceExtractor> extractor;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_idleExtractors.empty()) {
+            extractor = std::move(m_idleExtractors.back());
+            m_idleExtractors.pop_back();
+        }
+    }
+    if (extractor) {
+        extractor->resetDetector();     // frames of the previous client say nothing about this one
+    }
+    else {
+        try {
+            extractor.reset(new FaceExtractor(PROTOCOL_FACE_SIZE, PROTOCOL_FACE_SIZE, m_detectorConfig));
+        }
+        catch (const cv::Exception& e) {
+            // e.g. the cascade file was removed since the server started, the connection is closed
+            std::cerr << "Could not create a face detector for a client: " << e.what() << std::endl;
+        }
+    }
+    std::map<std::string, Mapping> mappings;    // shared memory objects of this client, mapped once
+    std::vector<unsigned char> payload, response;
+    std::vector<cv::Rect> faceRects, clippedRects;
+    cv::Mat frame, embeddings;
+    std::vector<int> classNumbers;
+    std::vector<float> distances;
+    RequestHeader request;
+
+    while (extractor && !m_stop && readFully(fd, &request, sizeof(request))) {
+        if (request.magic != REQUEST_MAGIC || request.version != PROTOCOL_VERSION ||
+            request.payloadSize > m_config.maxPayloadBytes)
+            break;
+        payload.resize(request.payloadSize);
+        if (!readFully(fd, payload.data(), payload.size()))
+            break;
+
+        ResponseHeader header;
+        std::memset(&header, 0, sizeof(header));
+        header.magic = RESPONSE_MAGIC;
+        header.requestId = request.requestId;
+        header.status = STATUS_OK;
+        response.clear();
+        frame.release();
+        faceRects.clear();
+        clippedRects.clear();
+
+        try {
+            switch (request.type) {
+                case REQUEST_ENCODED_FRAME:
+                    frame = cv::imdecode(cv::Mat(1, payload.size(), CV_8U, payload.data()), cv::IMREAD_COLOR);
+                    if (frame.empty())
+                        header.status = STATUS_DECODE_FAILED;
+                    break;
+                case REQUEST_SHARED_FRAME: {
+                    if (payload.size() != sizeof(SharedFrame)) {
+                        header.status = STATUS_BAD_REQUEST;
+                        break;
+                    }
+                    SharedFrame shared;
+                    std::memcpy(&shared, payload.data(), sizeof(shared));
+                    shared.name[sizeof(shared.name) - 1] = 0;
+                    const Mapping* mapping = mapSharedFrame(mappings, shared.name);
+                    if (!mapping) {
+                        header.status = STATUS_DECODE_FAILED;
+                        break;
+                    }
+                    // 64 bit and subtraction only, so no sum or product of client values can wrap around
+                    uint64_t frameBytes = uint64_t(shared.step) * shared.height;
+                    uint64_t mappedBytes = mapping->size;
+                    if (shared.width == 0 || shared.height == 0 || shared.height > uint32_t(INT_MAX) ||
+                        shared.width > shared.step / 3 || shared.offset > mappedBytes ||
+                        frameBytes > mappedBytes - shared.offset) {
+                        header.status = STATUS_BAD_REQUEST;
+                        break;
+                    }
+                    // the client keeps the pixels unchanged until the response arrives, so they are read in place
+                    frame = cv::Mat(shared.height, shared.width, CV_8UC3,
+                                    const_cast<unsigned char*>(mapping->data + shared.offset), shared.step);
+                    break;
+                }
+                case REQUEST_FACES: {
+                    size_t faceBytes = PROTOCOL_FACE_SIZE * PROTOCOL_FACE_SIZE * 3;
+                    if (payload.empty() || payload.size() % faceBytes != 0) {
+                        header.status = STATUS_BAD_REQUEST;
+                        break;
+                    }
+                    // the faces stacked into one image, each face is a rectangle of it
+                    int nmbrFaces = payload.size() / faceBytes;
+                    frame = cv::Mat(nmbrFaces * PROTOCOL_FACE_SIZE, PROTOCOL_FACE_SIZE, CV_8UC3, payload.data());
+                    for (int i = 0; i < nmbrFaces; i++)
+                        faceRects.emplace_back(0, i * PROTOCOL_FACE_SIZE, PROTOCOL_FACE_SIZE, PROTOCOL_FACE_SIZE);
+                    clippedRects = faceRects;
+                    break;
+                }
+                case REQUEST_CLASS_NAME: {
+                    int32_t classNumber;
+                    FaceNetClassifier& classifier = m_engine.getClassifier();
+                    if (payload.size() != sizeof(classNumber)) {
+                        header.status = STATUS_BAD_REQUEST;
+                        break;
+                    }
+                    std::memcpy(&classNumber, payload.data(), sizeof(classNumber));
+                    if (classNumber < 0 || classNumber >= classifier.getGallerySize()) {
+                        header.status = STATUS_BAD_REQUEST;
+                        break;
+                    }
+                    const std::string& name = classifier.getClassName(classNumber);
+                    response.assign(name.begin(), name.end());
+                    break;
+                }
+                default:
+                    header.status = STATUS_BAD_REQUEST;
+            }
+
+            if (header.status == STATUS_OK && request.type != REQUEST_CLASS_NAME) {
+                if (request.type != REQUEST_FACES) {
+                    extractor->detectFaces(frame, faceRects);
+                    extractor->clipFaces(frame, faceRects, clippedRects);
+                }
+                // the face count of the response is 16 bit
+                if (faceRects.size() > std::numeric_limits<uint16_t>::max()) {
+                    faceRects.resize(std::numeric_limits<uint16_t>::max());
+                    clippedRects.resize(faceRects.size());
+                }
+                m_engine.recognize(frame, faceRects, embeddings, classNumbers, distances);
+                if (embeddings.rows != int(faceRects.size())) {
+                    header.status = STATUS_INFERENCE_FAILED;
+                }
+                else {
+                    header.nmbrFaces = faceRects.size();
+                    header.embeddingDim = (request.flags & FLAG_EMBEDDINGS) ? embeddings.cols : 0;
+                    response.resize(header.nmbrFaces * (sizeof(FaceRecord) + header.embeddingDim * sizeof(float)));
+                    FaceRecord* records = reinterpret_cast<FaceRecord*>(response.data());
+                    for (int i = 0; i < header.nmbrFaces; i++) {
+                        records[i].x = clippedRects[i].x;
+                        records[i].y = clippedRects[i].y;
+                        records[i].width = clippedRects[i].width;
+                        records[i].height = clippedRects[i].height;
+                        records[i].classNumber = classNumbers[i];
+                        records[i].distance = distances[i];
+                    }
+                    if (header.embeddingDim > 0)
+                        std::memcpy(records + header.nmbrFaces, embeddings.ptr<float>(),
+                                    embeddings.total() * sizeof(float));
+                    m_faces += header.nmbrFaces;
+                }
+            }
+        }
+        catch (const cv::Exception& e) {
+            // e.g. a frame OpenCV cannot take, answered like any other malformed request
+            std::cerr << "Request " << request.requestId << " failed: " << e.what() << std::endl;
+            header.status = request.type == REQUEST_ENCODED_FRAME ? STATUS_DECODE_FAILED : STATUS_BAD_REQUEST;
+            header.nmbrFaces = 0;
+            header.embeddingDim = 0;
+            response.clear();
+        }
+        m_requests++;
+        if (header.status != STATUS_OK)
+            m_failedRequests++;
+        header.payloadSize = response.size();
+        if (!writeFully(fd, &header, sizeof(header)) || !writeFully(fd, response.data(), response.size()))
+            break;
+    }
+
+    for (auto& mapping : mappings)
+        munmap(const_cast<unsigned char*>(mapping.second.data), mapping.second.size);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_clientFds.erase(std::find(m_clientFds.begin(), m_clientFds.end(), fd));
+    close(fd);
+    if (extractor)
+        m_idleExtractors.push_back(std::move(extractor));
+    m_finishedClients.push_back(std::this_thread::get_id());
+    m_nmbrClients--;
+}
+
+/**
+ * Prints requests, failed requests and faces answered so far, followed by the batching report of the engine.
+ */
+void RecognitionServer::printReport(std::ostream& out) {
+    out << "server: " << m_requests << " requests, " << m_failedRequests << " failed, " << m_faces << " faces" <<
+        std::endl;
+    m_engine.printReport(out);
+}
@@ -0,0 +1,67 @@
+#ifndef FACE_RECOGNITION_RECOGNITIONSERVER_H
+#define FACE_RECOGNITION_RECOGNITIONSERVER_H
+
+#include <atomic>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include "InferenceEngine.h"
+#include "RecognitionProtocol.h"
+
+struct ServerConfig {
+    std::string unixSocketPath;     // listen on this Unix domain socket if not empty
+    int tcpPort = 0;                // otherwise on this TCP port of 127.0.0.1
+    int maxClients = 64;            // further connections are closed right away
+    uint32_t maxPayloadBytes = 64 << 20;
+};
+
+/**
+ * Serves one warm recognizer to many local clients over the protocol of RecognitionProtocol.h, so clients do not pay
+ * for loading the graph and creating a session. Every connection gets its own thread and face detector, both reused
+ * after the connection ended. The faces of all connections go through the shared InferenceEngine, which batches
+ * concurrent requests into common session runs.
+ * Frames arrive encoded (decoded by the server), as pre-cropped faces, or in POSIX shared memory, which the server
+ * maps once per object and reads in place without copying the frame.
+ */
+class RecognitionServer {
+private:
+    struct Mapping {
+        const unsigned char* data;
+        size_t size;
+        ino_t inode;    // with the size, tells whether the client re-created or resized the object
+    };
+
+    InferenceEngine& m_engine;
+    DetectorConfig m_detectorConfig;
+    ServerConfig m_config;
+    int m_listenFd = -1;
+    std::atomic<bool> m_stop;
+    std::thread m_acceptThread;
+    std::mutex m_mutex;
+    std::list<std::thread> m_clientThreads;
+    std::vector<std::thread::id> m_finishedClients;     // threads that left serveClient and can be joined
+    std::vector<int> m_clientFds;
+    std::vector<std::unique_ptr<FaceExtractor> > m_idleExtractors;
+    std::atomic<int> m_nmbrClients;
+    std::atomic<long> m_requests, m_faces, m_failedRequests;
+
+    static const Mapping* mapSharedFrame(std::map<std::string, Mapping>& mappings, const char* name);
+    void reapClients();
+    void acceptLoop();
+    void serveClient(int fd);
+public:
+    RecognitionServer(InferenceEngine& engine, const DetectorConfig& detectorConfig, const ServerConfig& config);
+    ~RecognitionServer();
+    bool start();
+    void stop();
+    void printReport(std::ostream& out);
+};
+
+
+#endif //FACE_RECOGNITION_RECOGNITIONSERVER_H
@@ -0,0 +1,132 @@
+#ifndef FACE_RECOGNITION_SPSCRING_H
+#define FACE_RECOGNITION_SPSCRING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Bounded lock-free ring buffer between two pipeline stages. Every slot carries a sequence number (Vyukov's bounded
+ * queue), so pop stays correct when the producer pops as well: with dropOldest the producer removes the oldest item
+ * of a full ring itself instead of waiting for the consumer, which keeps the latency bounded when the consumer falls
+ * behind. Capacity is rounded up to a power of two.
+ */
+template <typename T>
+class SpscRing {
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+    std::vector<Slot> m_slots;
+    size_t m_mask;
+    bool m_dropOldest;
+    // padding keeps producer and consumer positions on separate cache lines
+    char m_padding0[64];
+    std::atomic<size_t> m_pushPos;
+    char m_padding1[64];
+    std::atomic<size_t> m_popPos;
+    char m_padding2[64];
+    std::atomic<size_t> m_dropped;
+
+    static void backoff(int& spins) {
+        if (++spins < 64)
+            return;
+        if (spins < 128)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+public:
+    SpscRing(size_t capacity, bool dropOldest) : m_dropOldest(dropOldest), m_pushPos(0), m_popPos(0), m_dropped(0) {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        m_slots = std::vector<Slot>(size);
+        m_mask = size - 1;
+        for (size_t i = 0; i < size; i++)
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool tryPush(T& item) {
+        size_t pos = m_pushPos.load(std::memory_order_relaxed);
+        Slot& slot = m_slots[pos & m_mask];
+        if (slot.sequence.load(std::memory_order_acquire) != pos)
+            return false;
+        slot.item = std::move(item);
+        m_pushPos.store(pos + 1, std::memory_order_relaxed);
+        slot.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& item) {
+        size_t pos = m_popPos.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = m_slots[pos & m_mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence < pos + 1)
+                return false;
+            if (sequence == pos + 1 &&
+                m_popPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+            if (sequence > pos + 1)
+                pos = m_popPos.load(std::memory_order_relaxed);
+        }
+        item = std::move(m_slots[pos & m_mask].item);
+        m_slots[pos & m_mask].sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Pushes item, on a full ring either drops the oldest item (dropOldest) or waits for the consumer until stop
+     * becomes true. force waits in both modes, used for end-of-stream markers that must not be lost.
+     */
+    bool push(T& item, const std::atomic<bool>& stop, bool force = false) {
+        int spins = 0;
+        while (!tryPush(item)) {
+            T dropped;
+            if (m_dropOldest && !force && tryPop(dropped)) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            if (stop.load(std::memory_order_relaxed))
+                return false;
+            backoff(spins);
+        }
+        return true;
+    }
+
+    /**
+     * Waits until an item is available or stop becomes true.
+     */
+    bool pop(T& item, const std::atomic<bool>& stop) {
+        int spins = 0;
+        while (!tryPop(item)) {
+            if (stop.load(std::memory_order_relaxed))
+                return false;
+            backoff(spins);
+        }
+        return true;
+    }
+
+    size_t occupancy() const {
+        size_t pushPos = m_pushPos.load(std::memory_order_relaxed);
+        size_t popPos = m_popPos.load(std::memory_order_relaxed);
+        return pushPos > popPos ? pushPos - popPos : 0;
+    }
+
+    size_t capacity() const {
+        return m_mask + 1;
+    }
+
+    size_t dropped() const {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+};
+
+
+#endif //FACE_RECOGNITION_SPSCRING_H
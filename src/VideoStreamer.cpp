@@ -1,24 +1,66 @@
 #include "VideoStreamer.h"
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+#include "Profiler.h"
 
-VideoStreamer::VideoStreamer(int nmbrDevice, int videoWidth, int videoHeight) {
+/**
+ * Opens a camera.
+ * @param decodeConfig decode thread and frame skipping, usually latestOnly for live sources
+ */
+VideoStreamer::VideoStreamer(int nmbrDevice, int videoWidth, int videoHeight, const DecodeConfig& decodeConfig)
+        : m_stop(false), m_prefetched(decodeConfig.prefetchFrames, decodeConfig.latestOnly) {
     m_capture = new VideoCapture(nmbrDevice);
     if (!m_capture->isOpened()){
         //error in opening the video input
         cerr << "Unable to open file!" << std::endl;
     }
-    m_videoWidth = videoWidth;
-    m_videoHeight = videoHeight;
+    this->init(videoWidth, videoHeight, decodeConfig);
     m_capture->set(CAP_PROP_FRAME_WIDTH, m_videoWidth);
     m_capture->set(CAP_PROP_FRAME_HEIGHT, m_videoHeight);
 }
 
-VideoStreamer::VideoStreamer(string filename, int videoWith, int videoHeight) {
+/**
+ * Opens a video file or stream. Frames larger than videoWidth x videoHeight are scaled down, see setResoltionFile.
+ * @param decodeConfig decode thread, frame skipping and hardware decoding
+ */
+VideoStreamer::VideoStreamer(string filename, int videoWidth, int videoHeight, const DecodeConfig& decodeConfig)
+        : m_stop(false), m_prefetched(decodeConfig.prefetchFrames, decodeConfig.latestOnly) {
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 5 || \
+    (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 2)))
+    if (decodeConfig.hardwareAcceleration)
+        // falls back to software decoding if the backend has no hardware decoder for the codec
+        m_capture = new VideoCapture(filename, CAP_ANY, {CAP_PROP_HW_ACCELERATION, VIDEO_ACCELERATION_ANY});
+    else
+        m_capture = new VideoCapture(filename);
+#else
     m_capture = new VideoCapture(filename);
+#endif
     if (!m_capture->isOpened()){
         //error in opening the video input
         cerr << "Unable to open file!" << std::endl;
     }
-    // ToDo set filename width+height doesn't work with m_capture.set(...)
+    this->init(videoWidth, videoHeight, decodeConfig);
+    this->setResoltionFile(videoWidth, videoHeight);
+}
+
+void VideoStreamer::init(int videoWidth, int videoHeight, const DecodeConfig& decodeConfig) {
+    m_videoWidth = videoWidth;
+    m_videoHeight = videoHeight;
+    m_decodeConfig = decodeConfig;
+    m_decodeConfig.everyNthFrame = std::max(m_decodeConfig.everyNthFrame, 1);
+    m_frames = 0;
+    m_allocations = 0;
+    m_bytesCopied = 0;
+    m_skippedFrames = 0;
+    m_droppedFrames = 0;
+    m_decodeMicros = 0;
+}
+
+VideoStreamer::~VideoStreamer() {
+    m_stop = true;
+    if (m_decodeThread.joinable())
+        m_decodeThread.join();
+    delete m_capture;
 }
 
 void VideoStreamer::setResolutionDevice(int width, int height) {
@@ -28,12 +70,164 @@ void VideoStreamer::setResolutionDevice(int width, int height) {
     m_capture->set(CAP_PROP_FRAME_HEIGHT, m_videoHeight);
 }
 
+/**
+ * Scales frames of files down to fit into width x height, keeping the aspect ratio, right after decoding and before
+ * they are queued, so detection and buffers only see the smaller frames. Smaller frames are not scaled up, 0 turns
+ * scaling off. Capture backends do not scale file frames themselves, unlike the resolution of a camera.
+ */
 void VideoStreamer::setResoltionFile(int width, int height) {
-    // ToDo set resolution for input files
+    m_videoWidth = width;
+    m_videoHeight = height;
+    m_downscale = width > 0 && height > 0;
 }
 
+/**
+ * Sets how many capture buffers are recycled. It should cover all frames in flight, e.g. the frames in the queues of
+ * a RecognitionPipeline plus the one on display, otherwise frames are decoded into newly allocated memory. The frames
+ * prefetched by the decode thread are added. Call before the first getFrame.
+ */
+void VideoStreamer::setFramePoolSize(size_t framePoolSize) {
+    m_framePoolSize = framePoolSize;
+    if (m_framePool.size() > m_framePoolSize)
+        m_framePool.resize(m_framePoolSize);
+}
+
+/**
+ * Returns the next frame, frame shares a buffer of the frame pool. A buffer is free once frame and all its copies and
+ * views were released by the caller, so in steady state no frame memory is allocated. With a decode thread the frame
+ * was usually decoded already and is taken from the prefetch buffer; with latestOnly all older decoded frames are
+ * dropped.
+ * @param frame next frame, empty at the end of a file
+ */
 void VideoStreamer::getFrame(Mat &frame) {
-    *m_capture >> frame;
+    if (!m_decodeConfig.threaded) {
+        this->readFrame(frame);
+        return;
+    }
+    // a frame handed out before may be the only thing keeping its buffer busy
+    frame.release();
+    if (m_endOfStream)
+        return;
+    if (!m_decodeThread.joinable())
+        m_decodeThread = std::thread(&VideoStreamer::decodeLoop, this);
+    if (!m_prefetched.pop(frame, m_stop) || frame.empty()) {
+        m_endOfStream = true;
+        return;
+    }
+    if (m_decodeConfig.latestOnly) {
+        Mat newer;
+        while (m_prefetched.tryPop(newer)) {
+            if (newer.empty()) {
+                // the end of the stream is reported on the next call
+                m_endOfStream = true;
+                break;
+            }
+            frame = newer;
+            m_droppedFrames++;
+        }
+    }
+}
+
+void VideoStreamer::decodeLoop() {
+    while (!m_stop) {
+        Mat frame;
+        this->readFrame(frame);
+        bool endOfStream = frame.empty();
+        // the end of the stream is never dropped
+        if (!m_prefetched.push(frame, m_stop, endOfStream) || endOfStream)
+            return;
+    }
+}
+
+/**
+ * Decodes the next frame to hand out into a free buffer of the frame pool, on the decode thread if there is one.
+ * Only the decoded image is copied into the buffer, which the capture backends do anyway.
+ */
+void VideoStreamer::readFrame(Mat &frame) {
+    ScopedTimer timer(PROFILE_CAPTURE);
+    frame.release();
+    auto now = std::chrono::steady_clock::now();
+    if (m_frames == 0 && m_skippedFrames == 0)
+        m_decodeStart = now;
+    // frames not handed out are only grabbed, which skips conversion and copy
+    while ((m_frames + m_skippedFrames) % m_decodeConfig.everyNthFrame != 0) {
+        if (!m_capture->grab())
+            return;
+        m_skippedFrames++;
+    }
+
+    // prefetched frames keep their buffers busy as well
+    size_t poolSize = m_framePoolSize + (m_decodeConfig.threaded ? m_prefetched.capacity() + 1 : 0);
+    Mat* buffer = nullptr;
+    for (auto& pooled : m_framePool) {
+        // reference count read atomically, other threads release frames concurrently
+        if (pooled.u == nullptr || CV_XADD(&pooled.u->refcount, 0) == 1) {
+            buffer = &pooled;
+            break;
+        }
+    }
+    if (!buffer && m_framePool.size() < poolSize) {
+        m_framePool.emplace_back();
+        buffer = &m_framePool.back();
+    }
+
+    Mat unpooled;
+    Mat& target = buffer ? *buffer : unpooled;
+    const uchar* data = target.data;
+    if (!m_capture->read(m_downscale ? m_decoded : target))
+        return;
+    if (m_downscale) {
+        double scale = std::min(double(m_videoWidth) / m_decoded.cols, double(m_videoHeight) / m_decoded.rows);
+        if (scale < 1.)
+            cv::resize(m_decoded, target, Size(cvRound(m_decoded.cols * scale), cvRound(m_decoded.rows * scale)), 0,
+                       0, INTER_AREA);
+        else
+            m_decoded.copyTo(target);
+    }
+    if (target.empty())
+        return;
+    m_frames++;
+    if (target.data != data)
+        m_allocations++;
+    m_bytesCopied += target.total() * target.elemSize();
+    m_decodeMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                           m_decodeStart).count();
+    frame = target;
+}
+
+long VideoStreamer::getFrames() const {
+    return m_frames;
+}
+
+long VideoStreamer::getAllocations() const {
+    return m_allocations;
+}
+
+size_t VideoStreamer::getBytesCopied() const {
+    return m_bytesCopied;
+}
+
+/**
+ * Frames not handed out because of everyNthFrame.
+ */
+long VideoStreamer::getSkippedFrames() const {
+    return m_skippedFrames;
+}
+
+/**
+ * Decoded frames never handed out because a newer frame replaced them, latestOnly only.
+ */
+long VideoStreamer::getDroppedFrames() const {
+    return m_droppedFrames + long(m_prefetched.dropped());
+}
+
+/**
+ * Frames read from the source per second, skipped frames included. With a decode thread this is the rate the source
+ * can be decoded at, or the frame rate of a live source, independent of how fast frames are processed.
+ */
+double VideoStreamer::getDecodeFps() const {
+    long micros = m_decodeMicros;
+    return micros > 0 ? (m_frames + m_skippedFrames) * 1e6 / micros : 0.;
 }
 
 void VideoStreamer::assertResolution() {
@@ -41,4 +235,4 @@ void VideoStreamer::assertResolution() {
     // but a function like this would be good to ensure good performance
     assert(m_videoWidth == m_capture->get(CAP_PROP_FRAME_WIDTH));
     assert(m_videoHeight == m_capture->get(CAP_PROP_FRAME_HEIGHT));
-}
\ No newline at end of file
+}
@@ -1,27 +1,72 @@
 #ifndef VIDEO_INPUT_WRAPPER_VIDEOSTREAMER_H
 #define VIDEO_INPUT_WRAPPER_VIDEOSTREAMER_H
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <assert.h>
+#include <thread>
+#include <vector>
 #include <opencv2/core.hpp>
 #include <opencv2/videoio.hpp>
+#include "SpscRing.h"
 
 using namespace std;
 using namespace cv;
 
+struct DecodeConfig {
+    bool threaded = false;          // decode on an own thread ahead of getFrame
+    size_t prefetchFrames = 4;      // decoded frames buffered by the decode thread
+    bool latestOnly = false;        // live sources: getFrame returns the newest decoded frame, older ones are dropped
+    int everyNthFrame = 1;          // hand out every Nth frame only, the others are grabbed but not converted
+    bool hardwareAcceleration = true;   // hardware decoder for files if the OpenCV backend has one (OpenCV 4.5.2+)
+};
+
 class VideoStreamer {
 private:
     int m_videoWidth;
     int m_videoHeight;
+    bool m_downscale = false;       // file frames larger than m_videoWidth x m_videoHeight are scaled down
     VideoCapture *m_capture;
+    DecodeConfig m_decodeConfig;
+    std::vector<Mat> m_framePool;   // capture buffers, a buffer is free again once no frame refers to it anymore
+    size_t m_framePoolSize = 16;
+    Mat m_decoded;                  // full resolution frame before scaling down
+
+    // decode thread
+    std::thread m_decodeThread;
+    std::atomic<bool> m_stop;
+    SpscRing<Mat> m_prefetched;
+    bool m_endOfStream = false;
+
+    // statistics, written by the decoding thread
+    std::atomic<long> m_frames;
+    std::atomic<long> m_allocations;        // frames that could not be decoded into an existing buffer
+    std::atomic<size_t> m_bytesCopied;      // from the decoder into the frame buffers
+    std::atomic<long> m_skippedFrames;      // by everyNthFrame
+    std::atomic<long> m_droppedFrames;      // by latestOnly
+    std::chrono::steady_clock::time_point m_decodeStart;
+    std::atomic<long> m_decodeMicros;       // from the first to the last decoded frame
+
+    void init(int videoWidth, int videoHeight, const DecodeConfig& decodeConfig);
+    void readFrame(Mat &frame);
+    void decodeLoop();
 
 public:
-    VideoStreamer(int nmbrDevice, int videoWidth, int videoHeight);
-    VideoStreamer(string filename, int videoWidth, int videoHeight);
+    VideoStreamer(int nmbrDevice, int videoWidth, int videoHeight, const DecodeConfig& decodeConfig = DecodeConfig());
+    VideoStreamer(string filename, int videoWidth, int videoHeight, const DecodeConfig& decodeConfig = DecodeConfig());
+    ~VideoStreamer();
     void setResolutionDevice(int width, int height);
     void setResoltionFile(int width, int height);
     void assertResolution();
+    void setFramePoolSize(size_t framePoolSize);
     void getFrame(Mat &frame);
+    long getFrames() const;
+    long getAllocations() const;
+    size_t getBytesCopied() const;
+    long getSkippedFrames() const;
+    long getDroppedFrames() const;
+    double getDecodeFps() const;
 };
 
 #endif //VIDEO_INPUT_WRAPPER_VIDEOSTREAMER_H
@@ -1,12 +1,9 @@
 #include <iostream>
-#include <chrono>
-#include <opencv2/core.hpp>
-#include <opencv2/highgui.hpp>
+#include <string>
+#include <vector>
 #include "VideoStreamer.h"
 #include "FaceNet.h"
-
-// uncomment to show how much time inference needed
-//#define LOG_TIMES
+#include "RecognitionRunner.h"
 
 using namespace tensorflow;
 
@@ -20,62 +17,68 @@ void checkStatus(Status status);
 int main(int argc, char *argv[]) {
     if (argc < 2) {
         std::cout << "Usage:\n"
-                    "./facenet_recognition <Path/To/Image/Directory/Structure>\n"
-                    "Directory structure should be path/to/img_directory/class_names.jpg\n" << std::endl;
+                    "./facenet_recognition <Path/To/Image/Directory/Structure> [Path/To/Gallery/File] [Video files...]\n"
+                    "Directory structure should be path/to/img_directory/class_names.jpg\n"
+                    "The optional gallery file caches the embeddings of the images between runs\n"
+                    "With video files, all of them are recognized at once with one shared model instead of the "
+                    "camera\n"
+                    "With --serve <Path/To/Unix/Socket | TCP port> instead of video files, the recognizer serves "
+                    "local clients, see RecognitionClient.h\n" << std::endl;
         return 0;
     }
 
-    cv::Mat frame;
-    int nFrames = 0;
-    time_t timeStart, timeEnd;
-
     std::string modelPath = "../models/20180402-114759.pb";
     std::string haarCascadePath = "../models/haarcascade_frontalface_default.xml";
     std::string imagesPath = argv[1];
-
-    VideoStreamer videoStreamer = VideoStreamer(0, 640, 480);
+    std::string galleryPath = argc > 2 ? argv[2] : "";
+
+    // CPU cascade is the fastest backend without a GPU, use DETECTOR_CPU_HOG for dlib's more accurate detector or
+    // DETECTOR_CUDA_CASCADE if OpenCV was built with CUDA
+    // OpenCV's thread pool is process wide and shared by the cascade detectors of all streams, sized once here, 0 keeps
+    // the hardware default
+    int openCvThreads = 0;
+    if (openCvThreads > 0)
+        cv::setNumThreads(openCvThreads);
+
+    DetectorConfig detectorConfig;
+    detectorConfig.backend = DETECTOR_CPU_CASCADE;
+    detectorConfig.cascadePath = haarCascadePath;
+    // detection only where the scene moved, see GatedFaceDetector; ROIs are per camera, e.g. the door of a corridor
+    detectorConfig.gate.enabled = false;
 
     float knownPersonThreshold = 1.;
-    FaceNetClassifier faceNetClassifier = FaceNetClassifier(modelPath, knownPersonThreshold);
-
-    faceNetClassifier.forwardPreprocessing(imagesPath);
-
-    auto start = chrono::steady_clock::now();
-    time(&timeStart);
-    while (true) {
-        videoStreamer.getFrame(frame);
-        if (frame.empty()) {
-            std::cout << "Empty frame! Exiting..." << std::endl;
-            break;
-        }
-        auto startFW = chrono::steady_clock::now();
-        faceNetClassifier.forward(frame);
-        auto endFW = chrono::steady_clock::now();
-
-        cv::imshow("InputFrame", frame);
-        nFrames++;
-        char keyboard = cv::waitKey(1);
-        if (keyboard == 'q' || keyboard == 27)
-            break;
-
-        #ifdef LOG_TIMES
-        std::cout << "Forward took " << std::chrono::duration_cast<chrono::milliseconds>(endFW - startFW).count() <<
-            "ms" << std::endl;
-        #endif
-
-    }
-    time(&timeEnd);
-    auto end = chrono::steady_clock::now();
-    cv::destroyAllWindows();
-    auto milliseconds = chrono::duration_cast<chrono::milliseconds>(end-start).count();
-    double seconds = double(milliseconds)/1000.;
-    double fps = nFrames/seconds;
-
-    std::cout << "Counted " << nFrames << " frames in " << double(milliseconds)/1000. << " seconds!" <<
-              " This equals " << fps << "fps." << std::endl;
-
-    return 0;
-
+    // thread pools, graph optimizations and warm-up of the TensorFlow session, by default TensorFlow sizes the pools
+    SessionConfig sessionConfig;
+    // only used with sessionConfig.precision = PRECISION_INT8
+    sessionConfig.calibrationImagesPath = imagesPath;
+    FaceNetClassifier faceNetClassifier(modelPath, knownPersonThreshold, detectorConfig, sessionConfig);
+    // 5-point landmark alignment of every face, needs shape_predictor_5_face_landmarks.dat in the models folder, the
+    // gallery is enrolled again when this changes
+    AlignmentConfig alignmentConfig;
+    alignmentConfig.enabled = false;
+    faceNetClassifier.setAligner(alignmentConfig);
+
+    faceNetClassifier.forwardPreprocessing(imagesPath, galleryPath);
+
+    if (argc > 4 && std::string(argv[3]) == "--serve")
+        return runServer(faceNetClassifier, argv[4], detectorConfig);
+    if (argc > 3)
+        return runStreams(faceNetClassifier, std::vector<std::string>(argv + 3, argv + argc), detectorConfig);
+
+    // the camera is read on its own thread and only the newest frame is processed, so frames never queue up in the
+    // driver when recognition is slower than the camera
+    DecodeConfig cameraDecodeConfig;
+    cameraDecodeConfig.threaded = true;
+    cameraDecodeConfig.latestOnly = true;
+    VideoStreamer videoStreamer(0, 640, 480, cameraDecodeConfig);
+
+    // capture, detection, embedding and matching run on their own threads, the oldest frame is dropped when the
+    // network falls behind the camera
+    PipelineConfig pipelineConfig;
+    // per-stage latency histograms are written every few seconds to a metrics path, as JSON for a .json path and as
+    // Prometheus text otherwise
+    std::string metricsPath = "";
+    return runCamera(faceNetClassifier, videoStreamer, pipelineConfig, metricsPath);
 }
 
 // helper function for tensorflow status
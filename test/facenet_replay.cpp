@@ -0,0 +1,366 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "FaceNet.h"
+#include "VideoStreamer.h"
+
+/**
+ * Deterministic end-to-end replay of the recognition pipeline, used as a regression gate for changes that should not
+ * alter recognition output (detectors, graph rewrites, quantization, preprocessing). Enrols an image directory, runs
+ * every frame of a video file or image directory (sorted by name) through FaceNetClassifier::process and records per
+ * frame the face boxes, identities, distances and an embedding signature. With --record the result is written to the
+ * golden file, otherwise it is compared with the golden file and the program fails if a value is off by more than its
+ * tolerance. Runs on the CPU with single threaded TensorFlow and detection, without camera or display. If the model,
+ * the cascade or a fixture is missing, it prints why and exits with SKIP_EXIT_CODE, which ctest reports as skipped.
+ *
+ * The embedding signature is an FNV-1a checksum of the embedding rounded to 4 decimals, which tells whether it changed
+ * at all (reported, never fails), and 8 projections on fixed +-1/sqrt(dim) directions. A projection moves by at most
+ * the euclidean distance the embedding moved, so the embedding tolerance is a lower bound on that distance.
+ *
+ * Usage: ./facenet_replay <model.pb> <enrolment image directory> <video file | image directory> <golden file>
+ *        [--record] [--frames 100] [--detector cascade] [--cascade ../models/haarcascade_frontalface_default.xml]
+ *        [--threshold 1] [--box-tolerance 2] [--distance-tolerance 0.02] [--embedding-tolerance 0.02]
+ */
+
+static const int GOLDEN_VERSION = 1;
+static const int SIGNATURE_SIZE = 8;
+static const int SKIP_EXIT_CODE = 77;
+
+struct ReplayFace {
+    cv::Rect box;
+    std::string identity;   // "unknown" below the threshold
+    float distance;         // to the nearest identity, -1 with an empty gallery
+    uint64_t checksum;
+    float signature[SIGNATURE_SIZE];
+};
+
+struct Tolerances {
+    int box = 2;                // pixels per box coordinate
+    float distance = 0.02f;
+    float embedding = 0.02f;    // per signature projection
+};
+
+// largest differences seen, printed so that tolerances can be chosen from a run against a known good build
+struct Drift {
+    int box = 0;
+    float distance = 0.f;
+    float embedding = 0.f;
+    int changedChecksums = 0;
+};
+
+static bool pathExists(const std::string& path) {
+    struct stat status;
+    return stat(path.c_str(), &status) == 0;
+}
+
+static void loadFrames(const std::string& source, int maxFrames, std::vector<cv::Mat>& frames) {
+    DIR *dir = opendir(source.c_str());
+    if (dir) {
+        std::vector<std::string> names;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_type != DT_DIR)
+                names.push_back(entry->d_name);
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+        for (const std::string& name : names) {
+            if (frames.size() >= maxFrames)
+                break;
+            cv::Mat image = cv::imread(source + "/" + name);
+            if (!image.empty())
+                frames.push_back(image);
+        }
+        return;
+    }
+    VideoStreamer videoStreamer(source, 0, 0);
+    cv::Mat frame;
+    while (frames.size() < maxFrames) {
+        videoStreamer.getFrame(frame);
+        if (frame.empty())
+            break;
+        // the streamer recycles its buffers
+        frames.push_back(frame.clone());
+    }
+}
+
+static void signEmbedding(const float* embedding, int dim, ReplayFace& face) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int j = 0; j < dim; j++) {
+        int32_t rounded = int32_t(std::lround(embedding[j] * 1e4f));
+        for (int b = 0; b < 4; b++) {
+            hash ^= (uint32_t(rounded) >> (8 * b)) & 0xff;
+            hash *= 1099511628211ULL;
+        }
+    }
+    face.checksum = hash;
+    // the directions only depend on integer arithmetic, so golden files do not depend on the standard library
+    float invSqrtDim = 1.f / std::sqrt(float(dim));
+    for (int s = 0; s < SIGNATURE_SIZE; s++) {
+        float projection = 0.f;
+        for (int j = 0; j < dim; j++) {
+            uint32_t mixed = (uint32_t(j) * 2654435761u) ^ (uint32_t(s + 1) * 40503u);
+            projection += ((mixed >> 15) & 1) ? embedding[j] : -embedding[j];
+        }
+        face.signature[s] = projection * invSqrtDim;
+    }
+}
+
+static void writeGolden(std::ostream& out, const std::vector<std::vector<ReplayFace> >& frames) {
+    out << "facenet_replay " << GOLDEN_VERSION << "\nframes " << frames.size() << "\n";
+    out << std::fixed << std::setprecision(6);
+    for (size_t f = 0; f < frames.size(); f++) {
+        out << "frame " << f << " " << frames[f].size() << "\n";
+        for (const ReplayFace& face : frames[f]) {
+            out << face.box.x << " " << face.box.y << " " << face.box.width << " " << face.box.height << " " <<
+                face.identity << " " << face.distance << " " << std::hex << face.checksum << std::dec;
+            for (float value : face.signature)
+                out << " " << value;
+            out << "\n";
+        }
+    }
+}
+
+static bool readGolden(std::istream& in, std::vector<std::vector<ReplayFace> >& frames) {
+    std::string word;
+    int version = 0;
+    size_t nmbrFrames = 0;
+    if (!(in >> word >> version) || word != "facenet_replay" || version != GOLDEN_VERSION)
+        return false;
+    if (!(in >> word >> nmbrFrames) || word != "frames")
+        return false;
+    frames.resize(nmbrFrames);
+    for (size_t f = 0; f < nmbrFrames; f++) {
+        size_t index, nmbrFaces;
+        if (!(in >> word >> index >> nmbrFaces) || word != "frame" || index != f)
+            return false;
+        frames[f].resize(nmbrFaces);
+        for (ReplayFace& face : frames[f]) {
+            in >> face.box.x >> face.box.y >> face.box.width >> face.box.height >> face.identity >> face.distance >>
+               std::hex >> face.checksum >> std::dec;
+            for (float& value : face.signature)
+                in >> value;
+            if (!in)
+                return false;
+        }
+    }
+    return true;
+}
+
+static double overlap(const cv::Rect& a, const cv::Rect& b) {
+    double intersection = (a & b).area();
+    double unionArea = a.area() + b.area() - intersection;
+    return unionArea > 0 ? intersection / unionArea : 0.;
+}
+
+/**
+ * Compares the faces of one frame, every golden face is paired with the unpaired face of this run it overlaps most.
+ * @return number of differences beyond the tolerances, each one is printed
+ */
+static int compareFrame(int frame, const std::vector<ReplayFace>& golden, const std::vector<ReplayFace>& faces,
+                        const Tolerances& tolerances, Drift& drift) {
+    int failures = 0;
+    std::vector<char> paired(faces.size(), 0);
+    for (size_t g = 0; g < golden.size(); g++) {
+        const ReplayFace& expected = golden[g];
+        int best = -1;
+        double bestOverlap = 0.;
+        for (size_t i = 0; i < faces.size(); i++) {
+            double boxOverlap = overlap(expected.box, faces[i].box);
+            if (!paired[i] && boxOverlap > bestOverlap) {
+                best = int(i);
+                bestOverlap = boxOverlap;
+            }
+        }
+        std::ostringstream prefix;
+        prefix << "frame " << frame << ", face at " << expected.box << ": ";
+        if (best < 0) {
+            std::cout << prefix.str() << "not found" << std::endl;
+            failures++;
+            continue;
+        }
+        paired[best] = 1;
+        const ReplayFace& face = faces[best];
+        int boxDrift = std::max(std::max(std::abs(face.box.x - expected.box.x), std::abs(face.box.y - expected.box.y)),
+                                std::max(std::abs(face.box.width - expected.box.width),
+                                         std::abs(face.box.height - expected.box.height)));
+        float distanceDrift = std::abs(face.distance - expected.distance);
+        float embeddingDrift = 0.f;
+        for (int s = 0; s < SIGNATURE_SIZE; s++)
+            embeddingDrift = std::max(embeddingDrift, std::abs(face.signature[s] - expected.signature[s]));
+        drift.box = std::max(drift.box, boxDrift);
+        drift.distance = std::max(drift.distance, distanceDrift);
+        drift.embedding = std::max(drift.embedding, embeddingDrift);
+        if (face.checksum != expected.checksum)
+            drift.changedChecksums++;
+
+        if (boxDrift > tolerances.box) {
+            std::cout << prefix.str() << "box " << face.box << std::endl;
+            failures++;
+        }
+        if (face.identity != expected.identity) {
+            std::cout << prefix.str() << "identity " << face.identity << ", golden " << expected.identity << std::endl;
+            failures++;
+        }
+        if (distanceDrift > tolerances.distance) {
+            std::cout << prefix.str() << "distance " << face.distance << ", golden " << expected.distance << std::endl;
+            failures++;
+        }
+        if (embeddingDrift > tolerances.embedding) {
+            std::cout << prefix.str() << "embedding moved by at least " << embeddingDrift << std::endl;
+            failures++;
+        }
+    }
+    for (size_t i = 0; i < faces.size(); i++) {
+        if (!paired[i]) {
+            std::cout << "frame " << frame << ", face at " << faces[i].box << ": not in golden file" << std::endl;
+            failures++;
+        }
+    }
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 5) {
+        std::cout << "Usage: ./facenet_replay <model.pb> <enrolment image directory> <video file | image directory> "
+                     "<golden file> [--record] [--frames 100] [--detector cascade] [--cascade <xml>] "
+                     "[--threshold 1] [--box-tolerance 2] [--distance-tolerance 0.02] [--embedding-tolerance 0.02]" <<
+                  std::endl;
+        // a misinvoked gate must not pass
+        return 1;
+    }
+    std::string modelPath = argv[1], imagesPath = argv[2], source = argv[3], goldenPath = argv[4];
+    bool record = false;
+    int maxFrames = 100;
+    float threshold = 1.f;
+    std::string detector = "cascade", cascadePath = "../models/haarcascade_frontalface_default.xml";
+    Tolerances tolerances;
+    for (int a = 5; a < argc; a++) {
+        std::string option = argv[a];
+        if (option == "--record") {
+            record = true;
+            continue;
+        }
+        if (a + 1 >= argc) {
+            std::cerr << "Missing value of " << option << std::endl;
+            return 1;
+        }
+        std::string value = argv[++a];
+        if (option == "--frames") maxFrames = std::atoi(value.c_str());
+        else if (option == "--detector") detector = value;
+        else if (option == "--cascade") cascadePath = value;
+        else if (option == "--threshold") threshold = std::atof(value.c_str());
+        else if (option == "--box-tolerance") tolerances.box = std::atoi(value.c_str());
+        else if (option == "--distance-tolerance") tolerances.distance = std::atof(value.c_str());
+        else if (option == "--embedding-tolerance") tolerances.embedding = std::atof(value.c_str());
+        else std::cerr << "Unknown option " << option << std::endl;
+    }
+
+    // a gate that cannot run says so instead of passing
+    std::vector<std::string> required = {modelPath, imagesPath, source};
+    if (detector.compare(0, 3, "hog") != 0)
+        required.push_back(cascadePath);
+    if (!record)
+        required.push_back(goldenPath);
+    for (const std::string& path : required) {
+        if (!pathExists(path)) {
+            std::cout << "SKIPPED: " << path << " does not exist, see the regression test section of the README" <<
+                      std::endl;
+            return SKIP_EXIT_CODE;
+        }
+    }
+
+    std::vector<cv::Mat> frames;
+    loadFrames(source, maxFrames, frames);
+    if (frames.empty()) {
+        std::cerr << "No frames in " << source << std::endl;
+        return 1;
+    }
+
+    // one thread everywhere and no GPU, so reductions run in the same order on every run and machine
+    SessionConfig sessionConfig;
+    sessionConfig.intraOpThreads = 1;
+    sessionConfig.interOpThreads = 1;
+    sessionConfig.cpuOnly = true;
+    DetectorConfig detectorConfig;
+    detectorConfig.backend = detector.compare(0, 3, "hog") == 0 ? DETECTOR_CPU_HOG : DETECTOR_CPU_CASCADE;
+    detectorConfig.gate.enabled = detector.find("+gate") != std::string::npos;
+    detectorConfig.cascadePath = cascadePath;
+    detectorConfig.numThreads = 1;
+    cv::setNumThreads(1);
+    FaceNetClassifier classifier(modelPath, threshold, detectorConfig, sessionConfig);
+    EnrolmentConfig enrolmentConfig;
+    enrolmentConfig.decodeThreads = 1;
+    enrolmentConfig.detectThreads = 1;
+    enrolmentConfig.progressInterval = 0;
+    classifier.forwardPreprocessing(imagesPath, "", enrolmentConfig);
+
+    std::vector<std::vector<ReplayFace> > replayed(frames.size());
+    FaceResults results;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t f = 0; f < frames.size(); f++) {
+        classifier.process(frames[f], results);
+        for (size_t i = 0; i < results.faceRects.size(); i++) {
+            ReplayFace face;
+            face.box = results.faceRects[i];
+            face.identity = results.classNumbers[i] >= 0 ? classifier.getClassName(results.classNumbers[i]) :
+                            "unknown";
+            // the golden file is whitespace separated
+            std::replace(face.identity.begin(), face.identity.end(), ' ', '_');
+            face.distance = results.distances[i] < std::numeric_limits<float>::max() ? results.distances[i] : -1.f;
+            signEmbedding(results.embeddings.ptr<float>(int(i)), results.embeddings.cols, face);
+            replayed[f].push_back(face);
+        }
+    }
+    double millis = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() -
+                                                                          start).count();
+    std::cout << frames.size() << " frames replayed in " << millis << "ms" << std::endl;
+
+    if (record) {
+        std::ofstream golden(goldenPath);
+        writeGolden(golden, replayed);
+        if (!golden) {
+            std::cerr << "Unable to write " << goldenPath << std::endl;
+            return 1;
+        }
+        std::cout << "Golden file " << goldenPath << " written" << std::endl;
+        return 0;
+    }
+
+    std::ifstream goldenFile(goldenPath);
+    std::vector<std::vector<ReplayFace> > golden;
+    if (!readGolden(goldenFile, golden)) {
+        std::cerr << "Unable to read golden file " << goldenPath << ", write one with --record" << std::endl;
+        return 1;
+    }
+    if (golden.size() != replayed.size()) {
+        std::cout << replayed.size() << " frames replayed, golden file has " << golden.size() << std::endl;
+        return 1;
+    }
+    int failures = 0;
+    Drift drift;
+    for (size_t f = 0; f < replayed.size(); f++)
+        failures += compareFrame(int(f), golden[f], replayed[f], tolerances, drift);
+    std::cout << "largest drift: box " << drift.box << "px, distance " << drift.distance << ", embedding " <<
+              drift.embedding << ", " << drift.changedChecksums << " embeddings changed in the 4th decimal" <<
+              std::endl;
+    if (failures > 0) {
+        std::cout << failures << " differences beyond tolerance" << std::endl;
+        return 1;
+    }
+    std::cout << "Replay matches " << goldenPath << std::endl;
+    return 0;
+}
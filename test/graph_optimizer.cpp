@@ -0,0 +1,155 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "tensorflow/cc/framework/scope.h"
+#include "tensorflow/cc/ops/standard_ops.h"
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/public/session.h"
+#include "GraphOptimizer.h"
+
+/**
+ * Check of the graph optimizer on a small synthetic graph with the structure of the FaceNet model: a convolution with
+ * an inference batch norm, a dropout behind a Switch / Merge on the phase_train placeholder, weights computed from
+ * constants, a pooling and a fully connected layer named embeddings. The graph is optimized, both graphs are run on the
+ * same random batch and the program fails if an output differs by more than the tolerance, or if the batch norm, the
+ * switch or the phase_train placeholder survived. Needs neither a model nor a fixture, so it runs in every build.
+ *
+ * Usage: ./graph_optimizer
+ */
+
+using namespace tensorflow;
+
+static const int batchSize = 4;
+static const int imageSize = 8;
+static const int channels = 3;
+static const int filters = 6;
+static const int embeddingSize = 5;
+static const float tolerance = 1e-4f;
+
+static Tensor randomTensor(const TensorShape& shape, float offset = 0.f) {
+    Tensor tensor(DT_FLOAT, shape);
+    auto values = tensor.flat<float>();
+    // a fixed linear congruential sequence, so every run checks the same numbers
+    uint32_t state = 42u + uint32_t(shape.num_elements());
+    for (int64 i = 0; i < values.size(); i++) {
+        state = state * 1664525u + 1013904223u;
+        values(i) = offset + float(state >> 8) / float(1 << 24) - 0.5f;
+    }
+    return tensor;
+}
+
+static Status buildGraph(GraphDef& graphDef) {
+    Scope root = Scope::NewRootScope();
+    auto input = ops::Placeholder(root.WithOpName("input"), DT_FLOAT);
+    auto phaseTrain = ops::Placeholder(root.WithOpName("phase_train"), DT_BOOL);
+
+    auto conv = ops::Conv2D(root.WithOpName("conv"), input,
+                            ops::Const(root, randomTensor(TensorShape({3, 3, channels, filters}))), {1, 1, 1, 1},
+                            "SAME");
+    // variance and scale are kept away from zero like trained ones
+    auto batchNorm = ops::FusedBatchNorm(root.WithOpName("batch_norm"), conv,
+                                         ops::Const(root, randomTensor(TensorShape({filters}), 1.f)),
+                                         ops::Const(root, randomTensor(TensorShape({filters}))),
+                                         ops::Const(root, randomTensor(TensorShape({filters}))),
+                                         ops::Const(root, randomTensor(TensorShape({filters}), 1.f)),
+                                         ops::FusedBatchNorm::IsTraining(false).Epsilon(0.001f));
+    auto relu = ops::Relu(root.WithOpName("relu"), batchNorm.y);
+
+    // dropout while training, identity for inference
+    auto dropoutSwitch = ops::Switch(root.WithOpName("dropout/switch"), relu, phaseTrain);
+    auto dropped = ops::Mul(root.WithOpName("dropout/train"), dropoutSwitch.output_true, ops::Const(root, 0.5f));
+    auto kept = ops::Identity(root.WithOpName("dropout/inference"), dropoutSwitch.output_false);
+    auto dropout = ops::Merge(root.WithOpName("dropout/merge"), std::vector<Output>{dropped, kept});
+
+    auto pooled = ops::Mean(root.WithOpName("pool"), dropout.output, {1, 2});
+    auto weights = ops::Mul(root.WithOpName("weights"),
+                            ops::Const(root, randomTensor(TensorShape({filters, embeddingSize}))),
+                            ops::Const(root, 2.f));
+    auto bottleneck = ops::MatMul(root.WithOpName("bottleneck"), pooled, weights);
+    ops::Identity(root.WithOpName("embeddings"), bottleneck);
+    return root.ToGraphDef(&graphDef);
+}
+
+static Status runGraph(const GraphDef& graphDef, const std::vector<std::pair<std::string, Tensor> >& feeds,
+                       Tensor& embeddings) {
+    std::unique_ptr<Session> session(NewSession(SessionOptions()));
+    if (!session)
+        return errors::Internal("could not create a session");
+    TF_RETURN_IF_ERROR(session->Create(graphDef));
+    std::vector<Tensor> outputs;
+    TF_RETURN_IF_ERROR(session->Run(feeds, {"embeddings:0"}, {}, &outputs));
+    session->Close();
+    embeddings = outputs[0];
+    return Status::OK();
+}
+
+static int countNodes(const GraphDef& graphDef, const std::string& op) {
+    return int(std::count_if(graphDef.node().begin(), graphDef.node().end(), [&](const NodeDef& node) {
+        return node.op() == op;
+    }));
+}
+
+int main() {
+    GraphDef graphDef, optimized;
+    GraphOptimizerStats stats;
+    Status status = buildGraph(graphDef);
+    if (status.ok())
+        status = optimizeGraph(graphDef, GraphOptimizerConfig(), optimized, stats);
+    if (!status.ok()) {
+        std::cout << "FAILED: " << status.ToString() << std::endl;
+        return 1;
+    }
+    std::cout << "optimized " << stats.nodesBefore << " to " << stats.nodesAfter << " nodes: " <<
+              stats.switchesResolved << " switches resolved, " << stats.batchNormsFolded << " batch norms and " <<
+              stats.constantsFolded << " constants folded" << std::endl;
+
+    Tensor input = randomTensor(TensorShape({batchSize, imageSize, imageSize, channels}));
+    Tensor phaseTrain(DT_BOOL, TensorShape());
+    phaseTrain.scalar<bool>()() = false;
+    Tensor reference, result;
+    status = runGraph(graphDef, {{"input", input}, {"phase_train", phaseTrain}}, reference);
+    if (status.ok())
+        status = runGraph(optimized, {{"input", input}}, result);
+    if (!status.ok()) {
+        std::cout << "FAILED: " << status.ToString() << std::endl;
+        return 1;
+    }
+
+    float maxDifference = 0.f;
+    auto referenceValues = reference.flat<float>();
+    auto resultValues = result.flat<float>();
+    if (referenceValues.size() != resultValues.size()) {
+        std::cout << "FAILED: " << resultValues.size() << " outputs instead of " << referenceValues.size() << std::endl;
+        return 1;
+    }
+    for (int64 i = 0; i < referenceValues.size(); i++)
+        maxDifference = std::max(maxDifference, std::abs(referenceValues(i) - resultValues(i)));
+    std::cout << "max abs difference " << maxDifference << std::endl;
+
+    bool failed = maxDifference > tolerance;
+    if (failed)
+        std::cout << "FAILED: embeddings differ by more than " << tolerance << std::endl;
+    if (stats.batchNormsFolded != 1 || countNodes(optimized, "FusedBatchNorm") > 0) {
+        std::cout << "FAILED: the batch norm was not folded" << std::endl;
+        failed = true;
+    }
+    // of the training branches only the input placeholder may be left
+    if (stats.switchesResolved < 1 || countNodes(optimized, "Switch") + countNodes(optimized, "Merge") +
+                                      countNodes(optimized, "Placeholder") != 1) {
+        std::cout << "FAILED: the dropout switch or phase_train survived" << std::endl;
+        failed = true;
+    }
+    if (stats.constantsFolded < 1 || countNodes(optimized, "Mul") > 0) {
+        std::cout << "FAILED: the weights were not folded" << std::endl;
+        failed = true;
+    }
+    if (failed)
+        return 1;
+    std::cout << "OK" << std::endl;
+    return 0;
+}